@@ -0,0 +1,107 @@
+/*
+ * parsebench - Measure the cost of parseline, with and without
+ * parameter expansion.
+ *
+ * Each case is a pair of command lines that parse to the same words:
+ * one written out, the other using $NAME, ${NAME} and $?. The difference
+ * between their times is what expansion adds to parsing. The last column
+ * is the expanded line again, split into words once (parse_words) and
+ * only expanded each time (parse_expand), as a script runs its lines.
+ *
+ * Usage: ./parsebench [iterations]
+ */
+
+#include <time.h>
+
+#include "tsh_helper.h"
+#include "tsh_env.h"
+
+#define DEFAULT_ITERS 1000000
+
+static const struct {
+    const char *name;
+    const char *plain;          // the line as written out
+    const char *expanded;       // the same line, using expansion
+} cases[] = {
+    { "short",
+      "/bin/echo hello",
+      "/bin/echo $A" },
+    { "mixed",
+      "/bin/ls -l /usr/local/bin world > /tmp/out.txt 2>&1 &",
+      "/bin/ls -l $PREFIX/bin ${B} > $TMP/out.txt 2>&1 &" },
+    { "status",
+      "/bin/test 0 -eq 0 'quoted $A' hello-world",
+      "/bin/test $? -eq 0 'quoted $A' $A-${B}" },
+    { "many",
+      "/bin/echo hello world hello world hello world hello world "
+      "hello world hello world hello world hello world",
+      "/bin/echo $A $B $A $B $A $B $A $B $A $B $A $B $A $B $A $B" },
+};
+
+/* time_parse - Nanoseconds per parseline of cmdline */
+static double time_parse(const char *cmdline, long iters) {
+    struct cmdline_tokens token;
+    struct timespec start, end;
+    long i;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < iters; i++) {
+        if (parseline(cmdline, &token) == PARSELINE_ERROR) {
+            fprintf(stderr, "parsebench: cannot parse: %s\n", cmdline);
+            exit(1);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return ((end.tv_sec - start.tv_sec) * 1e9 +
+            (end.tv_nsec - start.tv_nsec)) / iters;
+}
+
+/* time_expand - Nanoseconds per parse_expand of the words of cmdline */
+static double time_expand(const char *cmdline, long iters) {
+    struct cmdline_tokens token;
+    struct cmdline_words *words;
+    struct timespec start, end;
+    long i;
+
+    if ((words = parse_words(cmdline)) == NULL) {
+        fprintf(stderr, "parsebench: cannot parse: %s\n", cmdline);
+        exit(1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < iters; i++) {
+        parse_expand(cmdline, words, &token);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    parse_words_free(words);
+    return ((end.tv_sec - start.tv_sec) * 1e9 +
+            (end.tv_nsec - start.tv_nsec)) / iters;
+}
+
+int main(int argc, char **argv) {
+    long iters = (argc > 1) ? atol(argv[1]) : DEFAULT_ITERS;
+    double plain, expanded, split;
+    size_t i;
+
+    if (iters <= 0) {
+        fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+        exit(1);
+    }
+
+    env_init(environ);
+    env_set("A", "hello");
+    env_set("B", "world");
+    env_set("PREFIX", "/usr/local");
+    env_set("TMP", "/tmp");
+    set_expansion_params(0, 0);
+
+    printf("%-8s %12s %12s %12s %12s\n", "case", "plain ns", "expanded ns",
+           "added ns", "split ns");
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        plain = time_parse(cases[i].plain, iters);
+        expanded = time_parse(cases[i].expanded, iters);
+        split = time_expand(cases[i].expanded, iters);
+        printf("%-8s %12.1f %12.1f %12.1f %12.1f\n", cases[i].name, plain,
+               expanded, expanded - plain, split);
+    }
+    return 0;
+}
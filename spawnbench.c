@@ -0,0 +1,132 @@
+/*
+ * spawnbench - Measure the latency of launching a command as the shell
+ * grows: forking it directly, and having the zygote fork it.
+ *
+ * For each size, the heap is grown by that many megabytes (touched, so
+ * the pages are mapped), and /bin/true is launched and waited for, first
+ * by fork and execve, then by zygote_spawn. The zygote is started before
+ * the heap grows, as the shell starts it, so its own forks stay cheap.
+ *
+ * Usage: ./spawnbench [iterations]
+ */
+
+#include <time.h>
+
+#include "tsh_zygote.h"
+#include "tsh_env.h"
+
+#define DEFAULT_ITERS 200
+
+static const size_t sizes_mb[] = { 0, 64, 256, 1024 };
+
+static char *const true_argv[] = { "/bin/true", NULL };
+
+/* elapsed_us - Microseconds from start to end */
+static double elapsed_us(const struct timespec *start,
+                         const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1e6 +
+           (end->tv_nsec - start->tv_nsec) / 1e3;
+}
+
+/* wait_child - Reap a launched child, which must have succeeded */
+static void wait_child(pid_t pid) {
+    int status;
+
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "spawnbench: /bin/true failed\n");
+        exit(1);
+    }
+}
+
+/* time_fork - Microseconds per fork, execve and wait */
+static double time_fork(long iters) {
+    struct timespec start, end;
+    pid_t pid;
+    long i;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < iters; i++) {
+        if ((pid = fork()) < 0) {
+            unix_error("fork");
+        }
+        if (pid == 0) {
+            execve(true_argv[0], true_argv, env_envp());
+            _exit(127);
+        }
+        wait_child(pid);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return elapsed_us(&start, &end) / iters;
+}
+
+/* time_zygote - Microseconds per zygote_spawn and wait */
+static double time_zygote(long iters) {
+    struct zygote_spawn req;
+    struct limit_set limits;
+    struct placement place;
+    struct redir_plan plan;
+    struct timespec start, end;
+    pid_t pid;
+    long i;
+
+    memset(&limits, 0, sizeof(limits));
+    memset(&place, 0, sizeof(place));
+    plan.nops = 0;
+    req.argv = true_argv;
+    req.envp = env_envp();
+    req.assigns = NULL;
+    req.nassigns = 0;
+    req.pgid = 0;
+    req.limits = &limits;
+    req.place = &place;
+    req.plan = &plan;
+    req.report_fd = -1;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < iters; i++) {
+        if ((pid = zygote_spawn(&req)) < 0) {
+            unix_error("zygote_spawn");
+        }
+        wait_child(pid);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return elapsed_us(&start, &end) / iters;
+}
+
+int main(int argc, char **argv) {
+    long iters = (argc > 1) ? atol(argv[1]) : DEFAULT_ITERS;
+    double direct, zygote;
+    size_t i, grown = 0, mb;
+    char *block;
+
+    if (iters <= 0) {
+        fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+        exit(1);
+    }
+
+    env_init(environ);
+    if (!zygote_start()) {
+        unix_error("zygote_start");
+    }
+
+    printf("%-8s %12s %12s %12s\n", "heap MB", "fork us", "zygote us",
+           "saved us");
+    for (i = 0; i < sizeof(sizes_mb) / sizeof(sizes_mb[0]); i++) {
+        /* grow the heap to the next size; never freed */
+        mb = sizes_mb[i] - grown;
+        if (mb > 0) {
+            if ((block = malloc(mb << 20)) == NULL) {
+                fprintf(stderr, "spawnbench: cannot grow by %zu MB\n", mb);
+                break;
+            }
+            memset(block, 1, mb << 20);
+            grown = sizes_mb[i];
+        }
+        direct = time_fork(iters);
+        zygote = time_zygote(iters);
+        printf("%-8zu %12.1f %12.1f %12.1f\n", sizes_mb[i], direct, zygote,
+               direct - zygote);
+    }
+    return 0;
+}
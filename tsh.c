@@ -8,6 +8,18 @@
  */
 
 #include "tsh_helper.h"
+#include "tsh_redir.h"
+#include "tsh_timer.h"
+#include "tsh_proc.h"
+#include "tsh_limit.h"
+#include "tsh_governor.h"
+#include "tsh_history.h"
+#include "tsh_env.h"
+#include "tsh_brace.h"
+#include "tsh_script.h"
+#include "tsh_func.h"
+#include "tsh_zygote.h"
+#include "tsh_fork.h"
 #if 0
 #include <assert.h>
 #include <stdio.h>
@@ -18,6 +30,7 @@
 #include <signal.h>
 #include <sys/types.h>
 #include <fcntl.h>
+#include <sys/select.h>
 #include <sys/wait.h>
 #include <errno.h>
 #include "csapp.h"
@@ -41,13 +54,190 @@
 #define dbg_ensures(...)
 #endif
 
+/* Exit status of a job that overran its deadline (as timeout(1)) */
+#define EXIT_TIMEDOUT  124
+
+/* Exit status of a batched command one of whose runs failed (as xargs) */
+#define EXIT_BATCHFAIL  123
+
+/* Room left in ARG_MAX for what the kernel adds, as xargs leaves */
+#define ARG_HEADROOM  2048
+
+/* Max aliases expanded in a row, as an alias may start with another */
+#define MAXALIASDEPTH  16
+
+/* Job selectors of the kill builtin */
+#define KILL_ALL      0x1       // %all
+#define KILL_RUNNING  0x2       // %running: in the background
+#define KILL_STOPPED  0x4       // %stopped
+
+/*
+ * Exit status of the most recent foreground job or wait builtin, in the
+ * usual shell encoding (see shell_status).
+ */
+static int last_status = 0;
+
+/* Pid of the most recent background job, for $! (0 before the first) */
+static pid_t last_bg_pid = 0;
+
+/* Pid of the most recent foreground job, for a command list to check */
+static pid_t last_fg_pid = 0;
+
+/* Set by ctrl-c when there is no foreground job, to interrupt wait */
+static volatile sig_atomic_t wait_interrupted = 0;
+
+/* Running tsh -c: its last command may replace the shell (see tail_exec) */
+static bool tail_exec_ok = false;
+
+/*
+ * In the driver of a command list: the command being waited for, the
+ * signal sent to it at its deadline, and the deadlines passed so far
+ */
+static volatile pid_t list_pid = 0;
+static int list_timeout_sig;
+static volatile sig_atomic_t list_timeouts = 0;
+
+/* In the driver of a command list: signal that killed the last command */
+static int list_signal = 0;
+
+/*
+ * A launch whose status pipe is still open: the child has yet to execute
+ * its command, or to report why it could not (see watch_launch)
+ */
+struct launch_watch
+{
+    pid_t pid;                  // The child, or 0 if the slot is free
+    int fd;                     // Read end of its status pipe, nonblocking
+    char *command;              // Its argv[0], then the paths of the plan
+    struct redir_plan plan;     // Its redirections, the paths copied
+};
+
+static struct launch_watch launch_watches[MAXJOBS];
+static int nwatches = 0;
+
+/* Deadline given to every job without a timeout prefix (0 for none) */
+static long default_timeout_ms = 0;
+static int default_timeout_sig = TIMEOUT_DEFAULT_SIG;
+static long default_grace_ms = TIMEOUT_DEFAULT_GRACE;
+
+/* Resource limits given to every job (the shell itself is not limited) */
+static struct limit_set default_limits;
+
+/*
+ * Per-job settings given by launch prefixes, which may be combined:
+ *     timeout [-s SIG] [-k GRACE] DURATION command ...
+ *     taskset [-c] CPULIST command ...
+ *     nice [-n INCREMENT] command ...
+ *     ionice [-c CLASS] [-n LEVEL] command ...
+ *     ulimit [-v|-t|-n|-u|-c LIMIT] ... command ...
+ * preceded by environment overrides for the command:
+ *     NAME=value ... command ...
+ */
+struct launch_opts
+{
+    long timeout_ms;            // Deadline relative to launch, or 0
+    int timeout_sig;            // Signal sent at the deadline
+    long grace_ms;              // Delay before SIGKILL after the deadline
+    struct placement place;     // CPU affinity, nice value, I/O priority
+    struct limit_set limits;    // Resource limits
+    int nassigns;               // Number of environment overrides
+    char *assigns[MAXARGS];     // NAME=value overrides (into argv)
+};
+
 /* Function prototypes */
 void eval(const char *cmdline);
+static void eval_command(const char *cmdline, struct cmdline_tokens *token,
+                         parseline_return parse_result);
+
+static bool open_history(void);
+static void eval_compound(const char *line, bool emit_prompt);
+static void eval_heredoc(const char *line, bool emit_prompt);
+static bool read_continuation(char **text, size_t *len, bool emit_prompt);
+static int script_eval(const char *cmdline,
+                       const struct cmdline_words *words, int status);
+static int run_command_string(const char *command);
+static void read_ahead(void);
+static void wait_for_input(void);
+static bool expand_aliases(struct cmdline_tokens *token);
+static void call_function(const struct func *func,
+                          struct cmdline_tokens *token);
+
+static void eval_line(const char *cmdline,
+                      const struct cmdline_words *words);
+static void eval_list(const char *cmdline);
+static void run_shell_list(const char *list);
+static void suspend_list(struct job_t *job, const char *text,
+                         const char *rest, list_op op,
+                         const sigset_t *mask);
+static void run_list(const char *list, list_op prev);
+static void list_command(const char *cmd);
+static void list_builtin(struct cmdline_tokens *token,
+                         struct redir_plan *plan);
+static int list_wait(pid_t pid, const struct launch_opts *opts);
+
+static void child_exec(struct cmdline_tokens *token,
+                       const struct launch_opts *opts,
+                       const struct redir_plan *plan, int report_fd);
+static pid_t zygote_launch(struct cmdline_tokens *token,
+                           const struct launch_opts *opts,
+                           const struct redir_plan *plan, int report_fd);
+static pid_t zygote_spawn_request(void *req);
+static bool redirect_shell(struct redir_plan *plan,
+                           struct redir_saved *saved);
+static bool psub_open(struct cmdline_tokens *token, struct redir_plan *plan,
+                      int *cmd_fds, int *helper_fds);
+static void psub_close(int npsubs, int *cmd_fds, int *helper_fds);
+static void psub_start(struct cmdline_tokens *token, pid_t pgid,
+                       int *cmd_fds, int *helper_fds, const sigset_t *mask);
+static void psub_exec(const char *cmd);
+static void exec_batches(struct cmdline_tokens *token, char **envp,
+                         int report_fd);
+static bool exec_succeeded(pid_t pid, int report_fd,
+                           struct cmdline_tokens *token,
+                           const struct redir_plan *plan);
+static void watch_launch(pid_t pid, int report_fd,
+                         const struct cmdline_tokens *token,
+                         const struct redir_plan *plan);
+static int watched_fds(fd_set *fds, int maxfd);
+static void collect_launches(void);
+static void wait_for_signal(const sigset_t *mask);
+static void print_exec_report(const struct exec_report *report,
+                              const char *command,
+                              const struct redir_plan *plan);
+static bool can_tail_exec(const struct cmdline_tokens *token,
+                          const struct launch_opts *opts);
+static void tail_exec(struct cmdline_tokens *token,
+                      const struct launch_opts *opts,
+                      struct redir_plan *plan, const sigset_t *mask);
+static void default_launch_opts(struct launch_opts *opts);
+static bool parse_launch_prefixes(struct cmdline_tokens *token,
+                                  struct launch_opts *opts);
+static void apply_launch_opts(pid_t pid, const struct launch_opts *opts);
+static int shell_status(int status, unsigned flags);
+static long cpu_ms(const struct rusage *usage);
+static int job_status(pid_t pid);
+static struct job_t *parse_jobspec(const char *cmd, const char *spec);
+static bool running_bg_job(void);
+static void builtin_wait(struct cmdline_tokens *token);
+static void builtin_kill(struct cmdline_tokens *token);
+static void builtin_timeout(struct cmdline_tokens *token);
+static void builtin_renice(struct cmdline_tokens *token);
+static void builtin_ulimit(struct cmdline_tokens *token);
+static void builtin_rssguard(struct cmdline_tokens *token);
+static void builtin_throttle(struct cmdline_tokens *token);
+static void builtin_autonice(struct cmdline_tokens *token);
+static void builtin_forkretry(struct cmdline_tokens *token);
+static void builtin_export(struct cmdline_tokens *token);
+static void builtin_source(struct cmdline_tokens *token);
+static void builtin_alias(struct cmdline_tokens *token, const char *cmdline);
+static void builtin_unalias(struct cmdline_tokens *token);
 
 void sigchld_handler(int sig);
 void sigtstp_handler(int sig);
 void sigint_handler(int sig);
 void sigquit_handler(int sig);
+void sigalrm_handler(int sig);
+void list_alarm_handler(int sig);
 
 /*
  * Takes command line arguments and does the following:
@@ -61,13 +251,15 @@ int main(int argc, char **argv) {
     char c;
     char cmdline[MAXLINE_TSH];  // Cmdline for fgets
     bool emit_prompt = true;    // Emit prompt (default)
+    bool use_history;           // Record and expand history
+    const char *command = NULL; // Command string of -c
 
     // Redirect stderr to stdout (so that driver will get all output
     // on the pipe connected to stdout)
     Dup2(STDOUT_FILENO, STDERR_FILENO);
 
     // Parse the command line
-    while ((c = getopt(argc, argv, "hvp")) != EOF) {
+    while ((c = getopt(argc, argv, "hvpc:")) != EOF) {
         switch (c) {
         case 'h':                   // Prints help message
             usage();
@@ -78,15 +270,23 @@ int main(int argc, char **argv) {
         case 'p':                   // Disables prompt printing
             emit_prompt = false;
             break;
+        case 'c':                   // Runs a command string and exits
+            command = optarg;
+            break;
         default:
             usage();
         }
     }
 
-    // Create environment variable
-    if (putenv("MY_ENV=42") < 0) {
-        perror("putenv");
-        exit(1);
+    // Load the environment store and create environment variable
+    env_init(environ);
+    env_set("MY_ENV", "42");
+
+    // Start the fork server, if asked to, while the shell is still small
+    // (not for -c, whose last command replaces the shell)
+    if (command == NULL && getenv("TSH_ZYGOTE") != NULL &&
+        strcmp(getenv("TSH_ZYGOTE"), "0") != 0 && !zygote_start()) {
+        perror("zygote");
     }
 
 
@@ -99,17 +299,30 @@ int main(int argc, char **argv) {
     Signal(SIGTTOU, SIG_IGN);
 
     Signal(SIGQUIT, sigquit_handler);
+    Signal(SIGALRM, sigalrm_handler);  // Handles job deadlines
 
     // Initialize the job list
     init_job_list();
 
+    // Run the command string, if any, instead of reading commands
+    if (command != NULL) {
+        return run_command_string(command);
+    }
+
+    // Open the persistent history, if any
+    use_history = open_history();
+
     // Execute the shell's read/eval loop
     while (true) {
+        // Report the background jobs that could not be launched
+        collect_launches();
+
         if (emit_prompt) {
             printf("%s", prompt);
             fflush(stdout);
         }
 
+        wait_for_input();
         if ((fgets(cmdline, MAXLINE_TSH, stdin) == NULL) && ferror(stdin)) {
             app_error("fgets error");
         }
@@ -125,6 +338,35 @@ int main(int argc, char **argv) {
         // Remove the trailing newline
         cmdline[strlen(cmdline)-1] = '\0';
 
+        // Expand !!, !N and !prefix, and record the command
+        if (use_history) {
+            switch (history_expand(cmdline, MAXLINE_TSH)) {
+            case -1:
+                continue;
+            case 1:
+                printf("%s\n", cmdline);
+                fflush(stdout);
+                break;
+            }
+            if (!isspace((unsigned char)cmdline[0])) {
+                history_add(cmdline);
+            }
+        }
+
+        // A compound command goes on until its closing keyword
+        if (script_is_keyword(cmdline)) {
+            eval_compound(cmdline, emit_prompt);
+            fflush(stdout);
+            continue;
+        }
+
+        // Here-documents go on until their delimiters
+        if (heredoc_pending(cmdline)) {
+            eval_heredoc(cmdline, emit_prompt);
+            fflush(stdout);
+            continue;
+        }
+
         // Evaluate the command line
         eval(cmdline);
 
@@ -152,76 +394,248 @@ int main(int argc, char **argv) {
  * displaying process info differently in each case & handles I/O redirection.
  */
 void eval(const char *cmdline) {
+    list_op op;
+
+    /* Several commands joined by ;, && or || make a command list */
+    split_list(cmdline, &op);
+    if(op != LIST_END && strchr(cmdline, '\n') != NULL)
+    {
+        sio_printf("Error: here-documents cannot be used in a command "
+                   "list\n");
+        return;
+    }
+    if(op != LIST_END)
+    {
+        eval_list(cmdline);
+        return;
+    }
+
+    eval_line(cmdline, NULL);
+}
+
+/*
+ * Evaluates a command line that is not a list, expanding its words (see
+ * parse_words) if it has them, else parsing its text, unless it was
+ * parsed ahead
+ */
+static void eval_line(const char *cmdline, const struct cmdline_words *words)
+{
     parseline_return parse_result;
-    struct cmdline_tokens token;
+    struct cmdline_tokens parsed;
+    struct cmdline_tokens *token;
+
+    set_expansion_params(last_status, last_bg_pid);
+    if((token = parse_take(cmdline, &parse_result)) == NULL)
+    {
+        token = &parsed;
+        parse_result = (words != NULL) ? parse_expand(cmdline, words, token)
+                                       : parseline(cmdline, token);
+    }
+
+    eval_command(cmdline, token, parse_result);
 
-    /* Parse command line */
-    parse_result = parseline(cmdline, &token); 
+    if(token != &parsed)
+    {
+        parse_release(token);
+    }
+}
+
+/*
+ * Runs a command line parsed by parseline (into token, with result
+ * parse_result): a builtin, a function, or a job.
+ */
+static void eval_command(const char *cmdline, struct cmdline_tokens *token,
+                         parseline_return parse_result)
+{
+    const struct func *func;
 
     /* Make Blocking List from empty set*/
     sigset_t proc_mask, suspend_mask, temp;
     pid_t pid;
     int jid;
+    int report_pipe[2];
+
+    /* I/O redirection, applied in the child (or around a builtin) */
+    struct redir_plan plan;
+    struct redir_saved saved;
 
-    /* Handling I/O redirection */ 
-    int in_file = 0;
-    int out_file = 0;
+    /* Settings from launch prefixes */
+    struct launch_opts opts;
 
-    if(token.infile != NULL)
+    /* Pipes of process substitutions: the command's ends, the helpers' */
+    int psub_cmd_fds[MAXPSUBS], psub_helper_fds[MAXPSUBS];
+
+    /* Check for valid parse */
+    if (parse_result == PARSELINE_ERROR || parse_result == PARSELINE_EMPTY) 
+    {
+        return;
+    }
+
+    /* Aliases and functions, each found by a hash probe of the name */
+    if (!expand_aliases(token) || token->argc == 0)
+    {
+        return;
+    }
+    if (token->npsubs > 0 && (token->builtin != BUILTIN_NONE ||
+                             func_find(token->argv[0]) != NULL))
     {
-        in_file = open(token.infile, O_RDONLY, 0);
-        dup2(in_file, STDIN_FILENO);
+        sio_printf("%s: process substitution needs an external command\n",
+                   token->argv[0]);
+        return;
     }
-     if(token.outfile != NULL)
+    if (token->builtin == BUILTIN_NONE &&
+        (func = func_find(token->argv[0])) != NULL)
     {
-        out_file = open(token.outfile, O_RDWR | O_CREAT, 0);
-        dup2(out_file, STDOUT_FILENO);
+        if (parse_result == PARSELINE_BG)
+        {
+            sio_printf("%s: functions cannot be run in the background\n",
+                       token->argv[0]);
+            return;
+        }
+        call_function(func, token);
+        return;
     }
 
-    /* Check for valid parse */
-    if (parse_result == PARSELINE_ERROR || parse_result == PARSELINE_EMPTY) 
+    if (!parse_launch_prefixes(token, &opts))
     {
         return;
     }
+
+    redir_plan_build(token, &plan);
+
     /* Not a builtin command */
-    else if(token.builtin == BUILTIN_NONE)
+    if(token->builtin == BUILTIN_NONE)
     {
         /* Add signals to block to the mask set */
         sigemptyset(&proc_mask);
         sigaddset(&proc_mask, SIGCHLD);
         sigaddset(&proc_mask, SIGINT);
         sigaddset(&proc_mask, SIGTSTP);
+        sigaddset(&proc_mask, SIGALRM);
 
         /* Block {SIGCHLD, SIGINT, SIGTSTP} with empty old blocking set 
          * before forking
          */
         sigprocmask(SIG_BLOCK, &proc_mask, &temp);
 
-        /* forking */
-        pid = fork();
+        /* the last command of tsh -c: the shell becomes the job */
+        if(parse_result == PARSELINE_FG && can_tail_exec(token, &opts))
+        {
+            tail_exec(token, &opts, &plan, &temp);
+            sigprocmask(SIG_SETMASK, &temp, NULL);
+            return;
+        }
+
+        /* the text of here-documents, for the child to read */
+        if(redir_plan_prepare(&plan) < 0)
+        {
+            perror("here-document");
+            sigprocmask(SIG_SETMASK, &temp, NULL);
+            return;
+        }
+
+        /* the pipes of process substitutions */
+        if(!psub_open(token, &plan, psub_cmd_fds, psub_helper_fds))
+        {
+            redir_plan_release(&plan);
+            sigprocmask(SIG_SETMASK, &temp, NULL);
+            return;
+        }
+
+        /* status pipe: closed by a successful execve in the child */
+        if(pipe(report_pipe) < 0)
+        {
+            perror("pipe");
+            redir_plan_release(&plan);
+            psub_close(token->npsubs, psub_cmd_fds, psub_helper_fds);
+            sigprocmask(SIG_SETMASK, &temp, NULL);
+            return;
+        }
+        fcntl(report_pipe[0], F_SETFD, FD_CLOEXEC);
+        fcntl(report_pipe[1], F_SETFD, FD_CLOEXEC);
+
+        /* forking, by the zygote if it can */
+        pid = zygote_launch(token, &opts, &plan, report_pipe[1]);
+        if(pid == 0)
+        {
+            pid = fork_retry();
+            if(pid < 0)
+            {
+                fork_failed(errno);
+            }
+        }
+
+        if(pid != 0)
+        {
+            close(report_pipe[1]);
+            redir_plan_release(&plan);
+        }
+        if(pid > 0)
+        {
+            /* the child's group, as the child sets it: signals sent to the
+             * job from now on find it, and the helpers join it */
+            setpgid(pid, pid);
+        }
+        if(pid > 0 && token->npsubs > 0)
+        {
+            psub_start(token, pid, psub_cmd_fds, psub_helper_fds, &temp);
+        }
+        if(pid != 0)
+        {
+            psub_close(token->npsubs, psub_cmd_fds, psub_helper_fds);
+        }
+        if(pid < 0)
+        {
+            /* nothing was launched */
+            close(report_pipe[0]);
+            last_status = 1;
+            sigprocmask(SIG_SETMASK, &temp, NULL);
+            return;
+        }
 
-        /* parent process received child's pid */
+        /* parent process received child's pid: the job is registered
+         * before the child executes its command, which it may never do
+         * (opening a FIFO, say), and the status pipe is only watched */
         if(pid > 0)
         {
             if(parse_result == PARSELINE_BG)
             {
                 add_job(pid, BG, cmdline);
+                set_command_of_job(find_job_with_pid(pid), token->argv[0]);
+                apply_launch_opts(pid, &opts);
+                governor_demote(find_job_with_pid(pid));
                 jid = find_jid_by_pid(pid);
+                last_bg_pid = pid;
 
                 /* output */
-                sio_printf("[%d] (%d) %s\n", jid, pid, cmdline);
+                sio_printf("[%d] (%d) %s\n", jid, pid,
+                           get_cmdline_of_job(find_job_with_pid(pid)));
+                watch_launch(pid, report_pipe[0], token, &plan);
             }
             else /* FG process, wait to finish */
             {
                 add_job(pid, FG, cmdline);
+                set_command_of_job(find_job_with_pid(pid), token->argv[0]);
+                apply_launch_opts(pid, &opts);
+                watch_launch(pid, report_pipe[0], token, &plan);
+                last_fg_pid = pid;
+
+                /* meanwhile, parse the script lines that follow */
+                read_ahead();
 
-                /* empty mask for sigsuspend */
+                /* empty mask for sigsuspend: ctrl-c and ctrl-z reach the
+                 * job even before it has executed its command */
                 sigemptyset(&suspend_mask);
 
                 while(fg_pid() != 0)
                 {
-                    sigsuspend(&suspend_mask);
+                    wait_for_signal(&suspend_mask);
+                    job_timer_poll();
                 }
+
+                /* a failed launch has reported before its child exited */
+                collect_launches();
+                last_status = job_status(pid);
             }
 
             /* unblock {SIGCHLD, SIGINT, SIGTSTP} signals*/
@@ -230,19 +644,20 @@ void eval(const char *cmdline) {
         /* successful fork */
         else if(pid == 0)
         {
+            close(report_pipe[0]);
+
+            /* until execve, ctrl-c and ctrl-z are for the job, not tsh */
+            Signal(SIGINT, SIG_DFL);
+            Signal(SIGTSTP, SIG_DFL);
+
             /* unblock {SIGCHLD, SIGINT, SIGTSTP} signals*/
             sigprocmask(SIG_SETMASK, &temp, NULL);
 
             /* put child process in new process group */
             Setpgid(0,0);
 
-            /* run */
-            if(execve(token.argv[0], &token.argv[0], environ) < 0)
-            {
-                sio_printf("%s: Command not found. \n", token.argv[0]);
-                return;
-            }
-            return;
+            /* run; never returns into the shell's REPL */
+            child_exec(token, &opts, &plan, report_pipe[1]);
         }
     }
     /* Built in command */
@@ -251,158 +666,3421 @@ void eval(const char *cmdline) {
         /* variables for buultin job */
         struct job_t *built_in_job;
         pid_t b_pid;
-        int b_jid;
 
         /* Add signals to block to the mask set */
         sigemptyset(&proc_mask);
         sigaddset(&proc_mask, SIGCHLD);
         sigaddset(&proc_mask, SIGINT);
         sigaddset(&proc_mask, SIGTSTP);
+        sigaddset(&proc_mask, SIGALRM);
+
+        /* redirect the shell's I/O for the duration of the builtin */
+        if(!redirect_shell(&plan, &saved))
+        {
+            return;
+        }
 
         /* BULTIN QUIT*/
-        if(token.builtin == BUILTIN_QUIT)
+        if(token->builtin == BUILTIN_QUIT)
         {
             exit(0);
         }
         /* BULTIN JOBS*/
-        else if(token.builtin == BUILTIN_JOBS)
+        else if(token->builtin == BUILTIN_JOBS)
         {
             /* Block {SIGCHLD, SIGINT, SIGTSTP} with empty old blocking set*/
             sigprocmask(SIG_BLOCK, &proc_mask, &temp);
 
-            list_jobs(STDOUT_FILENO);
+            if(token->argc > 1 && strcmp(token->argv[1], "-l") == 0)
+            {
+                list_jobs_long(STDOUT_FILENO);
+            }
+            else
+            {
+                list_jobs(STDOUT_FILENO);
+            }
 
             /* unblock {SIGCHLD, SIGINT, SIGTSTP} signals*/
             sigprocmask(SIG_SETMASK, &temp, NULL);
         }
         /* BULTIN BG */
-        else if(token.builtin == BUILTIN_BG)
+        else if(token->builtin == BUILTIN_BG)
         {
             /* Block {SIGCHLD, SIGINT, SIGTSTP} with empty old blocking */
             sigprocmask(SIG_BLOCK, &proc_mask, &temp);
 
-            /* JID is supplied. It starts with '%' */
-            if(token.argv[1][0] == '%')
+            /* the given job, or the current one */
+            built_in_job = parse_jobspec("bg", (token->argc > 1) ?
+                                               token->argv[1] : NULL);
+            if(built_in_job == NULL)
             {
-                /* convert argument to int */
-                b_jid = atoi(&token.argv[1][1]);
+                last_status = 1;
+                sigprocmask(SIG_SETMASK, &temp, NULL);
+                redir_restore(&saved);
+                return;
+            }
+            b_pid = get_pid_of_job(built_in_job);
 
-                built_in_job = find_job_with_jid(b_jid);
-                b_pid = get_pid_of_job(built_in_job);
+            /* a job stopped by the governor is resumed by request: only
+             * the hard RSS limit applies to it from now on */
+            if(get_flags_of_job(built_in_job) & JOB_RSS_STOPPED)
+            {
+                set_flags_of_job(built_in_job,
+                    (get_flags_of_job(built_in_job) & ~JOB_RSS_STOPPED) |
+                    JOB_RSS_EXEMPT);
             }
-            /* PID is supplied */
-            else 
+            /* likewise, a throttled job is no longer throttled */
+            if(get_state_of_job(built_in_job) == TH)
             {
-                /* convert argument to int */
-                b_pid = atoi(token.argv[1]);
-
-                b_jid = find_jid_by_pid(b_pid);
-                built_in_job = find_job_with_pid(b_pid);
+                set_flags_of_job(built_in_job,
+                    get_flags_of_job(built_in_job) | JOB_THROTTLE_EXEMPT);
             }
-           
+            governor_demote(built_in_job);
+
             kill(-b_pid, SIGCONT);
             set_state_of_job(built_in_job, BG);
 
             /* output */
-            sio_printf("[%d] (%d) %s\n", b_jid, b_pid, 
+            sio_printf("[%d] (%d) %s\n", get_jid_of_job(built_in_job), b_pid,
                                             get_cmdline_of_job(built_in_job));
 
             /* unblock {SIGCHLD, SIGINT, SIGTSTP} signals*/
             sigprocmask(SIG_SETMASK, &temp, NULL);
         }
-        else if(token.builtin == BUILTIN_FG)
+        else if(token->builtin == BUILTIN_FG)
         {
             /* Block {SIGCHLD, SIGINT, SIGTSTP} with empty old blocking set */
             sigprocmask(SIG_BLOCK, &proc_mask, &temp);
 
-            /* JID is supplied. It starts with '%' */
-            if(token.argv[1][0] == '%')
+            /* the given job, or the current one */
+            built_in_job = parse_jobspec("fg", (token->argc > 1) ?
+                                               token->argv[1] : NULL);
+            if(built_in_job == NULL)
             {
-                /* convert argument to int */
-                b_jid = atoi(&token.argv[1][1]);
-
-                built_in_job = find_job_with_jid(b_jid);
-                b_pid = get_pid_of_job(built_in_job);
+                last_status = 1;
+                sigprocmask(SIG_SETMASK, &temp, NULL);
+                redir_restore(&saved);
+                return;
             }
-            else
-            {
-                /* convert argument to int */
-                b_pid = atoi(token.argv[1]);
+            b_pid = get_pid_of_job(built_in_job);
 
-                built_in_job = find_job_with_pid(b_pid);
-                b_jid = find_jid_by_pid(b_pid);
+            set_flags_of_job(built_in_job,
+                             get_flags_of_job(built_in_job) & ~JOB_RSS_STOPPED);
+            if(governor_restore(built_in_job) < 0)
+            {
+                sio_printf("fg: %%%d: cannot restore priority: %s\n",
+                           get_jid_of_job(built_in_job), strerror(errno));
             }
-            
+
             kill(-b_pid, SIGCONT);
             set_state_of_job(built_in_job, FG);
+            last_fg_pid = b_pid;
 
             /* empty mask for sugsuspend, wait for it to finish */
             sigemptyset(&suspend_mask);
 
             while(fg_pid() != 0)
             {
-                Sigsuspend(&suspend_mask);
+                wait_for_signal(&suspend_mask);
+                job_timer_poll();
             }
+            collect_launches();
+            last_status = job_status(b_pid);
             
             /* unblock {SIGCHLD, SIGINT, SIGTSTP} signals*/
             sigprocmask(SIG_SETMASK, &temp, NULL);
         }
-    }
-    return;
-}
+        /* BUILTIN WAIT */
+        else if(token->builtin == BUILTIN_WAIT)
+        {
+            /* Block {SIGCHLD, SIGINT, SIGTSTP} with empty old blocking set */
+            sigprocmask(SIG_BLOCK, &proc_mask, &temp);
 
-/*****************
- * Signal handlers
- *****************/
+            builtin_wait(token);
 
-/*
- * Handles SIGCHLD signal. Blocks SIGINT, SIGTSTP and outputs information
- * about termination or stoppage of a process based on status from waitpid
- */
-void sigchld_handler(int sig) 
-{
-    pid_t pid;
-    int status, jid;
-    struct job_t *job;
+            /* unblock {SIGCHLD, SIGINT, SIGTSTP} signals*/
+            sigprocmask(SIG_SETMASK, &temp, NULL);
+        }
+        /* BUILTIN KILL */
+        else if(token->builtin == BUILTIN_KILL)
+        {
+            /* Block {SIGCHLD, SIGINT, SIGTSTP} with empty old blocking set */
+            sigprocmask(SIG_BLOCK, &proc_mask, &temp);
 
-    /* add SIGINT, SIGSTP in mask set to block  */
-    sigset_t proc_mask, temp;
-    sigaddset(&proc_mask, SIGINT);
-    sigaddset(&proc_mask, SIGTSTP);
+            builtin_kill(token);
 
-    /* BLOCK {SIGINT, SIGTSTP} */ 
-    sigprocmask(SIG_BLOCK, &proc_mask, &temp);
+            /* unblock {SIGCHLD, SIGINT, SIGTSTP} signals*/
+            sigprocmask(SIG_SETMASK, &temp, NULL);
+        }
+        /* BUILTIN RENICE */
+        else if(token->builtin == BUILTIN_RENICE)
+        {
+            /* Block {SIGCHLD, SIGINT, SIGTSTP} with empty old blocking set */
+            sigprocmask(SIG_BLOCK, &proc_mask, &temp);
 
-    while((pid = waitpid(-1, &status, WNOHANG | WUNTRACED)) > 0)
-    {
-        /* Child prcess terminated */
-        if(WIFSIGNALED(status))
+            builtin_renice(token);
+
+            /* unblock {SIGCHLD, SIGINT, SIGTSTP} signals*/
+            sigprocmask(SIG_SETMASK, &temp, NULL);
+        }
+        /* BUILTIN ULIMIT (without a command: shell-wide or job limits) */
+        else if(token->builtin == BUILTIN_ULIMIT)
         {
-            jid = find_jid_by_pid(pid);
-            /* output */
-            sio_printf("Job [%d] (%d) terminated by signal %d\n", jid, pid, 
-                WTERMSIG(status));
+            /* Block {SIGCHLD, SIGINT, SIGTSTP} with empty old blocking set */
+            sigprocmask(SIG_BLOCK, &proc_mask, &temp);
 
-            delete_job(pid);
+            builtin_ulimit(token);
+
+            /* unblock {SIGCHLD, SIGINT, SIGTSTP} signals*/
+            sigprocmask(SIG_SETMASK, &temp, NULL);
         }
-        /* Child is stopped */
-        else if(WIFSTOPPED(status))
+        /* BUILTIN RSSGUARD */
+        else if(token->builtin == BUILTIN_RSSGUARD)
         {
-            jid = find_jid_by_pid(pid);
-            /* output */
-            sio_printf("Job [%d] (%d) stopped by signal %d\n", jid, pid, 
-                WSTOPSIG(status));
+            /* Block {SIGCHLD, SIGINT, SIGTSTP} with empty old blocking set */
+            sigprocmask(SIG_BLOCK, &proc_mask, &temp);
 
-            job = find_job_with_pid(pid);
-            set_state_of_job(job, ST);
+            builtin_rssguard(token);
+
+            /* unblock {SIGCHLD, SIGINT, SIGTSTP} signals*/
+            sigprocmask(SIG_SETMASK, &temp, NULL);
         }
-        else
+        /* BUILTIN THROTTLE */
+        else if(token->builtin == BUILTIN_THROTTLE)
         {
-            delete_job(pid);
+            /* Block {SIGCHLD, SIGINT, SIGTSTP} with empty old blocking set */
+            sigprocmask(SIG_BLOCK, &proc_mask, &temp);
+
+            builtin_throttle(token);
+
+            /* unblock {SIGCHLD, SIGINT, SIGTSTP} signals*/
+            sigprocmask(SIG_SETMASK, &temp, NULL);
+        }
+        /* BUILTIN HISTORY */
+        else if(token->builtin == BUILTIN_HISTORY)
+        {
+            history_print(token->argc > 1 ? atoi(token->argv[1]) : 0);
+        }
+        /* BUILTIN EXPORT */
+        else if(token->builtin == BUILTIN_EXPORT)
+        {
+            builtin_export(token);
+        }
+        /* BUILTIN UNSET */
+        else if(token->builtin == BUILTIN_UNSET)
+        {
+            int i;
+            bool funcs = token->argc > 1 && strcmp(token->argv[1], "-f") == 0;
+
+            for(i = funcs ? 2 : 1; i < token->argc; i++)
+            {
+                if(funcs)
+                {
+                    func_remove(token->argv[i]);
+                }
+                else
+                {
+                    env_unset(token->argv[i]);
+                }
+            }
+        }
+        /* BUILTIN ALIAS */
+        else if(token->builtin == BUILTIN_ALIAS)
+        {
+            builtin_alias(token, cmdline);
         }
+        /* BUILTIN UNALIAS */
+        else if(token->builtin == BUILTIN_UNALIAS)
+        {
+            builtin_unalias(token);
+        }
+        /* BUILTIN SOURCE */
+        else if(token->builtin == BUILTIN_SOURCE)
+        {
+            builtin_source(token);
+        }
+        /* BUILTIN AUTONICE */
+        else if(token->builtin == BUILTIN_AUTONICE)
+        {
+            builtin_autonice(token);
+        }
+        /* BUILTIN FORKRETRY */
+        else if(token->builtin == BUILTIN_FORKRETRY)
+        {
+            builtin_forkretry(token);
+        }
+        /* BUILTIN TIMEOUT (without a command: default deadline) */
+        else if(token->builtin == BUILTIN_TIMEOUT)
+        {
+            builtin_timeout(token);
+        }
+
+        /* undo the builtin's redirection */
+        fflush(stdout);
+        redir_restore(&saved);
     }
-    /* UNBLOCK {SIGINT, SIGTSTP} */
-    sigprocmask(SIG_SETMASK, &temp, NULL);
+    return;
+}
+
+/*****************
+ * History
+ *****************/
+
+/*
+ * Opens the history named by $TSH_HISTFILE or $HISTFILE. Without either,
+ * an interactive shell uses ~/.tsh_history and a shell reading a script
+ * or trace keeps no history. Returns true if a history is open.
+ */
+static bool open_history(void)
+{
+    char path[MAXLINE_TSH];
+    const char *file = env_get("TSH_HISTFILE");
+    const char *home;
+
+    if(file == NULL)
+    {
+        file = env_get("HISTFILE");
+    }
+    if(file == NULL)
+    {
+        if(!isatty(STDIN_FILENO) || (home = env_get("HOME")) == NULL ||
+           strlen(home) + sizeof(HISTFILE_DEFAULT) + 1 > sizeof(path))
+        {
+            return false;
+        }
+        sprintf(path, "%s/%s", home, HISTFILE_DEFAULT);
+        file = path;
+    }
+    if(file[0] == '\0')
+    {
+        return false;
+    }
+    return history_open(file);
+}
+
+
+/*
+ * export                     prints the environment
+ * export NAME=value ...      sets environment variables
+ * export NAME ...            does nothing for variables already set (every
+ *                            variable is exported), and sets the others
+ *                            to the empty string
+ */
+static void builtin_export(struct cmdline_tokens *token)
+{
+    char *value;
+    int i;
+
+    if(token->argc == 1)
+    {
+        env_print();
+        return;
+    }
+
+    for(i = 1; i < token->argc; i++)
+    {
+        if((value = strchr(token->argv[i], '=')) != NULL)
+        {
+            *value = '\0';
+            if(!env_set(token->argv[i], value + 1))
+            {
+                sio_printf("export: %s: not a valid identifier\n",
+                           token->argv[i]);
+            }
+            *value = '=';
+        }
+        else if(env_get(token->argv[i]) == NULL &&
+                !env_set(token->argv[i], ""))
+        {
+            sio_printf("export: %s: not a valid identifier\n",
+                       token->argv[i]);
+        }
+    }
+}
+
+
+/*****************
+ * Scripts
+ *****************/
+
+/*
+ * Evaluates a command line of a script, with its words unless they are
+ * NULL, status being that of the script so far, and returns its status
+ */
+static int script_eval(const char *cmdline,
+                       const struct cmdline_words *words, int status)
+{
+    /* background jobs of the script that could not be launched */
+    collect_launches();
+
+    last_status = status;
+    if(words != NULL)
+    {
+        eval_line(cmdline, words);
+    }
+    else
+    {
+        eval(cmdline);
+    }
+    return last_status;
+}
+
+/*
+ * Runs the command string of tsh -c, which may span several lines, as a
+ * script. Returns its exit status, unless its last command replaced the
+ * shell.
+ */
+static int run_command_string(const char *command)
+{
+    struct script *script;
+    int result;
+
+    if((result = script_compile(command, "-c", &script)) != SCRIPT_OK)
+    {
+        if(result == SCRIPT_INCOMPLETE)
+        {
+            fprintf(stderr, "Error: unexpected end of file\n");
+        }
+        return 2;
+    }
+
+    tail_exec_ok = true;
+    last_status = script_run(script, script_eval, 0);
+    script_release(script);
+    return last_status;
+}
+
+/*
+ * Waits at the prompt for a line from the terminal, taking the governor's
+ * samples as they fall due (fgets would go on waiting, as the handlers
+ * restart it) and printing the reports of failed launches as they come. Input from elsewhere is not waited for: the stdio buffer
+ * may already hold the next lines, so samples that fall due then wait
+ * until the next foreground wait or command line.
+ */
+static void wait_for_input(void)
+{
+    sigset_t proc_mask, temp;
+    fd_set fds;
+    int ready;
+
+    if(!isatty(STDIN_FILENO))
+    {
+        return;
+    }
+
+    sigemptyset(&proc_mask);
+    sigaddset(&proc_mask, SIGCHLD);
+    sigaddset(&proc_mask, SIGINT);
+    sigaddset(&proc_mask, SIGTSTP);
+    sigaddset(&proc_mask, SIGALRM);
+    sigprocmask(SIG_BLOCK, &proc_mask, &temp);
+    do
+    {
+        job_timer_poll();
+        FD_ZERO(&fds);
+        FD_SET(STDIN_FILENO, &fds);
+        ready = pselect(watched_fds(&fds, STDIN_FILENO) + 1, &fds, NULL,
+                        NULL, NULL, &temp);
+        if(ready > 0 && !FD_ISSET(STDIN_FILENO, &fds))
+        {
+            /* a background job could not execute its command */
+            collect_launches();
+            ready = 0;
+        }
+    } while(ready == 0 || (ready < 0 && errno == EINTR));
+    sigprocmask(SIG_SETMASK, &temp, NULL);
+}
+
+/*
+ * Parses ahead the command lines of the running script that follow the
+ * foreground job, while it runs, so that when their turn comes they only
+ * cost their launch (see parse_ahead). Nothing is read ahead from stdin,
+ * which the job may be reading.
+ */
+static void read_ahead(void)
+{
+    const char *lines[MAXAHEAD];
+    const struct cmdline_words *words[MAXAHEAD];
+    int i, n = script_peek(lines, words, MAXAHEAD);
+
+    for(i = 0; i < n && parse_ahead(lines[i], words[i]); i++)
+    {
+        continue;
+    }
+}
+
+/*
+ * Reads a line from stdin and appends it to *text, of *len bytes, after
+ * a newline. Returns false at the end of the file.
+ */
+static bool read_continuation(char **text, size_t *len, bool emit_prompt)
+{
+    char next[MAXLINE_TSH];
+    size_t n;
+
+    if(emit_prompt)
+    {
+        printf("> ");
+        fflush(stdout);
+    }
+    if(fgets(next, MAXLINE_TSH, stdin) == NULL)
+    {
+        fprintf(stderr, "Error: unexpected end of file\n");
+        return false;
+    }
+    n = strcspn(next, "\n");
+
+    *text = Realloc(*text, *len + n + 2);
+    (*text)[(*len)++] = '\n';
+    memcpy(*text + *len, next, n);
+    *len += n;
+    (*text)[*len] = '\0';
+    return true;
+}
+
+/*
+ * Reads the rest of the compound command started by line (its lines up
+ * to the closing keyword) from stdin, then compiles and runs it.
+ */
+static void eval_compound(const char *line, bool emit_prompt)
+{
+    struct script *script;
+    size_t len = strlen(line);
+    char *text;
+    int result;
+
+    text = Malloc(len + 1);
+    strcpy(text, line);
+
+    while((result = script_compile(text, NULL, &script)) ==
+          SCRIPT_INCOMPLETE)
+    {
+        if(!read_continuation(&text, &len, emit_prompt))
+        {
+            free(text);
+            return;
+        }
+    }
+    free(text);
+
+    if(result == SCRIPT_OK)
+    {
+        last_status = script_run(script, script_eval, last_status);
+        script_release(script);
+    }
+}
+
+/*
+ * Reads the here-documents of line (its lines up to their delimiters)
+ * from stdin, then evaluates it
+ */
+static void eval_heredoc(const char *line, bool emit_prompt)
+{
+    size_t len = strlen(line);
+    char *text;
+
+    text = Malloc(len + 1);
+    strcpy(text, line);
+
+    while(heredoc_pending(text))
+    {
+        if(!read_continuation(&text, &len, emit_prompt))
+        {
+            free(text);
+            return;
+        }
+    }
+    eval(text);
+    free(text);
+}
+
+/*
+ * source FILE                runs the commands of FILE in the shell
+ * . FILE                     the same
+ */
+static void builtin_source(struct cmdline_tokens *token)
+{
+    struct script *script;
+
+    if(token->argc < 2)
+    {
+        sio_printf("%s: filename argument required\n", token->argv[0]);
+        last_status = 2;
+        return;
+    }
+
+    if((script = script_load(token->argv[1])) == NULL)
+    {
+        last_status = 1;
+        return;
+    }
+    last_status = script_run(script, script_eval, last_status);
+}
+
+
+/*****************
+ * Aliases and functions
+ *****************/
+
+/*
+ * Replaces the command name of a parsed line by the words of its alias,
+ * and so on while the new name is another alias. Returns false if the
+ * words do not fit.
+ */
+static bool expand_aliases(struct cmdline_tokens *token)
+{
+    const struct alias *alias, *prev = NULL;
+    int depth;
+
+    for(depth = 0; depth < MAXALIASDEPTH && token->argc > 0; depth++)
+    {
+        alias = alias_find(token->argv[0]);
+        if(alias == NULL || alias == prev)
+        {
+            break;
+        }
+        if(!parse_splice(token, 0, alias->words, alias->expand,
+                         alias->nwords))
+        {
+            return false;
+        }
+        prev = alias;
+    }
+    return true;
+}
+
+/*
+ * Calls a function in the shell, with its arguments as the positional
+ * parameters and its redirections around the whole body
+ */
+static void call_function(const struct func *func,
+                          struct cmdline_tokens *token)
+{
+    struct script *script = func->script;
+    int entry = func->entry;
+    struct redir_plan plan;
+    struct redir_saved saved;
+    char *const *saved_args;
+    int saved_nargs;
+    char **args;
+    int i, nargs = token->argc - 1;
+
+    redir_plan_build(token, &plan);
+    if(!redirect_shell(&plan, &saved))
+    {
+        last_status = 1;
+        return;
+    }
+
+    /* the words may be in buffers the body's commands parse into */
+    args = Malloc((nargs + 1) * sizeof(args[0]));
+    for(i = 0; i < nargs; i++)
+    {
+        args[i] = Malloc(strlen(token->argv[i + 1]) + 1);
+        strcpy(args[i], token->argv[i + 1]);
+    }
+    args[nargs] = NULL;
+
+    set_positional_params(args, nargs, &saved_args, &saved_nargs);
+    last_status = script_call(script, entry, script_eval, last_status);
+    set_positional_params(saved_args, saved_nargs, &saved_args,
+                          &saved_nargs);
+
+    for(i = 0; i < nargs; i++)
+    {
+        free(args[i]);
+    }
+    free(args);
+
+    fflush(stdout);
+    redir_restore(&saved);
+}
+
+/*
+ * Finds the end of a word of an alias definition, which may be quoted
+ * with ' or " from its start, or after the = of NAME=VALUE
+ */
+static char *alias_word_end(char *p)
+{
+    char *eq;
+
+    if(*p == '\'' || *p == '"')
+    {
+        eq = strchr(p + 1, *p);
+        return (eq != NULL) ? eq + 1 : NULL;
+    }
+    while(*p != '\0' && !isspace((unsigned char)*p))
+    {
+        if(*p == '=' && (p[1] == '\'' || p[1] == '"'))
+        {
+            eq = strchr(p + 2, p[1]);
+            return (eq != NULL) ? eq + 1 : NULL;
+        }
+        p++;
+    }
+    return p;
+}
+
+/*
+ * alias                      prints the aliases
+ * alias NAME=VALUE ...       defines aliases; VALUE may be quoted
+ * alias NAME ...             prints those aliases
+ *
+ * The definitions are read from the command line itself, as parseline
+ * only takes quotes at the start of a word.
+ */
+static void builtin_alias(struct cmdline_tokens *token, const char *cmdline)
+{
+    const struct alias *alias;
+    char *line, *p, *end, *value, *close;
+
+    last_status = 0;
+    if(token->argc == 1)
+    {
+        alias_print();
+        return;
+    }
+
+    line = Malloc(strlen(cmdline) + 1);
+    strcpy(line, cmdline);
+    p = line + strspn(line, " \t");
+    p += strcspn(p, " \t\n");                // past "alias"
+
+    while(*(p += strspn(p, " \t\n")) != '\0' &&
+          strchr("<>&", *p) == NULL)
+    {
+        if((end = alias_word_end(p)) == NULL)
+        {
+            sio_printf("alias: unmatched quote\n");
+            last_status = 1;
+            break;
+        }
+        if(*end != '\0')
+        {
+            *end++ = '\0';
+        }
+
+        if((value = strchr(p, '=')) != NULL)
+        {
+            *value++ = '\0';
+            if((*value == '\'' || *value == '"') &&
+               (close = strrchr(value + 1, *value)) != NULL)
+            {
+                *close = '\0';
+                value++;
+            }
+            if(!alias_define(p, value))
+            {
+                last_status = 1;
+            }
+        }
+        else if((alias = alias_find(p)) != NULL)
+        {
+            printf("alias %s='%s'\n", alias->name, alias->value);
+        }
+        else
+        {
+            sio_printf("alias: %s: not found\n", p);
+            last_status = 1;
+        }
+        p = end;
+    }
+    free(line);
+}
+
+/*
+ * unalias NAME ...           removes aliases
+ * unalias -a                 removes every alias
+ */
+static void builtin_unalias(struct cmdline_tokens *token)
+{
+    int i;
+
+    last_status = 0;
+    if(token->argc > 1 && strcmp(token->argv[1], "-a") == 0)
+    {
+        alias_clear();
+        return;
+    }
+    for(i = 1; i < token->argc; i++)
+    {
+        if(!alias_remove(token->argv[i]))
+        {
+            sio_printf("unalias: %s: not found\n", token->argv[i]);
+            last_status = 1;
+        }
+    }
+}
+
+
+/*****************
+ * Launch helpers
+ *****************/
+
+/*
+ * Runs in a freshly forked child: applies the resource limits, the launch
+ * placement and the redirection plan, and executes the command. On
+ * failure the reason is written to report_fd, which is close-on-exec, and
+ * the child exits without returning to the caller. Only async-signal-safe
+ * calls are made.
+ */
+static void child_exec(struct cmdline_tokens *token,
+                       const struct launch_opts *opts,
+                       const struct redir_plan *plan, int report_fd)
+{
+    struct exec_report report;
+    const struct redir_op *failed_op;
+    char **envp;
+
+    report.redir_op = -1;
+
+    /* resource limits from ulimit, shell-wide or as a prefix */
+    if(limits_apply_self(&opts->limits) < 0)
+    {
+        report.stage = REPORT_LIMIT;
+        report.err = errno;
+        write(report_fd, &report, sizeof(report));
+        _exit(1);
+    }
+
+    /* CPU affinity, nice value and I/O priority from launch prefixes */
+    if(placement_apply_self(&opts->place) < 0)
+    {
+        report.stage = REPORT_PLACE;
+        report.err = errno;
+        write(report_fd, &report, sizeof(report));
+        _exit(1);
+    }
+
+    /* redirect I/O; the shell's own descriptors are untouched */
+    if(redir_plan_exec(plan, NULL, &failed_op) < 0)
+    {
+        report.stage = REPORT_REDIR;
+        report.err = errno;
+        report.redir_op = failed_op - plan->ops;
+        write(report_fd, &report, sizeof(report));
+        _exit(1);
+    }
+
+    envp = env_override(env_envp(), opts->assigns, opts->nassigns);
+    if(token->nbraces > 0)
+    {
+        exec_batches(token, envp, report_fd);
+    }
+    execve(token->argv[0], &token->argv[0], envp);
+
+    report.stage = REPORT_EXEC;
+    report.err = errno;
+    write(report_fd, &report, sizeof(report));
+    _exit(EXIT_NOEXEC);
+}
+
+/*
+ * Has the zygote fork the child of a job, which then does what child_exec
+ * does, and returns its pid; report_fd is the status pipe, as for
+ * child_exec. Returns 0 if the shell is to fork the child itself: there
+ * is no zygote, or it has gone, or the command has brace words (whose
+ * batches are run by the child itself). Returns -1 after printing a
+ * diagnostic if the zygote could not fork.
+ */
+static pid_t zygote_launch(struct cmdline_tokens *token,
+                           const struct launch_opts *opts,
+                           const struct redir_plan *plan, int report_fd)
+{
+    struct zygote_spawn req;
+    pid_t pid;
+
+    if(!zygote_running() || token->nbraces > 0)
+    {
+        return 0;
+    }
+
+    req.argv = token->argv;
+    req.envp = env_envp();
+    req.assigns = opts->assigns;
+    req.nassigns = opts->nassigns;
+    req.pgid = 0;
+    req.limits = &opts->limits;
+    req.place = &opts->place;
+    req.plan = plan;
+    req.report_fd = report_fd;
+
+    if((pid = spawn_retry(zygote_spawn_request, &req)) < 0)
+    {
+        if(!zygote_running())
+        {
+            return 0;
+        }
+        fork_failed(errno);
+    }
+    return pid;
+}
+
+/* zygote_spawn, for spawn_retry */
+static pid_t zygote_spawn_request(void *req)
+{
+    return zygote_spawn(req);
+}
+
+/*
+ * Applies a redirection plan to the shell itself, around a builtin or a
+ * function call, saving what it replaces in saved. The descriptors of
+ * its here-documents are only needed until they are dup2'ed. Returns
+ * false after printing a diagnostic.
+ */
+static bool redirect_shell(struct redir_plan *plan, struct redir_saved *saved)
+{
+    const struct redir_op *failed_op;
+    int result, err;
+
+    if(redir_plan_prepare(plan) < 0)
+    {
+        sio_printf("here-document: %s\n", strerror(errno));
+        return false;
+    }
+    result = redir_plan_exec(plan, saved, &failed_op);
+    err = errno;
+    redir_plan_release(plan);
+    if(result < 0)
+    {
+        redir_strerror(failed_op, err);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Executes argv for exec_batches, in a child or in place. On failure the
+ * reason is written to report_fd, if it is open.
+ */
+static void exec_list(char **argv, char **envp, int report_fd)
+{
+    struct exec_report report;
+
+    execve(argv[0], argv, envp);
+
+    report.stage = REPORT_EXEC;
+    report.err = errno;
+    report.redir_op = -1;
+    if(report_fd >= 0)
+    {
+        write(report_fd, &report, sizeof(report));
+    }
+    _exit(EXIT_NOEXEC);
+}
+
+/*
+ * Runs a command with brace words, in the child, in place of execve. The
+ * words are streamed (see tsh_brace.h) into argument lists that fit in
+ * ARG_MAX, as xargs does: the words before the first brace word and after
+ * the last are repeated in every list, and those in between are shared
+ * out among them in order. A single list is executed directly. Otherwise
+ * each list is run in turn by a child, in this process group, so that
+ * the shell stops, resumes and kills them as one job.
+ *
+ * Only the first run reports a failure to start over report_fd. Exits
+ * with EXIT_BATCHFAIL if a run failed, or dies of the signal that killed
+ * one, which ends the job. Never returns.
+ */
+static void exec_batches(struct cmdline_tokens *token, char **envp,
+                         int report_fd)
+{
+    struct brace_stream stream;
+    struct exec_report report;
+    char **argv;
+    char *strings, *items, *pos;
+    long budget, fixed, used, len;
+    int first, last, nfixed, n, i, status;
+    int first_pipe[2];
+    int result = 0;
+    bool started = false;
+    pid_t pid;
+
+    report.stage = REPORT_EXEC;
+    report.redir_op = -1;
+
+    /* the runs get the default dispositions, which exec would give them */
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGALRM, SIG_DFL);
+
+    /* argv[first..last] are streamed, the words around them are fixed */
+    for(first = 0; token->argv[first] != token->braces[0]; first++)
+    {
+        continue;
+    }
+    last = token->argc - 1;
+    while(token->argv[last] != token->braces[token->nbraces - 1])
+    {
+        last--;
+    }
+
+    /* what ARG_MAX leaves for arguments, and what the fixed words take */
+    budget = sysconf(_SC_ARG_MAX) - ARG_HEADROOM;
+    for(i = 0; envp[i] != NULL; i++)
+    {
+        budget -= strlen(envp[i]) + 1 + sizeof(char *);
+    }
+    fixed = sizeof(char *);
+    for(i = 0; i < token->argc; i++)
+    {
+        if(i < first || i > last)
+        {
+            fixed += strlen(token->argv[i]) + 1 + sizeof(char *);
+        }
+    }
+    if(budget <= fixed)
+    {
+        report.err = E2BIG;
+        write(report_fd, &report, sizeof(report));
+        _exit(EXIT_NOEXEC);
+    }
+
+    /* each streamed word takes at least two bytes and a pointer */
+    strings = mmap(NULL, budget, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    argv = mmap(NULL, (budget / (sizeof(char *) + 2) + token->argc + 2) *
+                      sizeof(char *),
+                PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(strings == MAP_FAILED || argv == MAP_FAILED)
+    {
+        report.err = errno;
+        write(report_fd, &report, sizeof(report));
+        _exit(EXIT_NOEXEC);
+    }
+
+    brace_stream_init(&stream, &token->argv[first], last - first + 1,
+                      token->braces, token->nbraces);
+    items = strings;
+    nfixed = first;
+    memcpy(argv, token->argv, first * sizeof(char *));
+    if(first == 0)
+    {
+        /* the command itself comes from the stream, as in {echo,a,b} */
+        if((len = brace_next(&stream, strings, budget - fixed)) < 0)
+        {
+            report.err = (len == BRACE_END) ? ENOENT : E2BIG;
+            write(report_fd, &report, sizeof(report));
+            _exit(EXIT_NOEXEC);
+        }
+        argv[0] = strings;
+        items += len + 1;
+        fixed += len + 1 + sizeof(char *);
+        nfixed = 1;
+    }
+
+    do
+    {
+        /* fill a list with as many words as fit */
+        n = nfixed;
+        used = fixed;
+        pos = items;
+        len = BRACE_FULL;
+        while(budget - used > (long)sizeof(char *) &&
+              (len = brace_next(&stream, pos,
+                                budget - used - sizeof(char *))) >= 0)
+        {
+            argv[n++] = pos;
+            pos += len + 1;
+            used += len + 1 + sizeof(char *);
+        }
+        if(len == BRACE_FULL && n == nfixed)
+        {
+            /* a word on its own is too long */
+            report.err = E2BIG;
+            write(report_fd, &report, sizeof(report));
+            _exit(started ? EXIT_BATCHFAIL : EXIT_NOEXEC);
+        }
+        for(i = last + 1; i < token->argc; i++)
+        {
+            argv[n++] = token->argv[i];
+        }
+        argv[n] = NULL;
+
+        if(!started && len == BRACE_END)
+        {
+            /* everything fits in one list */
+            exec_list(argv, envp, report_fd);
+        }
+
+        /* the first run reports to us whether the command could be
+         * executed, and we pass that on to the shell */
+        if(!started && pipe(first_pipe) < 0)
+        {
+            report.err = errno;
+            write(report_fd, &report, sizeof(report));
+            _exit(EXIT_NOEXEC);
+        }
+        if((pid = fork_retry()) == 0)
+        {
+            if(!started)
+            {
+                close(first_pipe[0]);
+                fcntl(first_pipe[1], F_SETFD, FD_CLOEXEC);
+            }
+            exec_list(argv, envp, started ? -1 : first_pipe[1]);
+        }
+        if(pid < 0)
+        {
+            report.err = errno;
+            write(report_fd, &report, sizeof(report));
+            _exit(started ? EXIT_BATCHFAIL : EXIT_NOEXEC);
+        }
+        if(!started)
+        {
+            close(first_pipe[1]);
+            while((i = read(first_pipe[0], &report, sizeof(report))) < 0 &&
+                  errno == EINTR)
+            {
+                continue;
+            }
+            close(first_pipe[0]);
+            if(i == sizeof(report))
+            {
+                write(report_fd, &report, sizeof(report));
+                waitpid(pid, &status, 0);
+                _exit(EXIT_NOEXEC);
+            }
+            close(report_fd);
+            report_fd = -1;
+            started = true;
+        }
+
+        while(waitpid(pid, &status, 0) < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(WIFSIGNALED(status))
+        {
+            signal(WTERMSIG(status), SIG_DFL);
+            kill(getpid(), WTERMSIG(status));
+            _exit(128 + WTERMSIG(status));
+        }
+        if(WEXITSTATUS(status) != 0)
+        {
+            result = EXIT_BATCHFAIL;
+        }
+    } while(len != BRACE_END);
+
+    _exit(result);
+}
+
+/*
+ * Waits on the status pipe of a child started by child_exec. Returns true
+ * once the child has executed its command (the pipe was closed by execve).
+ * Otherwise prints the child's diagnostic, reaps it, and returns false.
+ * SIGCHLD must be blocked so the child is not reaped behind our back.
+ */
+static bool exec_succeeded(pid_t pid, int report_fd,
+                           struct cmdline_tokens *token,
+                           const struct redir_plan *plan)
+{
+    struct exec_report report;
+    ssize_t n;
+    int status;
+
+    while((n = read(report_fd, &report, sizeof(report))) < 0 &&
+          errno == EINTR)
+    {
+        continue;
+    }
+    close(report_fd);
+
+    if(n != sizeof(report))
+    {
+        return true;
+    }
+
+    print_exec_report(&report, token->argv[0], plan);
+
+    while(waitpid(pid, &status, 0) < 0 && errno == EINTR)
+    {
+        continue;
+    }
+    last_status = shell_status(status, 0);
+    return false;
+}
+
+/*
+ * Watches the status pipe of pid, a child started by child_exec for a job
+ * already in the job list, rather than wait on it: the child may never get
+ * to execute its command (it may be opening a FIFO that has no writer),
+ * and the shell must go on meanwhile. collect_launches prints its report,
+ * if it fails. Takes report_fd over.
+ */
+static void watch_launch(pid_t pid, int report_fd,
+                         const struct cmdline_tokens *token,
+                         const struct redir_plan *plan)
+{
+    struct launch_watch *watch = NULL;
+    size_t len;
+    char *text;
+    int i;
+
+    for(i = 0; i < MAXJOBS && watch == NULL; i++)
+    {
+        if(launch_watches[i].pid == 0)
+        {
+            watch = &launch_watches[i];
+        }
+    }
+    if(watch == NULL)
+    {
+        /* no more launches than jobs can be pending: there is no job */
+        close(report_fd);
+        return;
+    }
+
+    /* the words of the command line do not outlive it: copy those needed */
+    len = strlen(token->argv[0]) + 1;
+    for(i = 0; i < plan->nops; i++)
+    {
+        if(plan->ops[i].kind == ROP_OPEN)
+        {
+            len += strlen(plan->ops[i].path) + 1;
+        }
+    }
+    watch->command = text = Malloc(len);
+    strcpy(text, token->argv[0]);
+    text += strlen(text) + 1;
+
+    watch->plan = *plan;
+    for(i = 0; i < plan->nops; i++)
+    {
+        watch->plan.ops[i].data = NULL;
+        if(plan->ops[i].kind == ROP_OPEN)
+        {
+            strcpy(text, plan->ops[i].path);
+            watch->plan.ops[i].path = text;
+            text += strlen(text) + 1;
+        }
+    }
+
+    fcntl(report_fd, F_SETFL, O_NONBLOCK);
+    watch->fd = report_fd;
+    watch->pid = pid;
+    nwatches++;
+}
+
+/*
+ * Adds the status pipes of the watched launches to fds, and returns the
+ * highest descriptor in it, given maxfd the highest so far.
+ */
+static int watched_fds(fd_set *fds, int maxfd)
+{
+    int i;
+
+    for(i = 0; i < MAXJOBS && nwatches > 0; i++)
+    {
+        if(launch_watches[i].pid != 0)
+        {
+            FD_SET(launch_watches[i].fd, fds);
+            if(launch_watches[i].fd > maxfd)
+            {
+                maxfd = launch_watches[i].fd;
+            }
+        }
+    }
+    return maxfd;
+}
+
+/*
+ * Reads, without waiting, the status pipes of the watched launches. A
+ * child that could not execute its command has its diagnostic printed and
+ * the helpers of its job killed; a pipe that has been closed, by execve
+ * or by the exit of its child, is no longer watched. Not for handlers.
+ */
+static void collect_launches(void)
+{
+    struct exec_report report;
+    struct launch_watch *watch;
+    sigset_t proc_mask, temp;
+    ssize_t n;
+    int i;
+
+    if(nwatches == 0)
+    {
+        return;
+    }
+
+    sigemptyset(&proc_mask);
+    sigaddset(&proc_mask, SIGCHLD);
+    sigaddset(&proc_mask, SIGINT);
+    sigaddset(&proc_mask, SIGTSTP);
+    sigaddset(&proc_mask, SIGALRM);
+    sigprocmask(SIG_BLOCK, &proc_mask, &temp);
+
+    for(i = 0; i < MAXJOBS && nwatches > 0; i++)
+    {
+        watch = &launch_watches[i];
+        if(watch->pid == 0 ||
+           ((n = read(watch->fd, &report, sizeof(report))) < 0 &&
+            (errno == EAGAIN || errno == EINTR)))
+        {
+            continue;
+        }
+
+        /* a report is smaller than PIPE_BUF: it comes whole or not at all */
+        if(n == sizeof(report))
+        {
+            print_exec_report(&report, watch->command, &watch->plan);
+            kill_helpers(watch->pid, SIGKILL);
+        }
+        close(watch->fd);
+        free(watch->command);
+        watch->pid = 0;
+        nwatches--;
+    }
+
+    sigprocmask(SIG_SETMASK, &temp, NULL);
+}
+
+/*
+ * Waits as sigsuspend(mask) does, but also returns when a watched launch
+ * reports, which it then collects. Signals must be blocked.
+ */
+static void wait_for_signal(const sigset_t *mask)
+{
+    fd_set fds;
+    int maxfd;
+
+    FD_ZERO(&fds);
+    if((maxfd = watched_fds(&fds, -1)) < 0)
+    {
+        sigsuspend(mask);
+        return;
+    }
+    if(pselect(maxfd + 1, &fds, NULL, NULL, NULL, mask) > 0)
+    {
+        collect_launches();
+    }
+}
+
+/*
+ * Prints the diagnostic for command, which could not be executed, as
+ * reported by report.
+ */
+static void print_exec_report(const struct exec_report *report,
+                              const char *command,
+                              const struct redir_plan *plan)
+{
+    if(report->stage == REPORT_LIMIT)
+    {
+        sio_printf("%s: cannot set limits: %s\n", command,
+                   strerror(report->err));
+    }
+    else if(report->stage == REPORT_PLACE)
+    {
+        sio_printf("%s: cannot set placement: %s\n", command,
+                   strerror(report->err));
+    }
+    else if(report->stage == REPORT_REDIR)
+    {
+        redir_strerror(&plan->ops[report->redir_op], report->err);
+    }
+    else if(report->err == ENOENT)
+    {
+        sio_printf("%s: Command not found\n", command);
+    }
+    else
+    {
+        sio_printf("%s: %s\n", command, strerror(report->err));
+    }
+}
+
+/*
+ * Tests whether a foreground job is the last thing tsh -c does: the last
+ * command of the string, outside any function, with no other job left
+ * to wait for. The shell can then execute it in place (see tail_exec)
+ * rather than fork and wait for it, provided nothing in the shell has to
+ * outlive it: a deadline, the helpers of process substitutions, or the
+ * runs of brace words. Signals must be blocked.
+ */
+static bool can_tail_exec(const struct cmdline_tokens *token,
+                          const struct launch_opts *opts)
+{
+    return tail_exec_ok && script_is_last() && token->npsubs == 0 &&
+           token->nbraces == 0 && opts->timeout_ms == 0 &&
+           get_next_job(NULL) == NULL;
+}
+
+/*
+ * Executes the last command of tsh -c in place of the shell, doing in
+ * the shell what child_exec does in a child. The command keeps the
+ * shell's process, and so its process group, and starts with mask, the
+ * signal mask the shell had before blocking signals for the launch; the
+ * shell's handlers are reset by execve, and the signals it ignores stay
+ * ignored, as for its children. Returns only if the command could not be
+ * executed, after printing a diagnostic and undoing the redirections;
+ * the caller then restores mask.
+ */
+static void tail_exec(struct cmdline_tokens *token,
+                      const struct launch_opts *opts,
+                      struct redir_plan *plan, const sigset_t *mask)
+{
+    struct exec_report report;
+    struct redir_saved saved;
+    const struct redir_op *failed_op;
+    char **envp;
+
+    report.redir_op = -1;
+    if(redir_plan_prepare(plan) < 0)
+    {
+        perror("here-document");
+        last_status = 1;
+        return;
+    }
+
+    /* what the shell printed goes out before the descriptors move */
+    fflush(stdout);
+
+    report.stage = REPORT_LIMIT;
+    if(limits_apply_self(&opts->limits) == 0)
+    {
+        report.stage = REPORT_PLACE;
+        if(placement_apply_self(&opts->place) == 0)
+        {
+            report.stage = REPORT_REDIR;
+            if(redir_plan_exec(plan, &saved, &failed_op) == 0)
+            {
+                report.stage = REPORT_EXEC;
+            }
+        }
+    }
+    report.err = errno;
+    redir_plan_release(plan);
+    if(report.stage != REPORT_EXEC)
+    {
+        if(report.stage == REPORT_REDIR)
+        {
+            report.redir_op = failed_op - plan->ops;
+        }
+        print_exec_report(&report, token->argv[0], plan);
+        last_status = 1;
+        return;
+    }
+
+    envp = env_override(env_envp(), opts->assigns, opts->nassigns);
+    sigprocmask(SIG_SETMASK, mask, NULL);
+    execve(token->argv[0], &token->argv[0], envp);
+    report.err = errno;
+
+    redir_restore(&saved);
+    print_exec_report(&report, token->argv[0], plan);
+    last_status = EXIT_NOEXEC;
+}
+
+
+/***************
+ * Process substitution
+ ***************/
+
+/*
+ * Makes a pipe for each process substitution of token. The command's end
+ * is moved above the descriptors redirections can name, kept open across
+ * execve by plan, and named in the substitution's argument; the helper's
+ * end goes to helper_fds. Both are close-on-exec in the shell. Returns
+ * false after printing a diagnostic.
+ */
+static bool psub_open(struct cmdline_tokens *token, struct redir_plan *plan,
+                      int *cmd_fds, int *helper_fds)
+{
+    struct proc_subst *psub;
+    int fds[2], i, end;
+
+    for(i = 0; i < token->npsubs; i++)
+    {
+        psub = &token->psubs[i];
+        if(pipe(fds) < 0)
+        {
+            perror("pipe");
+            psub_close(i, cmd_fds, helper_fds);
+            return false;
+        }
+        end = psub->write ? 1 : 0;
+        cmd_fds[i] = fcntl(fds[end], F_DUPFD_CLOEXEC, 10);
+        helper_fds[i] = fds[1 - end];
+        fcntl(helper_fds[i], F_SETFD, FD_CLOEXEC);
+        close(fds[end]);
+        if(cmd_fds[i] < 0)
+        {
+            perror("fcntl");
+            close(helper_fds[i]);
+            psub_close(i, cmd_fds, helper_fds);
+            return false;
+        }
+        redir_plan_keep(plan, cmd_fds[i]);
+        snprintf(psub->path, PSUB_PATHLEN, "/dev/fd/%d", cmd_fds[i]);
+    }
+    return true;
+}
+
+/* Closes the shell's ends of the pipes of process substitutions */
+static void psub_close(int npsubs, int *cmd_fds, int *helper_fds)
+{
+    int i;
+
+    for(i = 0; i < npsubs; i++)
+    {
+        close(cmd_fds[i]);
+        close(helper_fds[i]);
+    }
+}
+
+/*
+ * Starts the helpers of the process substitutions of token, in process
+ * group pgid, and records them (see add_helper) so that they are listed
+ * and reaped with the job. mask is the signal mask to run them with.
+ * The job's leader is not in the job list yet, so SIGCHLD stays blocked
+ * if a fork is retried.
+ */
+static void psub_start(struct cmdline_tokens *token, pid_t pgid,
+                       int *cmd_fds, int *helper_fds, const sigset_t *mask)
+{
+    struct proc_subst *psub;
+    char text[MAXLINE_TSH];
+    pid_t pid;
+    int i;
+
+    for(i = 0; i < token->npsubs; i++)
+    {
+        psub = &token->psubs[i];
+        if((pid = fork_retry_masked()) < 0)
+        {
+            fork_failed(errno);
+            continue;
+        }
+        if(pid == 0)
+        {
+            /* the default dispositions, which exec would give it */
+            signal(SIGINT, SIG_DFL);
+            signal(SIGTSTP, SIG_DFL);
+            signal(SIGCHLD, SIG_DFL);
+            signal(SIGQUIT, SIG_DFL);
+            signal(SIGALRM, SIG_DFL);
+            sigprocmask(SIG_SETMASK, mask, NULL);
+            setpgid(0, pgid);
+
+            if(dup2(helper_fds[i], psub->write ? STDIN_FILENO
+                                              : STDOUT_FILENO) < 0)
+            {
+                _exit(1);
+            }
+            psub_close(token->npsubs, cmd_fds, helper_fds);
+            psub_exec(psub->cmd);
+        }
+        setpgid(pid, pgid);
+
+        text[0] = psub->write ? '>' : '<';
+        text[1] = '(';
+        strncpy(text + 2, psub->cmd, sizeof(text) - 4);
+        text[sizeof(text) - 2] = '\0';
+        strcat(text, ")");
+        if(!add_helper(pid, pgid, text))
+        {
+            sio_printf("Error: too many process substitutions running\n");
+        }
+    }
+}
+
+/*
+ * Runs the command of a process substitution in a helper, whose end of
+ * the pipe is already its stdin or stdout. Only simple commands of
+ * external programs can be run. Failures are reported by the helper
+ * itself. Never returns.
+ */
+static void psub_exec(const char *cmd)
+{
+    struct cmdline_tokens token;
+    struct redir_plan plan;
+    const struct redir_op *failed_op;
+    parseline_return result;
+    char **envp;
+    list_op op;
+
+    split_list(cmd, &op);
+    result = parseline(cmd, &token);
+    if(result == PARSELINE_ERROR)
+    {
+        _exit(2);
+    }
+    if(result == PARSELINE_EMPTY)
+    {
+        _exit(0);
+    }
+    if(op != LIST_END || result == PARSELINE_BG ||
+       token.builtin != BUILTIN_NONE || token.npsubs > 0)
+    {
+        sio_printf("Error: a process substitution must run a program\n");
+        _exit(2);
+    }
+
+    redir_plan_build(&token, &plan);
+    if(redir_plan_prepare(&plan) < 0)
+    {
+        sio_printf("here-document: %s\n", strerror(errno));
+        _exit(1);
+    }
+    if(redir_plan_exec(&plan, NULL, &failed_op) < 0)
+    {
+        redir_strerror(failed_op, errno);
+        _exit(1);
+    }
+
+    envp = env_envp();
+    if(token.nbraces > 0)
+    {
+        exec_batches(&token, envp, -1);
+    }
+    execve(token.argv[0], token.argv, envp);
+    if(errno == ENOENT)
+    {
+        sio_printf("%s: Command not found\n", token.argv[0]);
+    }
+    else
+    {
+        sio_printf("%s: %s\n", token.argv[0], strerror(errno));
+    }
+    _exit(EXIT_NOEXEC);
+}
+
+
+/***************
+ * Command lists
+ ***************/
+
+/*
+ * Runs a command list: commands joined by ;, && and ||, with an optional
+ * & at the end that puts the whole list in the background. In the
+ * foreground the shell runs the list itself (see run_shell_list). In the
+ * background it is run by a driver, a child that leads the job's process
+ * group and runs the commands in turn in that group (see run_list), so
+ * that the shell stops, resumes and kills the list as one job; the
+ * default deadline and limits then apply to the list as a whole.
+ */
+static void eval_list(const char *cmdline)
+{
+    char list[MAXLINE_TSH];
+    const char *cmd;
+    size_t len, end;
+    list_op op, prev = LIST_SEQ;
+    bool bg = false;
+    sigset_t proc_mask, temp;
+    pid_t pid;
+    int jid;
+    struct launch_opts opts;
+
+    /* a trailing & applies to the whole list */
+    end = strlen(cmdline);
+    while(end > 0 && isspace((unsigned char)cmdline[end - 1]))
+    {
+        end--;
+    }
+    if(end > 1 && cmdline[end - 1] == '&' && cmdline[end - 2] != '&')
+    {
+        bg = true;
+        end--;
+    }
+    if(end >= sizeof(list))
+    {
+        end = sizeof(list) - 1;
+    }
+    memcpy(list, cmdline, end);
+    list[end] = '\0';
+
+    /* && and || need a command on either side */
+    for(cmd = list; ; cmd += len + (op == LIST_SEQ ? 1 : 2), prev = op)
+    {
+        len = split_list(cmd, &op);
+        if(strspn(cmd, " \t\r\n") >= len &&
+           (prev == LIST_AND || prev == LIST_OR ||
+            op == LIST_AND || op == LIST_OR))
+        {
+            fprintf(stderr, "Error: missing command in list\n");
+            return;
+        }
+        if(op == LIST_END)
+        {
+            break;
+        }
+    }
+
+    if(!bg)
+    {
+        run_shell_list(list);
+        return;
+    }
+
+    default_launch_opts(&opts);
+
+    /* Block {SIGCHLD, SIGINT, SIGTSTP, SIGALRM} before forking */
+    sigemptyset(&proc_mask);
+    sigaddset(&proc_mask, SIGCHLD);
+    sigaddset(&proc_mask, SIGINT);
+    sigaddset(&proc_mask, SIGTSTP);
+    sigaddset(&proc_mask, SIGALRM);
+    sigprocmask(SIG_BLOCK, &proc_mask, &temp);
+
+    pid = fork_retry();
+    if(pid < 0)
+    {
+        fork_failed(errno);
+        sigprocmask(SIG_SETMASK, &temp, NULL);
+        return;
+    }
+    if(pid == 0)
+    {
+        sigprocmask(SIG_SETMASK, &temp, NULL);
+
+        /* the driver leads the list's process group */
+        Setpgid(0, 0);
+        last_status = 0;
+        run_list(list, LIST_SEQ);
+    }
+
+    add_job(pid, BG, cmdline);
+    apply_launch_opts(pid, &opts);
+    governor_demote(find_job_with_pid(pid));
+    jid = find_jid_by_pid(pid);
+    last_bg_pid = pid;
+
+    sio_printf("[%d] (%d) %s\n", jid, pid, cmdline);
+
+    sigprocmask(SIG_SETMASK, &temp, NULL);
+}
+
+/*
+ * Runs a command list in the foreground, in the shell itself: its
+ * builtins, assignments and functions act on the shell as they would on
+ * lines of their own, and each external command is a job of its own. A
+ * command killed by ctrl-c ends the list. If ctrl-z stops one, the rest
+ * of the list goes to a driver, and the two make one stopped job (see
+ * suspend_list).
+ */
+static void run_shell_list(const char *list)
+{
+    char cmd[MAXLINE_TSH];
+    const char *rest = list;
+    sigset_t proc_mask, temp;
+    struct job_t *job;
+    bool tail_ok = tail_exec_ok;
+    bool interrupted = false;
+    size_t len;
+    list_op op, prev = LIST_SEQ;
+    int status;
+
+    sigemptyset(&proc_mask);
+    sigaddset(&proc_mask, SIGCHLD);
+    sigaddset(&proc_mask, SIGINT);
+    sigaddset(&proc_mask, SIGTSTP);
+    sigaddset(&proc_mask, SIGALRM);
+
+    /* no command of a list is the last of tsh -c: it must come back */
+    tail_exec_ok = false;
+
+    do
+    {
+        list = rest;
+        len = split_list(list, &op);
+        rest = list + len + (op == LIST_SEQ ? 1 : (op == LIST_END ? 0 : 2));
+        if(prev != LIST_SEQ && (prev == LIST_AND) != (last_status == 0))
+        {
+            prev = op;
+            continue;
+        }
+        prev = op;
+
+        memcpy(cmd, list, len);
+        cmd[len] = '\0';
+        last_fg_pid = 0;
+        wait_interrupted = 0;
+        eval_line(cmd, NULL);
+        fflush(stdout);
+
+        sigprocmask(SIG_BLOCK, &proc_mask, &temp);
+        if(last_fg_pid != 0 &&
+           (job = find_job_with_pid(last_fg_pid)) != NULL &&
+           get_state_of_job(job) == ST)
+        {
+            if(op != LIST_END)
+            {
+                suspend_list(job, list, rest, op, &temp);
+            }
+            sigprocmask(SIG_SETMASK, &temp, NULL);
+            break;
+        }
+        interrupted = wait_interrupted ||
+                      (last_fg_pid != 0 &&
+                       find_job_status(last_fg_pid, &status, NULL) &&
+                       WIFSIGNALED(status) && WTERMSIG(status) == SIGINT);
+        sigprocmask(SIG_SETMASK, &temp, NULL);
+    } while(op != LIST_END && !interrupted);
+
+    tail_exec_ok = tail_ok;
+}
+
+/*
+ * Makes the rest of a command list one job with job, one of its commands,
+ * stopped by ctrl-z. A driver joins the job's process group, waits for
+ * the shell to relay the status of that command once it has ended, and
+ * then runs rest, which follows operator op, as run_list does. text is
+ * the list from the stopped command on, for jobs to show. Signals must
+ * be blocked; mask is the mask to restore in the driver.
+ */
+static void suspend_list(struct job_t *job, const char *text,
+                         const char *rest, list_op op,
+                         const sigset_t *mask)
+{
+    pid_t pgid = get_pid_of_job(job);
+    pid_t pid;
+    int relay[2], status;
+    ssize_t n;
+
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, relay) < 0)
+    {
+        perror("socketpair");
+        return;
+    }
+    fcntl(relay[0], F_SETFD, FD_CLOEXEC);
+    fcntl(relay[1], F_SETFD, FD_CLOEXEC);
+
+    if((pid = fork_retry()) < 0)
+    {
+        fork_failed(errno);
+        close(relay[0]);
+        close(relay[1]);
+        return;
+    }
+    if(pid == 0)
+    {
+        close(relay[0]);
+
+        /* ctrl-z is for the stopped command, until it has ended */
+        Signal(SIGINT, SIG_DFL);
+        Signal(SIGTSTP, SIG_IGN);
+        setpgid(0, pgid);
+        sigprocmask(SIG_SETMASK, mask, NULL);
+
+        while((n = read(relay[1], &status, sizeof(status))) < 0 &&
+              errno == EINTR)
+        {
+            continue;
+        }
+        if(n != sizeof(status))
+        {
+            _exit(1);
+        }
+        last_status = shell_status(status, 0);
+        list_signal = WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+        run_list(rest, op);
+    }
+
+    close(relay[1]);
+    setpgid(pid, pgid);
+    set_driver_of_job(job, pid, relay[0]);
+    set_cmdline_of_job(job, text);
+}
+
+/*
+ * Runs the commands of a command list in turn, in its driver, and exits
+ * with the status of the last one run. A command after && runs only if
+ * the status so far, last_status, is 0, and one after || only if it is
+ * not; prev is the operator before list (LIST_SEQ at its start). If the
+ * last command was killed by a signal, the driver dies of it as well so
+ * that the shell reports the job as killed. Never returns.
+ */
+static void run_list(const char *list, list_op prev)
+{
+    char cmd[MAXLINE_TSH];
+    size_t len;
+    list_op op;
+    int sig;
+
+    /* the commands get the default dispositions, which exec gives them;
+     * SIGALRM only marks the deadline of the command being waited for */
+    Signal(SIGINT, SIG_DFL);
+    Signal(SIGTSTP, SIG_DFL);
+    Signal(SIGCHLD, SIG_DFL);
+    Signal(SIGQUIT, SIG_DFL);
+    Signal(SIGALRM, list_alarm_handler);
+
+    /* the default deadline is the list job's, kept by the shell: only a
+     * timeout prefix gives a command of the list a deadline of its own */
+    default_timeout_ms = 0;
+
+    while(true)
+    {
+        len = split_list(list, &op);
+        if(prev == LIST_SEQ || (prev == LIST_AND) == (last_status == 0))
+        {
+            memcpy(cmd, list, len);
+            cmd[len] = '\0';
+            list_command(cmd);
+        }
+        if(op == LIST_END)
+        {
+            break;
+        }
+        list += len + (op == LIST_SEQ ? 1 : 2);
+        prev = op;
+    }
+
+    fflush(stdout);
+    if(list_signal != 0)
+    {
+        sig = list_signal;
+        Signal(sig, SIG_DFL);
+        kill(getpid(), sig);
+    }
+    _exit(last_status);
+}
+
+/*
+ * Runs one command of a command list in its driver, and sets last_status
+ * to its status. An external command is run by a child in the driver's
+ * process group and waited for, unless it ends in &. A timeout prefix
+ * is enforced by the driver; the default deadline is not applied again.
+ */
+static void list_command(const char *cmd)
+{
+    parseline_return parse_result;
+    struct cmdline_tokens token;
+    struct launch_opts opts;
+    struct redir_plan plan;
+    int report_pipe[2];
+    pid_t pid;
+    int i;
+
+    list_signal = 0;
+    set_expansion_params(last_status, last_bg_pid);
+    parse_result = parseline(cmd, &token);
+    if(parse_result == PARSELINE_ERROR || !expand_aliases(&token))
+    {
+        last_status = 1;
+        return;
+    }
+    if(parse_result == PARSELINE_EMPTY || token.argc == 0)
+    {
+        return;
+    }
+    if(token.builtin == BUILTIN_NONE && func_find(token.argv[0]) != NULL)
+    {
+        sio_printf("%s: functions cannot be run in a command list\n",
+                   token.argv[0]);
+        last_status = 1;
+        return;
+    }
+    if(token.npsubs > 0)
+    {
+        sio_printf("%s: process substitution cannot be used in a command "
+                   "list\n", token.argv[0]);
+        last_status = 1;
+        return;
+    }
+
+    if(!parse_launch_prefixes(&token, &opts))
+    {
+        /* only assignments without a command succeed */
+        for(i = 0; i < token.argc && env_is_assignment(token.argv[i]); i++)
+        {
+            continue;
+        }
+        last_status = (i == token.argc) ? 0 : 1;
+        return;
+    }
+
+    redir_plan_build(&token, &plan);
+
+    if(token.builtin != BUILTIN_NONE)
+    {
+        list_builtin(&token, &plan);
+        return;
+    }
+
+    if(redir_plan_prepare(&plan) < 0)
+    {
+        perror("here-document");
+        last_status = 1;
+        return;
+    }
+    if(pipe(report_pipe) < 0)
+    {
+        perror("pipe");
+        redir_plan_release(&plan);
+        last_status = 1;
+        return;
+    }
+    fcntl(report_pipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(report_pipe[1], F_SETFD, FD_CLOEXEC);
+
+    if((pid = fork_retry()) < 0)
+    {
+        fork_failed(errno);
+        close(report_pipe[0]);
+        close(report_pipe[1]);
+        redir_plan_release(&plan);
+        last_status = 1;
+        return;
+    }
+    if(pid == 0)
+    {
+        close(report_pipe[0]);
+        child_exec(&token, &opts, &plan, report_pipe[1]);
+    }
+    close(report_pipe[1]);
+    redir_plan_release(&plan);
+
+    if(!exec_succeeded(pid, report_pipe[0], &token, &plan))
+    {
+        return;
+    }
+    if(parse_result == PARSELINE_BG)
+    {
+        last_bg_pid = pid;
+        last_status = 0;
+        return;
+    }
+    last_status = list_wait(pid, &opts);
+}
+
+/*
+ * Runs a builtin in the driver of a command list: one in the background,
+ * or the rest of one that was suspended. Only those that do not act on
+ * jobs or on the shell itself can be: their effects last until the end
+ * of the list.
+ */
+static void list_builtin(struct cmdline_tokens *token,
+                         struct redir_plan *plan)
+{
+    struct redir_saved saved;
+    int i;
+
+    if(token->builtin != BUILTIN_EXPORT && token->builtin != BUILTIN_UNSET &&
+       token->builtin != BUILTIN_HISTORY)
+    {
+        sio_printf("%s: cannot be run in a command list\n", token->argv[0]);
+        last_status = 1;
+        return;
+    }
+
+    if(!redirect_shell(plan, &saved))
+    {
+        last_status = 1;
+        return;
+    }
+
+    if(token->builtin == BUILTIN_EXPORT)
+    {
+        builtin_export(token);
+    }
+    else if(token->builtin == BUILTIN_UNSET)
+    {
+        for(i = 1; i < token->argc; i++)
+        {
+            env_unset(token->argv[i]);
+        }
+    }
+    else
+    {
+        history_print(token->argc > 1 ? atoi(token->argv[1]) : 0);
+    }
+    last_status = 0;
+
+    fflush(stdout);
+    redir_restore(&saved);
+}
+
+/*
+ * Waits for a command of a command list and returns its status. At the
+ * deadline of a timeout prefix, list_alarm_handler signals the command,
+ * and again with SIGKILL once each grace period has passed.
+ */
+static int list_wait(pid_t pid, const struct launch_opts *opts)
+{
+    struct itimerval timer;
+    int status = 0;
+
+    list_pid = pid;
+    list_timeout_sig = opts->timeout_sig;
+    list_timeouts = 0;
+
+    timer.it_value.tv_sec = opts->timeout_ms / 1000;
+    timer.it_value.tv_usec = (opts->timeout_ms % 1000) * 1000;
+    timer.it_interval.tv_sec = opts->grace_ms / 1000;
+    timer.it_interval.tv_usec = (opts->grace_ms % 1000) * 1000;
+    if(opts->timeout_ms > 0)
+    {
+        setitimer(ITIMER_REAL, &timer, NULL);
+    }
+
+    while(waitpid(pid, &status, 0) < 0 && errno == EINTR)
+    {
+        continue;
+    }
+
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_REAL, &timer, NULL);
+    list_pid = 0;
+
+    if(list_timeouts > 0)
+    {
+        return shell_status(status, JOB_TIMEDOUT);
+    }
+    if(WIFSIGNALED(status))
+    {
+        list_signal = WTERMSIG(status);
+    }
+    return shell_status(status, 0);
+}
+
+
+/*****************
+ * Launch prefixes
+ *****************/
+
+/*
+ * Scans the options of a timeout prefix or builtin starting at argv[1]:
+ *     -s SIG     signal sent at the deadline
+ *     -k GRACE   delay before the follow-up SIGKILL (0 for none)
+ *     -d DURATION
+ *                set the default deadline instead of running a command
+ * Returns the index of the first operand, or -1 after printing a
+ * diagnostic if an option is malformed.
+ */
+static int parse_timeout_options(struct cmdline_tokens *token, int *sig,
+                                 long *grace_ms, long *default_ms)
+{
+    int i;
+
+    for(i = 1; i < token->argc && token->argv[i][0] == '-'; i++)
+    {
+        if(strcmp(token->argv[i], "-d") == 0 && i + 1 < token->argc)
+        {
+            if(!parse_duration_ms(token->argv[++i], default_ms))
+            {
+                sio_printf("timeout: %s: invalid duration\n",
+                           token->argv[i]);
+                return -1;
+            }
+        }
+        else if(strcmp(token->argv[i], "-s") == 0 && i + 1 < token->argc)
+        {
+            if((*sig = parse_signal(token->argv[++i])) < 0)
+            {
+                sio_printf("timeout: %s: invalid signal\n", token->argv[i]);
+                return -1;
+            }
+        }
+        else if(strcmp(token->argv[i], "-k") == 0 && i + 1 < token->argc)
+        {
+            if(!parse_duration_ms(token->argv[++i], grace_ms))
+            {
+                sio_printf("timeout: %s: invalid duration\n",
+                           token->argv[i]);
+                return -1;
+            }
+        }
+        else
+        {
+            sio_printf("timeout: %s: invalid option\n", token->argv[i]);
+            return -1;
+        }
+    }
+    return i;
+}
+
+/*
+ * Parses a timeout prefix. Returns the index of the command that follows
+ * it, 0 if this is the timeout builtin itself (no command, or -d), or -1
+ * after printing a diagnostic.
+ */
+static int parse_timeout_prefix(struct cmdline_tokens *token,
+                                struct launch_opts *opts)
+{
+    int first;
+    long default_ms = -1;
+
+    first = parse_timeout_options(token, &opts->timeout_sig,
+                                  &opts->grace_ms, &default_ms);
+    if(first < 0)
+    {
+        return -1;
+    }
+    if(default_ms >= 0 || first + 1 >= token->argc)
+    {
+        return 0;
+    }
+    if(!parse_duration_ms(token->argv[first], &opts->timeout_ms))
+    {
+        sio_printf("timeout: %s: invalid duration\n", token->argv[first]);
+        return -1;
+    }
+    return first + 1;
+}
+
+/*
+ * Scans the options of a ulimit prefix or builtin starting at argv[1]
+ * into set: -v KBYTES, -t SECONDS, -n FILES, -u PROCESSES, -c KBYTES,
+ * each also accepting "unlimited". Returns the index of the first operand,
+ * or -1 after printing a diagnostic if an option is malformed.
+ */
+static int parse_ulimit_options(struct cmdline_tokens *token,
+                                struct limit_set *set)
+{
+    int i, kind;
+
+    for(i = 1; i < token->argc && token->argv[i][0] == '-'; i += 2)
+    {
+        kind = (token->argv[i][2] == '\0')
+               ? limit_kind_of(token->argv[i][1]) : -1;
+        if(kind < 0 || i + 1 >= token->argc)
+        {
+            sio_printf("ulimit: %s: invalid option\n", token->argv[i]);
+            return -1;
+        }
+        if(!parse_limit(kind, token->argv[i + 1], set))
+        {
+            sio_printf("ulimit: %s: invalid limit\n", token->argv[i + 1]);
+            return -1;
+        }
+    }
+    return i;
+}
+
+/* Returns true if arg names a job (%jid or pid) rather than a command */
+static bool is_jobspec(const char *arg)
+{
+    return arg[0] == '%' || (isdigit((unsigned char)arg[0]) &&
+                             strspn(arg, "0123456789") == strlen(arg));
+}
+
+/*
+ * Parses a ulimit prefix into opts->limits. Returns the index of the
+ * command that follows it, 0 if this is the ulimit builtin itself (no
+ * command, or job operands), or -1 after printing a diagnostic.
+ */
+static int parse_ulimit_prefix(struct cmdline_tokens *token,
+                               struct launch_opts *opts)
+{
+    struct limit_set set;
+    int first;
+
+    set.mask = 0;
+    first = parse_ulimit_options(token, &set);
+    if(first < 0)
+    {
+        return -1;
+    }
+    if(first >= token->argc || is_jobspec(token->argv[first]))
+    {
+        return 0;
+    }
+    limit_merge(&opts->limits, &set);
+    return first;
+}
+
+/*
+ * Parses a taskset, nice or ionice prefix into opts->place. Returns the
+ * index of the command that follows it, or -1 after printing a diagnostic.
+ */
+static int parse_placement_prefix(struct cmdline_tokens *token,
+                                  struct launch_opts *opts)
+{
+    struct placement *place = &opts->place;
+    const char *cmd = token->argv[0];
+    char *end;
+    long value;
+    int i = 1;
+
+    if(strcmp(cmd, "taskset") == 0)
+    {
+        if(i < token->argc && strcmp(token->argv[i], "-c") == 0)
+        {
+            i++;
+        }
+        if(i >= token->argc || !parse_cpulist(token->argv[i], place))
+        {
+            sio_printf("taskset: invalid CPU list\n");
+            return -1;
+        }
+        return i + 1;
+    }
+
+    if(strcmp(cmd, "nice") == 0)
+    {
+        value = 10;
+        if(i + 1 < token->argc && strcmp(token->argv[i], "-n") == 0)
+        {
+            value = strtol(token->argv[i + 1], &end, 10);
+            if(*end != '\0' || end == token->argv[i + 1])
+            {
+                sio_printf("nice: %s: invalid increment\n",
+                           token->argv[i + 1]);
+                return -1;
+            }
+            i += 2;
+        }
+        errno = 0;
+        place->nice = getpriority(PRIO_PROCESS, 0) + (int)value;
+        place->nice = (place->nice < -20) ? -20 :
+                      (place->nice > 19) ? 19 : place->nice;
+        place->flags |= PLACE_NICE;
+        return i;
+    }
+
+    /* ionice */
+    place->io_class = IOCLASS_BE;
+    place->io_level = 4;
+    while(i + 1 < token->argc && token->argv[i][0] == '-')
+    {
+        if(strcmp(token->argv[i], "-c") == 0 &&
+           parse_ioclass(token->argv[i + 1], place))
+        {
+            i += 2;
+        }
+        else if(strcmp(token->argv[i], "-n") == 0 &&
+                (value = strtol(token->argv[i + 1], &end, 10)) >= 0 &&
+                value <= 7 && *end == '\0')
+        {
+            place->io_level = (int)value;
+            i += 2;
+        }
+        else
+        {
+            sio_printf("ionice: %s %s: invalid option\n", token->argv[i],
+                       token->argv[i + 1]);
+            return -1;
+        }
+    }
+    place->flags |= PLACE_IOPRIO;
+    return i;
+}
+
+/*
+ * Sets opts to the shell-wide defaults given to a job without prefixes.
+ */
+static void default_launch_opts(struct launch_opts *opts)
+{
+    opts->timeout_ms = default_timeout_ms;
+    opts->timeout_sig = default_timeout_sig;
+    opts->grace_ms = default_grace_ms;
+    opts->place.flags = 0;
+    opts->limits = default_limits;
+    opts->nassigns = 0;
+}
+
+/*
+ * Consumes the launch prefixes at the start of token->argv, records their
+ * settings in opts (starting from the shell-wide defaults), and classifies
+ * the command that follows them. A timeout or ulimit without a command is
+ * left in place to be run as a builtin. NAME=value overrides at the very
+ * start are recorded too, or, without a command, set in the environment.
+ * Returns false after printing a diagnostic if a prefix is malformed or
+ * applied to a builtin, or if there is nothing left to run.
+ */
+static bool parse_launch_prefixes(struct cmdline_tokens *token,
+                                  struct launch_opts *opts)
+{
+    int first;
+    char *value;
+    bool prefixed = false;
+
+    default_launch_opts(opts);
+
+    /* environment overrides, or assignments without a command */
+    for(opts->nassigns = 0; opts->nassigns < token->argc &&
+        opts->nassigns < MAXARGS &&
+        env_is_assignment(token->argv[opts->nassigns]); opts->nassigns++)
+    {
+        opts->assigns[opts->nassigns] = token->argv[opts->nassigns];
+    }
+    if(opts->nassigns == token->argc)
+    {
+        for(first = 0; first < opts->nassigns; first++)
+        {
+            value = strchr(opts->assigns[first], '=');
+            *value = '\0';
+            env_set(opts->assigns[first], value + 1);
+            *value = '=';
+        }
+        return false;
+    }
+    if(opts->nassigns > 0)
+    {
+        first = opts->nassigns;
+        memmove(&token->argv[0], &token->argv[first],
+                (token->argc - first + 1) * sizeof(token->argv[0]));
+        token->argc -= first;
+        token->builtin = lookup_builtin(token->argv[0]);
+        prefixed = true;
+    }
+
+    while(true)
+    {
+        if(token->builtin == BUILTIN_TIMEOUT)
+        {
+            first = parse_timeout_prefix(token, opts);
+            if(first == 0)
+            {
+                /* not a prefix: the timeout builtin itself */
+                break;
+            }
+        }
+        else if(token->builtin == BUILTIN_ULIMIT)
+        {
+            first = parse_ulimit_prefix(token, opts);
+            if(first == 0)
+            {
+                /* not a prefix: the ulimit builtin itself */
+                break;
+            }
+        }
+        else if(strcmp(token->argv[0], "taskset") == 0 ||
+                strcmp(token->argv[0], "nice") == 0 ||
+                strcmp(token->argv[0], "ionice") == 0)
+        {
+            first = parse_placement_prefix(token, opts);
+            if(first >= token->argc)
+            {
+                sio_printf("%s: missing command\n", token->argv[0]);
+                return false;
+            }
+        }
+        else
+        {
+            break;
+        }
+        if(first < 0)
+        {
+            return false;
+        }
+
+        /* drop the prefix from argv */
+        memmove(&token->argv[0], &token->argv[first],
+                (token->argc - first + 1) * sizeof(token->argv[0]));
+        token->argc -= first;
+        token->builtin = lookup_builtin(token->argv[0]);
+        prefixed = true;
+    }
+
+    if(prefixed && token->builtin != BUILTIN_NONE)
+    {
+        sio_printf("%s: cannot be run with a launch prefix\n",
+                   token->argv[0]);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Applies the settings of the launch prefixes to the newly added job led
+ * by pid. Signals must be blocked.
+ */
+static void apply_launch_opts(pid_t pid, const struct launch_opts *opts)
+{
+    struct job_t *job = find_job_with_pid(pid);
+    struct job_timeout *timeout;
+    long cpu_limit;
+
+    if(job == NULL)
+    {
+        return;
+    }
+
+    /* remember the limit that can explain the job's death */
+    if(limit_cpu_of(&opts->limits, &cpu_limit))
+    {
+        set_cpu_limit_of_job(job, cpu_limit);
+    }
+
+    if(opts->timeout_ms > 0)
+    {
+        timeout = get_timeout_of_job(job);
+        timeout->deadline_ms = timer_now_ms() + opts->timeout_ms;
+        timeout->sig = opts->timeout_sig;
+        timeout->grace_ms = opts->grace_ms;
+    }
+
+    /* the first job also starts the governor's sampling */
+    job_timer_arm();
+}
+
+/*
+ * timeout                               prints the default deadline
+ * timeout -d DURATION [-s SIG] [-k GRACE]
+ *                                       sets the deadline given to every
+ *                                       job launched without a prefix
+ *                                       (DURATION 0 disables it)
+ */
+static void builtin_timeout(struct cmdline_tokens *token)
+{
+    int first, sig = default_timeout_sig;
+    long grace_ms = default_grace_ms;
+    long timeout_ms = -1;
+
+    first = parse_timeout_options(token, &sig, &grace_ms, &timeout_ms);
+    if(first < 0)
+    {
+        return;
+    }
+
+    if(first == 1 && token->argc == 1)
+    {
+        if(default_timeout_ms == 0)
+        {
+            printf("timeout: no default deadline\n");
+        }
+        else
+        {
+            printf("timeout: default deadline %ldms, signal %d, "
+                   "grace %ldms\n", default_timeout_ms,
+                   default_timeout_sig, default_grace_ms);
+        }
+        return;
+    }
+
+    if(timeout_ms < 0 || first != token->argc)
+    {
+        sio_printf("usage: timeout [-s SIG] [-k GRACE] DURATION command"
+                   " | timeout -d DURATION [-s SIG] [-k GRACE]\n");
+        return;
+    }
+
+    default_timeout_ms = timeout_ms;
+    default_timeout_sig = sig;
+    default_grace_ms = grace_ms;
+}
+
+/*
+ * renice [-c CPULIST] [-n NICE] [-i CLASS[:LEVEL]] %jid|pid ...
+ *     changes the CPU affinity, (absolute) nice value and I/O priority of
+ *     every process in each given job's process group.
+ * Signals must be blocked.
+ */
+static void builtin_renice(struct cmdline_tokens *token)
+{
+    struct placement place;
+    struct job_t *job;
+    char *end;
+    long value;
+    int i;
+
+    place.flags = 0;
+    for(i = 1; i + 1 < token->argc && token->argv[i][0] == '-'; i += 2)
+    {
+        if(strcmp(token->argv[i], "-c") == 0 &&
+           parse_cpulist(token->argv[i + 1], &place))
+        {
+            continue;
+        }
+        if(strcmp(token->argv[i], "-i") == 0 &&
+           parse_ioclass(token->argv[i + 1], &place))
+        {
+            continue;
+        }
+        if(strcmp(token->argv[i], "-n") == 0)
+        {
+            value = strtol(token->argv[i + 1], &end, 10);
+            if(*end == '\0' && value >= -20 && value <= 19)
+            {
+                place.nice = (int)value;
+                place.flags |= PLACE_NICE;
+                continue;
+            }
+        }
+        sio_printf("renice: %s %s: invalid option\n", token->argv[i],
+                   token->argv[i + 1]);
+        return;
+    }
+
+    if(place.flags == 0 || i >= token->argc)
+    {
+        sio_printf("usage: renice [-c CPULIST] [-n NICE] "
+                   "[-i CLASS[:LEVEL]] %%jid|pid ...\n");
+        return;
+    }
+
+    for(; i < token->argc; i++)
+    {
+        if((job = parse_jobspec("renice", token->argv[i])) == NULL)
+        {
+            continue;
+        }
+        if(placement_apply_pgrp(get_pid_of_job(job), &place) < 0)
+        {
+            sio_printf("renice: %s: %s\n", token->argv[i], strerror(errno));
+        }
+    }
+}
+
+/*
+ * ulimit                                 prints the limits given to jobs
+ * ulimit -v|-t|-n|-u|-c LIMIT ...        sets shell-wide limits, given to
+ *                                        every job launched from now on
+ *                                        ("unlimited" removes one)
+ * ulimit -v|-t|-n|-u|-c LIMIT ... %jid|pid ...
+ *                                        applies limits with prlimit to
+ *                                        every process of running jobs
+ * Signals must be blocked.
+ */
+static void builtin_ulimit(struct cmdline_tokens *token)
+{
+    struct limit_set set;
+    struct job_t *job;
+    long cpu_limit;
+    int i, kind;
+
+    set.mask = 0;
+    if((i = parse_ulimit_options(token, &set)) < 0)
+    {
+        return;
+    }
+
+    if(set.mask == 0)
+    {
+        if(i < token->argc)
+        {
+            sio_printf("usage: ulimit [-v|-t|-n|-u|-c LIMIT] ... "
+                       "[command | %%jid|pid ...]\n");
+            return;
+        }
+        limit_print(&default_limits);
+        return;
+    }
+
+    if(i == token->argc)
+    {
+        limit_merge(&default_limits, &set);
+        for(kind = 0; kind < LIMIT_COUNT; kind++)
+        {
+            if(default_limits.value[kind] == RLIM_INFINITY)
+            {
+                default_limits.mask &= ~(1U << kind);
+            }
+        }
+        return;
+    }
+
+    for(; i < token->argc; i++)
+    {
+        if((job = parse_jobspec("ulimit", token->argv[i])) == NULL)
+        {
+            continue;
+        }
+        if(limits_apply_pgrp(get_pid_of_job(job), &set) < 0)
+        {
+            sio_printf("ulimit: %s: %s\n", token->argv[i], strerror(errno));
+            continue;
+        }
+        if(limit_cpu_of(&set, &cpu_limit))
+        {
+            set_cpu_limit_of_job(job, cpu_limit);
+        }
+    }
+}
+
+/*
+ * rssguard                               prints the governor settings
+ * rssguard off                           disables the RSS governor
+ * rssguard [-s SOFT] [-k HARD] [-i INTERVAL]
+ *                                        samples the RSS of each job's
+ *                                        process group every INTERVAL;
+ *                                        background jobs over SOFT are
+ *                                        stopped, over HARD killed
+ * Signals must be blocked.
+ */
+static void builtin_rssguard(struct cmdline_tokens *token)
+{
+    long soft_kb = 0, hard_kb = 0;
+    long interval_ms = GOVERNOR_DEFAULT_INTERVAL;
+    bool ok;
+    int i;
+
+    if(token->argc == 1)
+    {
+        governor_print_rss();
+        return;
+    }
+    if(token->argc == 2 && strcmp(token->argv[1], "off") == 0)
+    {
+        governor_set_rss(0, 0, interval_ms);
+        return;
+    }
+
+    for(i = 1; i + 1 < token->argc; i += 2)
+    {
+        if(strcmp(token->argv[i], "-s") == 0)
+        {
+            ok = parse_size_kb(token->argv[i + 1], &soft_kb);
+        }
+        else if(strcmp(token->argv[i], "-k") == 0)
+        {
+            ok = parse_size_kb(token->argv[i + 1], &hard_kb);
+        }
+        else if(strcmp(token->argv[i], "-i") == 0)
+        {
+            ok = parse_duration_ms(token->argv[i + 1], &interval_ms) &&
+                 interval_ms > 0;
+        }
+        else
+        {
+            break;
+        }
+        if(!ok)
+        {
+            sio_printf("rssguard: %s: invalid value\n", token->argv[i + 1]);
+            return;
+        }
+    }
+
+    if(i != token->argc || (soft_kb == 0 && hard_kb == 0))
+    {
+        sio_printf("usage: rssguard [-s SOFT] [-k HARD] [-i INTERVAL]"
+                   " | rssguard off\n");
+        return;
+    }
+    governor_set_rss(soft_kb, hard_kb, interval_ms);
+}
+
+/*
+ * throttle                               prints the throttle settings and
+ *                                        the current load
+ * throttle off                           disables throttling
+ * throttle [-l HIGH[:LOW]] [-p HIGH[:LOW]] [-i INTERVAL]
+ *                                        throttles background jobs while
+ *                                        the load average (-l) or CPU
+ *                                        pressure in % (-p) is high
+ * Signals must be blocked.
+ */
+static void builtin_throttle(struct cmdline_tokens *token)
+{
+    struct throttle_limits limits = { 0, 0, 0, 0 };
+    long interval_ms = GOVERNOR_DEFAULT_INTERVAL;
+    bool ok;
+    int i;
+
+    if(token->argc == 1)
+    {
+        governor_print_throttle();
+        return;
+    }
+    if(token->argc == 2 && strcmp(token->argv[1], "off") == 0)
+    {
+        governor_set_throttle(&limits, interval_ms);
+        return;
+    }
+
+    for(i = 1; i + 1 < token->argc; i += 2)
+    {
+        if(strcmp(token->argv[i], "-l") == 0)
+        {
+            ok = parse_watermarks(token->argv[i + 1], &limits.load_high,
+                                  &limits.load_low);
+        }
+        else if(strcmp(token->argv[i], "-p") == 0)
+        {
+            ok = parse_watermarks(token->argv[i + 1], &limits.psi_high,
+                                  &limits.psi_low);
+        }
+        else if(strcmp(token->argv[i], "-i") == 0)
+        {
+            ok = parse_duration_ms(token->argv[i + 1], &interval_ms) &&
+                 interval_ms > 0;
+        }
+        else
+        {
+            break;
+        }
+        if(!ok)
+        {
+            sio_printf("throttle: %s: invalid value\n", token->argv[i + 1]);
+            return;
+        }
+    }
+
+    if(i != token->argc || (limits.load_high == 0 && limits.psi_high == 0))
+    {
+        sio_printf("usage: throttle [-l HIGH[:LOW]] [-p HIGH[:LOW]] "
+                   "[-i INTERVAL] | throttle off\n");
+        return;
+    }
+    governor_set_throttle(&limits, interval_ms);
+}
+
+/*
+ * autonice                               prints the demotion settings
+ * autonice off                           stops demoting jobs
+ * autonice [-n INCREMENT] [-b]           demotes jobs that leave the
+ *                                        foreground by INCREMENT nice
+ *                                        levels (default 10), and with -b
+ *                                        to SCHED_BATCH; fg restores them
+ */
+static void builtin_autonice(struct cmdline_tokens *token)
+{
+    int increment = AUTONICE_DEFAULT_INCREMENT;
+    bool batch = false;
+    char *end;
+    int i;
+
+    if(token->argc == 1)
+    {
+        governor_print_autonice();
+        return;
+    }
+    if(token->argc == 2 && strcmp(token->argv[1], "off") == 0)
+    {
+        governor_set_autonice(0, false);
+        return;
+    }
+
+    for(i = 1; i < token->argc; i++)
+    {
+        if(strcmp(token->argv[i], "-b") == 0)
+        {
+            batch = true;
+        }
+        else if(strcmp(token->argv[i], "-n") == 0 && i + 1 < token->argc)
+        {
+            increment = (int)strtol(token->argv[++i], &end, 10);
+            if(*end != '\0' || end == token->argv[i] ||
+               increment < 0 || increment > 39)
+            {
+                sio_printf("autonice: %s: invalid increment\n",
+                           token->argv[i]);
+                return;
+            }
+        }
+        else
+        {
+            sio_printf("usage: autonice [-n INCREMENT] [-b] | "
+                       "autonice off\n");
+            return;
+        }
+    }
+    governor_set_autonice(increment, batch);
+}
+
+/*
+ * forkretry                              prints the retry budget and the
+ *                                        fork counters
+ * forkretry RETRIES                      retries a fork that fails for
+ *                                        lack of processes or memory up to
+ *                                        RETRIES times (0 to 20), backing
+ *                                        off between attempts
+ */
+static void builtin_forkretry(struct cmdline_tokens *token)
+{
+    long retries;
+    char *end;
+
+    if(token->argc == 1)
+    {
+        fork_print();
+        return;
+    }
+    if(token->argc != 2)
+    {
+        sio_printf("usage: forkretry [RETRIES]\n");
+        return;
+    }
+    retries = strtol(token->argv[1], &end, 10);
+    if(*end != '\0' || end == token->argv[1] || retries < 0 ||
+       retries > FORK_MAX_RETRIES)
+    {
+        sio_printf("forkretry: %s: invalid number of retries\n",
+                   token->argv[1]);
+        return;
+    }
+    fork_set_retries((int)retries);
+}
+
+
+/*****************
+ * Job status and the wait builtin
+ *****************/
+
+/*
+ * Converts a status from waitpid into a shell exit status: the exit code
+ * of a process that exited, or 128 plus the number of the signal that
+ * terminated or stopped it. A job that overran its deadline (flags has
+ * JOB_TIMEDOUT) reports EXIT_TIMEDOUT.
+ */
+static int shell_status(int status, unsigned flags)
+{
+    if((flags & JOB_TIMEDOUT) && !WIFSTOPPED(status))
+    {
+        return EXIT_TIMEDOUT;
+    }
+    if(WIFEXITED(status))
+    {
+        return WEXITSTATUS(status);
+    }
+    if(WIFSIGNALED(status))
+    {
+        return 128 + WTERMSIG(status);
+    }
+    if(WIFSTOPPED(status))
+    {
+        return 128 + WSTOPSIG(status);
+    }
+    return 0;
+}
+
+/*
+ * Returns the shell exit status last reported for the job led by pid,
+ * or 0 if nothing was recorded.
+ */
+static int job_status(pid_t pid)
+{
+    int status;
+    unsigned flags;
+
+    if(!find_job_status(pid, &status, &flags))
+    {
+        return 0;
+    }
+    return shell_status(status, flags);
+}
+
+/* Returns the user and system CPU time of usage, in milliseconds */
+static long cpu_ms(const struct rusage *usage)
+{
+    return (usage->ru_utime.tv_sec + usage->ru_stime.tv_sec) * 1000L +
+           (usage->ru_utime.tv_usec + usage->ru_stime.tv_usec) / 1000;
+}
+
+/*
+ * Resolves a job specification given to the builtin cmd: a pid, or a %
+ * spec (%jid, %+, %-, %name or %?text, see find_job_with_spec), or NULL
+ * for the current job, which diagnostics then call "current".
+ * Prints a diagnostic and returns NULL if there is no such job, or if the
+ * spec is ambiguous.
+ * Signals must be blocked.
+ */
+static struct job_t *parse_jobspec(const char *cmd, const char *spec)
+{
+    const char *name = (spec != NULL) ? spec : "current";
+    struct job_t *job;
+    bool ambiguous = false;
+    char *end;
+    long id;
+
+    if(spec == NULL)
+    {
+        spec = "%+";
+    }
+    if(spec[0] == '%')
+    {
+        job = find_job_with_spec(&spec[1], &ambiguous);
+    }
+    else
+    {
+        id = strtol(spec, &end, 10);
+        job = (end != spec && *end == '\0') ? find_job_with_pid(id) : NULL;
+    }
+
+    if(ambiguous)
+    {
+        sio_printf("%s: %s: ambiguous job spec\n", cmd, name);
+    }
+    else if(job == NULL)
+    {
+        sio_printf("%s: %s: no such job\n", cmd, name);
+    }
+    return job;
+}
+
+/*
+ * Returns true if some job is running in the background (a throttled job
+ * counts, as it will be resumed by itself)
+ */
+static bool running_bg_job(void)
+{
+    struct job_t *job = NULL;
+
+    while((job = get_next_job(job)) != NULL)
+    {
+        if(get_state_of_job(job) == BG || get_state_of_job(job) == TH)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * wait              waits until no job is running in the background
+ * wait -n           waits until the next job terminates
+ * wait %jid|pid ... waits until each given job terminates or stops
+ *
+ * Waits for signals like the foreground path, and sets last_status to
+ * the status of the (last) awaited job. ctrl-c interrupts the wait.
+ * Signals must be blocked.
+ */
+static void builtin_wait(struct cmdline_tokens *token)
+{
+    sigset_t suspend_mask;
+    struct job_t *job;
+    unsigned long reaps;
+    unsigned flags;
+    pid_t pid;
+    int status, i;
+
+    sigemptyset(&suspend_mask);
+    wait_interrupted = 0;
+
+    if(token->argc == 1)
+    {
+        while(!wait_interrupted && running_bg_job())
+        {
+            wait_for_signal(&suspend_mask);
+            job_timer_poll();
+        }
+        last_status = wait_interrupted ? 128 + SIGINT : 0;
+        return;
+    }
+
+    if(strcmp(token->argv[1], "-n") == 0)
+    {
+        if(!running_bg_job())
+        {
+            last_status = 127;
+            return;
+        }
+        reaps = get_reap_count();
+        while(!wait_interrupted && get_reap_count() == reaps &&
+              running_bg_job())
+        {
+            wait_for_signal(&suspend_mask);
+            job_timer_poll();
+        }
+        if(wait_interrupted)
+        {
+            last_status = 128 + SIGINT;
+        }
+        else if(get_reap_count() != reaps)
+        {
+            get_last_reaped(&status, &flags);
+            last_status = shell_status(status, flags);
+        }
+        return;
+    }
+
+    for(i = 1; i < token->argc; i++)
+    {
+        /* a pid that has already been reaped still reports its status */
+        if(token->argv[i][0] != '%' && (pid = atoi(token->argv[i])) > 0 &&
+           find_job_with_pid(pid) == NULL &&
+           find_job_status(pid, &status, &flags))
+        {
+            last_status = shell_status(status, flags);
+            continue;
+        }
+
+        if((job = parse_jobspec("wait", token->argv[i])) == NULL)
+        {
+            last_status = 127;
+            continue;
+        }
+
+        pid = get_pid_of_job(job);
+        while(!wait_interrupted && (job = find_job_with_pid(pid)) != NULL &&
+              get_state_of_job(job) != ST)
+        {
+            wait_for_signal(&suspend_mask);
+            job_timer_poll();
+        }
+        if(wait_interrupted)
+        {
+            last_status = 128 + SIGINT;
+            return;
+        }
+        last_status = job_status(pid);
+    }
+}
+
+/* An operand of the kill builtin */
+struct kill_operand
+{
+    const char *arg;            // As given
+    char kind;                  // '%' jid, 'p' pid, 's' selector, 0 invalid
+    long id;                    // The jid or pid
+    bool found;                 // Matched a job
+    int pidfd;                  // A pid that is no job, held meanwhile
+};
+
+/*
+ * Parses an operand of the kill builtin, adding selectors to *select. A
+ * % spec other than %jid is resolved to its jid here. Prints a diagnostic
+ * if it is invalid.
+ */
+static void parse_kill_operand(struct kill_operand *op, unsigned *select)
+{
+    const char *digits = (op->arg[0] == '%') ? &op->arg[1] : op->arg;
+    struct job_t *job;
+    char *end;
+
+    op->kind = 's';
+    op->found = false;
+    op->pidfd = -1;
+    if(strcmp(op->arg, "%all") == 0)
+    {
+        *select |= KILL_ALL;
+        return;
+    }
+    if(strcmp(op->arg, "%running") == 0)
+    {
+        *select |= KILL_RUNNING;
+        return;
+    }
+    if(strcmp(op->arg, "%stopped") == 0)
+    {
+        *select |= KILL_STOPPED;
+        return;
+    }
+
+    op->kind = 0;
+    if(op->arg[0] == '%' && !isdigit((unsigned char)digits[0]))
+    {
+        if((job = parse_jobspec("kill", op->arg)) != NULL)
+        {
+            op->kind = '%';
+            op->id = get_jid_of_job(job);
+        }
+        return;
+    }
+    if(isdigit((unsigned char)digits[0]))
+    {
+        op->id = strtol(digits, &end, 10);
+        if(*end == '\0' && op->id > 0)
+        {
+            op->kind = (digits == op->arg) ? 'p' : '%';
+            return;
+        }
+    }
+    sio_printf("kill: %s: arguments must be process or job IDs\n", op->arg);
+}
+
+/*
+ * Returns true if the kill builtin's operands pick job: by selector, or
+ * by jid or pid, marking the operands that name it.
+ */
+static bool kill_selects(struct job_t *job, struct kill_operand *ops,
+                         int nops, unsigned select)
+{
+    job_state state = get_state_of_job(job);
+    bool picked;
+    int i;
+
+    picked = (select & KILL_ALL) ||
+             ((select & KILL_RUNNING) && (state == BG || state == TH)) ||
+             ((select & KILL_STOPPED) && state == ST);
+    for(i = 0; i < nops; i++)
+    {
+        if((ops[i].kind == '%' && ops[i].id == get_jid_of_job(job)) ||
+           (ops[i].kind == 'p' && ops[i].id == get_pid_of_job(job)))
+        {
+            ops[i].found = true;
+            picked = true;
+        }
+    }
+    return picked;
+}
+
+/*
+ * kill [-s SIG | -SIG] %spec|pid|%all|%running|%stopped ...
+ *     sends SIG (SIGTERM by default) to the process group of each job
+ *     given or selected, and to each pid that is not a job. The
+ *     selectors take precedence over %name specs.
+ *
+ * The operands are all resolved, in one pass over the job table, before
+ * any signal is sent. A job's group cannot change meanwhile, as its
+ * leader is not reaped while signals are blocked; a pid that is no job
+ * is held by a pidfd, so that if it exits, the signal is not sent to a
+ * process that took over its pid. A stopped job sent SIGTERM or SIGHUP
+ * is continued to act on it; one sent SIGCONT runs in the background.
+ * Sets last_status to 1 if a signal could not be sent, else 0.
+ * Signals must be blocked.
+ */
+static void builtin_kill(struct cmdline_tokens *token)
+{
+    struct job_t *jobs[MAXJOBS], *job = NULL;
+    struct kill_operand *ops;
+    unsigned select = 0;
+    int sig = SIGTERM, njobs = 0, nops, i;
+    pid_t pid;
+    bool failed = false;
+
+    i = 1;
+    if(i + 1 < token->argc && strcmp(token->argv[i], "-s") == 0)
+    {
+        if((sig = parse_signal(token->argv[i + 1])) < 0)
+        {
+            sio_printf("kill: %s: invalid signal\n", token->argv[i + 1]);
+            last_status = 1;
+            return;
+        }
+        i += 2;
+    }
+    else if(i < token->argc && token->argv[i][0] == '-')
+    {
+        if((sig = parse_signal(&token->argv[i][1])) < 0)
+        {
+            sio_printf("kill: %s: invalid signal\n", &token->argv[i][1]);
+            last_status = 1;
+            return;
+        }
+        i++;
+    }
+
+    if(i >= token->argc)
+    {
+        sio_printf("usage: kill [-s SIG | -SIG] "
+                   "%%spec|pid|%%all|%%running|%%stopped ...\n");
+        last_status = 1;
+        return;
+    }
+
+    nops = token->argc - i;
+    if((ops = malloc(nops * sizeof(*ops))) == NULL)
+    {
+        sio_printf("kill: %s\n", strerror(errno));
+        last_status = 1;
+        return;
+    }
+    for(i = 0; i < nops; i++)
+    {
+        ops[i].arg = token->argv[token->argc - nops + i];
+        parse_kill_operand(&ops[i], &select);
+        failed |= (ops[i].kind == 0);
+    }
+
+    /* resolve every operand before sending anything */
+    while((job = get_next_job(job)) != NULL)
+    {
+        if(kill_selects(job, ops, nops, select))
+        {
+            jobs[njobs++] = job;
+        }
+    }
+    for(i = 0; i < nops; i++)
+    {
+        if(ops[i].kind == '%' && !ops[i].found)
+        {
+            sio_printf("kill: %s: no such job\n", ops[i].arg);
+            failed = true;
+        }
+        else if(ops[i].kind == 'p' && !ops[i].found &&
+                (ops[i].pidfd = proc_pidfd(ops[i].id)) < 0 &&
+                errno != ENOSYS)
+        {
+            sio_printf("kill: (%ld) - %s\n", ops[i].id, strerror(errno));
+            ops[i].kind = 0;
+            failed = true;
+        }
+    }
+
+    for(i = 0; i < njobs; i++)
+    {
+        pid = get_pid_of_job(jobs[i]);
+        if(kill(-pid, sig) < 0)
+        {
+            sio_printf("kill: [%d] (%d): %s\n", get_jid_of_job(jobs[i]), pid,
+                       strerror(errno));
+            failed = true;
+            continue;
+        }
+        if(get_state_of_job(jobs[i]) == ST)
+        {
+            if(sig == SIGTERM || sig == SIGHUP)
+            {
+                kill(-pid, SIGCONT);
+            }
+            else if(sig == SIGCONT)
+            {
+                set_state_of_job(jobs[i], BG);
+            }
+        }
+    }
+    for(i = 0; i < nops; i++)
+    {
+        if(ops[i].kind != 'p' || ops[i].found)
+        {
+            continue;
+        }
+        /* without pidfds, the pid is signalled as it is */
+        if((ops[i].pidfd >= 0 ? proc_pidfd_signal(ops[i].pidfd, sig)
+                              : kill(ops[i].id, sig)) < 0)
+        {
+            sio_printf("kill: (%ld) - %s\n", ops[i].id, strerror(errno));
+            failed = true;
+        }
+        if(ops[i].pidfd >= 0)
+        {
+            close(ops[i].pidfd);
+        }
+    }
+
+    free(ops);
+    last_status = failed ? 1 : 0;
+}
+
+
+/*****************
+ * Signal handlers
+ *****************/
+
+/*
+ * Handles SIGCHLD signal. Blocks SIGINT, SIGTSTP and outputs information
+ * about termination or stoppage of a process based on status from waitpid
+ */
+void sigchld_handler(int sig) 
+{
+    pid_t pid;
+    int status, jid;
+    struct job_t *job;
+    unsigned flags;
+    const char *limit;
+    struct rusage before, after;
+    long cpu_used_ms;
+
+    /* add SIGINT, SIGSTP, SIGALRM in mask set to block  */
+    sigset_t proc_mask, temp;
+    sigemptyset(&proc_mask);
+    sigaddset(&proc_mask, SIGINT);
+    sigaddset(&proc_mask, SIGTSTP);
+    sigaddset(&proc_mask, SIGALRM);
+
+    /* BLOCK {SIGINT, SIGTSTP, SIGALRM} */ 
+    sigprocmask(SIG_BLOCK, &proc_mask, &temp);
+
+    /* the CPU time of each child reaped is what it adds to the total */
+    getrusage(RUSAGE_CHILDREN, &before);
+    while((pid = waitpid(-1, &status, WNOHANG | WUNTRACED)) > 0)
+    {
+        getrusage(RUSAGE_CHILDREN, &after);
+        cpu_used_ms = cpu_ms(&after) - cpu_ms(&before);
+        before = after;
+
+        /* the zygote, gone: jobs are forked by the shell again */
+        if(zygote_reaped(pid))
+        {
+            continue;
+        }
+
+        /* a process substitution: its job reports for it */
+        if(is_helper(pid))
+        {
+            if(!WIFSTOPPED(status))
+            {
+                delete_helper(pid);
+            }
+            continue;
+        }
+
+        /* the driver of a suspended list stands for its job, and the
+         * command it waits for hands it its status */
+        if((job = find_job_with_driver(pid)) != NULL)
+        {
+            if(!WIFSTOPPED(status) && drop_job_driver(job))
+            {
+                /* gone first: the job is the command's alone again */
+                continue;
+            }
+            pid = get_pid_of_job(job);
+        }
+        else if(!WIFSTOPPED(status) &&
+                (job = find_job_with_pid(pid)) != NULL &&
+                relay_job_status(job, status))
+        {
+            continue;
+        }
+
+        job = find_job_with_pid(pid);
+        flags = (job != NULL) ? get_flags_of_job(job) : 0;
+        record_job_status(pid, status, flags);
+
+        limit = limit_death(status,
+                            (job != NULL) ? get_cpu_limit_of_job(job) : 0,
+                            cpu_used_ms);
+
+        /* Child prcess terminated */
+        if(WIFSIGNALED(status))
+        {
+            jid = find_jid_by_pid(pid);
+            /* output */
+            if(flags & JOB_TIMEDOUT)
+            {
+                sio_printf("Job [%d] (%d) terminated by signal %d "
+                           "(timed out)\n", jid, pid, WTERMSIG(status));
+            }
+            else if(flags & JOB_RSS_KILLED)
+            {
+                sio_printf("Job [%d] (%d) terminated by signal %d "
+                           "(RSS over hard limit)\n", jid, pid,
+                           WTERMSIG(status));
+            }
+            else if(limit != NULL)
+            {
+                sio_printf("Job [%d] (%d) terminated by signal %d (%s)\n",
+                           jid, pid, WTERMSIG(status), limit);
+            }
+            else
+            {
+                sio_printf("Job [%d] (%d) terminated by signal %d\n", jid,
+                           pid, WTERMSIG(status));
+            }
+
+            delete_job(pid);
+        }
+        /* Child is stopped */
+        else if(WIFSTOPPED(status))
+        {
+            jid = find_jid_by_pid(pid);
+            /* output */
+            if(job != NULL && get_state_of_job(job) == TH)
+            {
+                /* stopped by the load governor: not a user stop, and the
+                 * job stays TH until the governor resumes it */
+                sio_printf("Job [%d] (%d) throttled by signal %d\n", jid,
+                           pid, WSTOPSIG(status));
+            }
+            else if(flags & JOB_RSS_STOPPED)
+            {
+                sio_printf("Job [%d] (%d) stopped by signal %d "
+                           "(RSS over soft limit)\n", jid, pid,
+                           WSTOPSIG(status));
+                set_state_of_job(job, ST);
+            }
+            else
+            {
+                sio_printf("Job [%d] (%d) stopped by signal %d\n", jid, pid,
+                           WSTOPSIG(status));
+                set_state_of_job(job, ST);
+                /* leaving the foreground */
+                governor_demote(job);
+            }
+        }
+        else
+        {
+            if(flags & JOB_TIMEDOUT)
+            {
+                sio_printf("Job [%d] (%d) timed out\n",
+                           find_jid_by_pid(pid), pid);
+            }
+            else if(limit != NULL)
+            {
+                sio_printf("Job [%d] (%d) exited with status %d (%s)\n",
+                           find_jid_by_pid(pid), pid, WEXITSTATUS(status),
+                           limit);
+            }
+            delete_job(pid);
+        }
+    }
+    /* UNBLOCK {SIGINT, SIGTSTP, SIGALRM} */
+    sigprocmask(SIG_SETMASK, &temp, NULL);
     return;
 }
 
@@ -428,6 +4106,10 @@ void sigint_handler(int sig)
     {
         kill(-pid, sig);
     }
+    else
+    {
+        wait_interrupted = 1;
+    }
 
     /* Unblock {SIGCHLD, SIGINT, SIGTSTP} */
     sigprocmask(SIG_SETMASK, &temp, NULL);
@@ -463,3 +4145,45 @@ void sigtstp_handler(int sig) {
     return;
 }
 
+/*
+ * Handles SIGALRM signal, raised by the job deadline timer, by blocking
+ * {SIGCHLD, SIGINT, SIGTSTP} first and signalling the overdue jobs
+ */
+void sigalrm_handler(int sig)
+{
+    int olderrno = errno;
+
+    /* add SIGINT, SIGSTP, SIGCHLD in mask set to block */
+    sigset_t proc_mask, temp;
+    sigemptyset(&proc_mask);
+    sigaddset(&proc_mask, SIGCHLD);
+    sigaddset(&proc_mask, SIGINT);
+    sigaddset(&proc_mask, SIGTSTP);
+
+    /* Block {SIGCHLD, SIGINT, SIGTSTP} */
+    sigprocmask(SIG_BLOCK, &proc_mask, &temp);
+
+    job_timer_tick();
+
+    /* Unblock {SIGCHLD, SIGINT, SIGTSTP} */
+    sigprocmask(SIG_SETMASK, &temp, NULL);
+
+    errno = olderrno;
+    return;
+}
+
+/*
+ * In the driver of a command list, signals the command being waited for
+ * at its deadline, and kills it if it outlives the grace period.
+ */
+void list_alarm_handler(int sig)
+{
+    int olderrno = errno;
+
+    if(list_pid > 0)
+    {
+        kill(list_pid, list_timeouts++ == 0 ? list_timeout_sig : SIGKILL);
+    }
+
+    errno = olderrno;
+}
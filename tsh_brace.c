@@ -0,0 +1,357 @@
+/* tsh_brace.c
+ * brace expansion for tshlab
+ */
+
+#include "tsh_brace.h"
+
+/* Kinds of brace */
+#define BRACE_NONE      0       // none: the literal tail of a word
+#define BRACE_LIST      1       // {A,B,...}
+#define BRACE_NUM       2       // {X..Y..S}
+#define BRACE_CHAR      3       // {C..D..S}
+
+#define NUM_DIGITS      24      /* room for a long, with its sign, and
+                                   the widest padding of one */
+
+/*
+ * parse_num - Parse an optionally signed integer from [p, end). Returns
+ * a pointer past it, or NULL if there is none.
+ */
+static const char *parse_num(const char *p, const char *end, long *value) {
+    bool neg = false;
+    unsigned long v = 0;
+    const char *digits;
+
+    if (p < end && (*p == '-' || *p == '+')) {
+        neg = (*p == '-');
+        p++;
+    }
+    for (digits = p; p < end && isdigit((unsigned char)*p); p++) {
+        v = v * 10 + (*p - '0');
+    }
+    if (p == digits) {
+        return NULL;
+    }
+    *value = neg ? -(long)v : (long)v;
+    return p;
+}
+
+/* zero_padded - Test whether a range bound is written with a leading 0 */
+static bool zero_padded(const char *p, const char *end) {
+    const char *digits = (*p == '-' || *p == '+') ? p + 1 : p;
+
+    return digits[0] == '0' && end - digits > 1;
+}
+
+/* distance - |b - a|, without overflow */
+static unsigned long distance(long a, long b) {
+    return (b >= a) ? (unsigned long)b - (unsigned long)a
+                    : (unsigned long)a - (unsigned long)b;
+}
+
+/*
+ * parse_range - Parse X..Y[..S] or C..D[..S] from [p, end) into part.
+ * Returns false if it is neither.
+ */
+static bool parse_range(const char *p, const char *end,
+                        struct brace_part *part) {
+    const char *x_end, *y, *y_end, *s;
+    long x, yv, step = 1;
+
+    if ((x_end = parse_num(p, end, &x)) != NULL &&
+        end - x_end > 2 && x_end[0] == '.' && x_end[1] == '.' &&
+        (y_end = parse_num(y = x_end + 2, end, &yv)) != NULL) {
+        part->kind = BRACE_NUM;
+        part->width = 0;
+        if (zero_padded(p, x_end) || zero_padded(y, y_end)) {
+            /* as wide as the wider bound */
+            part->width = (x_end - p > y_end - y) ? x_end - p : y_end - y;
+            if (part->width > NUM_DIGITS) {
+                part->width = NUM_DIGITS;
+            }
+        }
+    } else if (end - p >= 4 && p[1] == '.' && p[2] == '.' &&
+               (end - p == 4 || p[4] == '.')) {
+        part->kind = BRACE_CHAR;
+        x = (unsigned char)p[0];
+        yv = (unsigned char)p[3];
+        y_end = p + 4;
+    } else {
+        return false;
+    }
+
+    /* the optional step */
+    if (y_end < end) {
+        s = y_end + 2;
+        if (end - y_end < 3 || y_end[0] != '.' || y_end[1] != '.' ||
+            parse_num(s, end, &step) != end) {
+            return false;
+        }
+    }
+    if (step == 0) {
+        step = 1;
+    }
+
+    part->start = x;
+    part->count = distance(x, yv) / distance(0, step) + 1;
+    part->step = (yv >= x) ? (long)distance(0, step)
+                           : -(long)distance(0, step);
+    return true;
+}
+
+/*
+ * parse_brace - Parse the brace opening at open into part, and set
+ * *close to its closing brace. Returns false if it is not a brace to
+ * expand: unclosed, nested, or neither a list nor a range.
+ */
+static bool parse_brace(const char *open, const char **close,
+                        struct brace_part *part) {
+    const char *p;
+    unsigned long commas = 0;
+
+    for (p = open + 1; *p != '}'; p++) {
+        if (*p == '\0' || *p == '{') {
+            return false;
+        }
+        commas += (*p == ',');
+    }
+    *close = p;
+
+    if (commas > 0) {
+        part->kind = BRACE_LIST;
+        part->list = open + 1;
+        part->list_end = p;
+        part->count = commas + 1;
+        return true;
+    }
+    return parse_range(open + 1, p, part);
+}
+
+/* brace_is_pattern - Test a word for braces to expand */
+bool brace_is_pattern(const char *word) {
+    struct brace_part part;
+    const char *close;
+
+    while ((word = strchr(word, '{')) != NULL) {
+        if (parse_brace(word, &close, &part)) {
+            return true;
+        }
+        word++;
+    }
+    return false;
+}
+
+/* first_alt - Make the first alternative of a list current */
+static void first_alt(struct brace_part *part) {
+    const char *comma;
+
+    part->alt = part->list;
+    for (comma = part->alt; *comma != ',' && comma < part->list_end;
+         comma++) {
+    }
+    part->alt_len = comma - part->alt;
+}
+
+/* next_alt - Make the next alternative of a list current */
+static void next_alt(struct brace_part *part) {
+    const char *comma;
+
+    part->alt += part->alt_len + 1;
+    for (comma = part->alt; *comma != ',' && comma < part->list_end;
+         comma++) {
+    }
+    part->alt_len = comma - part->alt;
+}
+
+/*
+ * compile_word - Split word into its braces and the literal text
+ * around them, and make the first combination current
+ */
+static void compile_word(struct brace_stream *stream, const char *word) {
+    struct brace_part *part;
+    const char *lit = word;
+    const char *p = word;
+    const char *open, *close;
+    int n = 0;
+
+    while (n < BRACE_MAXPARTS && (open = strchr(p, '{')) != NULL) {
+        part = &stream->parts[n];
+        if (!parse_brace(open, &close, part)) {
+            p = open + 1;
+            continue;
+        }
+        part->lit = lit;
+        part->lit_len = open - lit;
+        part->index = 0;
+        if (part->kind == BRACE_LIST) {
+            first_alt(part);
+        }
+        lit = p = close + 1;
+        n++;
+    }
+
+    part = &stream->parts[n++];
+    part->lit = lit;
+    part->lit_len = strlen(lit);
+    part->kind = BRACE_NONE;
+    part->count = 1;
+    part->index = 0;
+    stream->nparts = n;
+}
+
+/*
+ * format_num - Write value, padded with zeros to width, into out (of
+ * 2 * NUM_DIGITS bytes). Returns its length.
+ */
+static size_t format_num(long value, int width, char *out) {
+    char digits[NUM_DIGITS];
+    unsigned long v = distance(0, value);
+    size_t n = 0, len = 0;
+
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v > 0);
+
+    if (value < 0) {
+        out[len++] = '-';
+    }
+    while ((int)(len + n) < width) {
+        out[len++] = '0';
+    }
+    while (n > 0) {
+        out[len++] = digits[--n];
+    }
+    return len;
+}
+
+/*
+ * write_current - Write the current combination of the current word
+ * into buf (of size bytes). Returns its length, or -1 if it does not fit.
+ */
+static long write_current(const struct brace_stream *stream, char *buf,
+                          size_t size) {
+    const struct brace_part *part;
+    char num[2 * NUM_DIGITS];
+    const char *value;
+    size_t len = 0, vlen;
+    int i;
+
+    for (i = 0; i < stream->nparts; i++) {
+        part = &stream->parts[i];
+        switch (part->kind) {
+        case BRACE_LIST:
+            value = part->alt;
+            vlen = part->alt_len;
+            break;
+        case BRACE_NUM:
+            value = num;
+            vlen = format_num(part->start + (long)(part->index *
+                              (unsigned long)part->step),
+                              part->width, num);
+            break;
+        case BRACE_CHAR:
+            num[0] = part->start + (long)part->index * part->step;
+            value = num;
+            vlen = 1;
+            break;
+        default:
+            value = "";
+            vlen = 0;
+        }
+
+        if (len + part->lit_len + vlen >= size) {
+            return -1;
+        }
+        memcpy(buf + len, part->lit, part->lit_len);
+        len += part->lit_len;
+        memcpy(buf + len, value, vlen);
+        len += vlen;
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+/*
+ * advance - Move the current word to its next combination. Returns
+ * false if it has none.
+ */
+static bool advance(struct brace_stream *stream) {
+    struct brace_part *part;
+    int i;
+
+    for (i = stream->nparts - 1; i >= 0; i--) {
+        part = &stream->parts[i];
+        if (++part->index < part->count) {
+            if (part->kind == BRACE_LIST) {
+                next_alt(part);
+            }
+            return true;
+        }
+        part->index = 0;
+        if (part->kind == BRACE_LIST) {
+            first_alt(part);
+        }
+    }
+    return false;
+}
+
+/* brace_stream_init - Start a stream over the words of a command line */
+void brace_stream_init(struct brace_stream *stream, char *const *words,
+                       int nwords, char *const *patterns, int npatterns) {
+    stream->words = words;
+    stream->nwords = nwords;
+    stream->next = 0;
+    stream->patterns = patterns;
+    stream->npatterns = npatterns;
+    stream->nparts = 0;
+}
+
+/* is_pattern_word - Test whether a word of the stream is to be expanded */
+static bool is_pattern_word(const struct brace_stream *stream,
+                            const char *word) {
+    int i;
+
+    for (i = 0; i < stream->npatterns; i++) {
+        if (stream->patterns[i] == word) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* brace_next - Write the next word of the stream */
+long brace_next(struct brace_stream *stream, char *buf, size_t size) {
+    const char *word;
+    size_t len;
+    long n;
+
+    while (true) {
+        if (stream->nparts == 0) {
+            if (stream->next == stream->nwords) {
+                return BRACE_END;
+            }
+            word = stream->words[stream->next];
+            if (!is_pattern_word(stream, word)) {
+                if ((len = strlen(word)) >= size) {
+                    return BRACE_FULL;
+                }
+                memcpy(buf, word, len + 1);
+                stream->next++;
+                return len;
+            }
+            compile_word(stream, word);
+            stream->next++;
+        }
+
+        if ((n = write_current(stream, buf, size)) < 0) {
+            return BRACE_FULL;
+        }
+        if (!advance(stream)) {
+            stream->nparts = 0;
+        }
+        if (n > 0) {
+            return n;           // as in other shells, empty words are dropped
+        }
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef __TSH_BRACE_H__
+#define __TSH_BRACE_H__
+
+/*
+ * tsh_brace.h: brace expansion for tshlab
+ *
+ * A word such as f{a,b,c}.txt or n{1..100000} stands for several words:
+ *
+ *     {A,B,...}       each of the alternatives, in order
+ *     {X..Y[..S]}     the integers from X to Y (in steps of S), padded
+ *                     with zeros if X or Y is written with a leading 0
+ *     {C..D[..S]}     the characters from C to D
+ *
+ * A word may hold several braces; its words are every combination, the
+ * last brace varying fastest. Braces do not nest: a brace holding
+ * another one is taken literally.
+ *
+ * Expansion is lazy. A brace_stream yields the words of a command line
+ * one at a time, each computed from its position in the ranges and
+ * written straight to where the caller wants it, so a range costs
+ * nothing until its words are used and never needs to be stored whole.
+ * The stream does not allocate, so it can be used in a forked child.
+ */
+
+#include "tsh_helper.h"
+
+#define BRACE_MAXPARTS  16      /* max braces in a word */
+
+#define BRACE_END       (-1)    /* brace_next: no more words */
+#define BRACE_FULL      (-2)    /* brace_next: the word does not fit */
+
+/* A brace of a word, and the literal text before it */
+struct brace_part
+{
+    const char *lit;            // Literal text before the brace
+    size_t lit_len;
+    int kind;                   // Kind of brace (or none, for the tail)
+    const char *list;           // List: its alternatives, comma-separated
+    const char *list_end;
+    const char *alt;            // List: the current alternative
+    size_t alt_len;
+    long start;                 // Range: the first value
+    long step;                  // Range: the step, with its sign
+    int width;                  // Range: width to pad numbers to
+    unsigned long count;        // Number of values
+    unsigned long index;        // Index of the current value
+};
+
+struct brace_stream
+{
+    char *const *words;         // The words of the command line
+    int nwords;
+    int next;                   // Next word to start on
+    char *const *patterns;      // Those of them to expand
+    int npatterns;
+    struct brace_part parts[BRACE_MAXPARTS + 1];
+    int nparts;                 // Parts of the current word, or 0
+};
+
+/*
+ * brace_is_pattern returns true if word holds a brace to expand.
+ */
+bool brace_is_pattern(const char *word);
+
+/*
+ * brace_stream_init starts a stream over words, expanding those that are
+ * in patterns (compared as pointers) and passing the others through.
+ */
+void brace_stream_init(struct brace_stream *stream, char *const *words,
+                       int nwords, char *const *patterns, int npatterns);
+
+/*
+ * brace_next writes the next word of the stream, NUL-terminated, into
+ * buf (of size bytes) and returns its length. Returns BRACE_END after
+ * the last word, or BRACE_FULL, without consuming the word, if it does
+ * not fit. Async-signal-safe.
+ */
+long brace_next(struct brace_stream *stream, char *buf, size_t size);
+
+#endif // __TSH_BRACE_H__
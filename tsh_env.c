@@ -0,0 +1,229 @@
+/* tsh_env.c
+ * environment store for tshlab
+ */
+
+#include <stdint.h>
+
+#include "tsh_env.h"
+
+/* The store: "NAME=value" strings, and the envp array built from them */
+static char **vars = NULL;
+static size_t nvars = 0;
+static size_t vars_cap = 0;
+
+/* Hash index of the store: open addressing, slot holds index + 1 or 0 */
+static size_t *slots = NULL;
+static size_t nslots = 0;               // a power of two, or 0
+
+static char **envp_cache = NULL;
+static size_t envp_cap = 0;
+static bool envp_dirty = true;
+static unsigned long generation = 0;    // Changes so far
+
+/* env_name_len - Length of the variable name at the start of str */
+size_t env_name_len(const char *str) {
+    size_t len = 0;
+
+    if (isdigit((unsigned char)str[0])) {
+        return 0;
+    }
+    while (isalnum((unsigned char)str[len]) || str[len] == '_') {
+        len++;
+    }
+    return len;
+}
+
+/* env_is_assignment - Test for NAME=value */
+bool env_is_assignment(const char *str) {
+    size_t len = env_name_len(str);
+
+    return len > 0 && str[len] == '=';
+}
+
+/* hash_name - FNV-1a hash of a variable name of length len */
+static size_t hash_name(const char *name, size_t len) {
+    uint32_t hash = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/* index_insert - Add variable i to the hash index */
+static void index_insert(size_t i) {
+    size_t h = hash_name(vars[i], env_name_len(vars[i]));
+
+    while (slots[h & (nslots - 1)] != 0) {
+        h++;
+    }
+    slots[h & (nslots - 1)] = i + 1;
+}
+
+/* index_rebuild - Recreate the hash index, at most a quarter full */
+static void index_rebuild(void) {
+    size_t i;
+
+    if (nslots < 4 * nvars || nslots < 64) {
+        for (nslots = 64; nslots < 4 * nvars; nslots *= 2) {
+        }
+        slots = Realloc(slots, nslots * sizeof(slots[0]));
+    }
+    memset(slots, 0, nslots * sizeof(slots[0]));
+    for (i = 0; i < nvars; i++) {
+        index_insert(i);
+    }
+}
+
+/* find_var - Index of variable name (of length len), or -1 */
+static long find_var(const char *name, size_t len) {
+    size_t h, i;
+
+    if (nslots == 0) {
+        return -1;
+    }
+    for (h = hash_name(name, len); slots[h & (nslots - 1)] != 0; h++) {
+        i = slots[h & (nslots - 1)] - 1;
+        if (strncmp(vars[i], name, len) == 0 && vars[i][len] == '=') {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* env_init - Copy the initial environment into the store */
+void env_init(char **envp) {
+    size_t len;
+
+    for (; *envp != NULL; envp++) {
+        len = env_name_len(*envp);
+        if (len > 0 && (*envp)[len] == '=') {
+            (*envp)[len] = '\0';
+            env_set(*envp, *envp + len + 1);
+            (*envp)[len] = '=';
+        }
+    }
+    env_envp();
+}
+
+/* env_get - Value of a variable */
+const char *env_get(const char *name) {
+    return env_getn(name, strlen(name));
+}
+
+/* env_getn - Value of a variable named by len characters */
+const char *env_getn(const char *name, size_t len) {
+    long i = find_var(name, len);
+
+    return (i < 0) ? NULL : vars[i] + len + 1;
+}
+
+/* env_set - Set a variable */
+bool env_set(const char *name, const char *value) {
+    size_t len = strlen(name);
+    size_t vlen = strlen(value);
+    char *var;
+    long i;
+
+    if (len == 0 || env_name_len(name) != len) {
+        return false;
+    }
+
+    /* built by hand: a for loop sets its variable on every iteration */
+    var = Malloc(len + vlen + 2);
+    memcpy(var, name, len);
+    var[len] = '=';
+    memcpy(var + len + 1, value, vlen + 1);
+
+    if ((i = find_var(name, len)) >= 0) {
+        Free(vars[i]);
+        vars[i] = var;
+    } else {
+        if (nvars == vars_cap) {
+            vars_cap = (vars_cap == 0) ? 64 : vars_cap * 2;
+            vars = Realloc(vars, vars_cap * sizeof(vars[0]));
+        }
+        vars[nvars++] = var;
+        if (4 * nvars > 2 * nslots) {
+            index_rebuild();
+        } else {
+            index_insert(nvars - 1);
+        }
+    }
+    envp_dirty = true;
+    generation++;
+    env_envp();
+    return true;
+}
+
+/* env_unset - Remove a variable */
+void env_unset(const char *name) {
+    long i = find_var(name, strlen(name));
+
+    if (i < 0) {
+        return;
+    }
+    Free(vars[i]);
+    memmove(&vars[i], &vars[i + 1], (nvars - i - 1) * sizeof(vars[0]));
+    nvars--;
+    index_rebuild();            // the later variables have moved
+    envp_dirty = true;
+    generation++;
+    env_envp();
+}
+
+/* env_print - Print every variable */
+void env_print(void) {
+    size_t i;
+
+    for (i = 0; i < nvars; i++) {
+        printf("export %s\n", vars[i]);
+    }
+}
+
+/* env_generation - Number of changes to the store so far */
+unsigned long env_generation(void) {
+    return generation;
+}
+
+/* env_envp - The prebuilt envp array */
+char **env_envp(void) {
+    if (!envp_dirty) {
+        return envp_cache;
+    }
+    if (envp_cap < nvars + MAXARGS + 1) {
+        envp_cap = nvars + MAXARGS + 1;
+        envp_cache = Realloc(envp_cache, envp_cap * sizeof(envp_cache[0]));
+    }
+    memcpy(envp_cache, vars, nvars * sizeof(vars[0]));
+    envp_cache[nvars] = NULL;
+    envp_dirty = false;
+
+    /* getenv (and anything else in libc) reads the store too */
+    environ = envp_cache;
+    return envp_cache;
+}
+
+/* env_override - Apply NAME=value assignments to envp in place */
+char **env_override(char **envp, char *const *assigns, int n) {
+    size_t count, len, j;
+    int i;
+
+    for (count = 0; envp[count] != NULL; count++) {
+    }
+
+    for (i = 0; i < n; i++) {
+        len = env_name_len(assigns[i]) + 1;
+        for (j = 0; j < count; j++) {
+            if (strncmp(envp[j], assigns[i], len) == 0) {
+                break;
+            }
+        }
+        envp[j] = assigns[i];
+        if (j == count) {
+            envp[++count] = NULL;
+        }
+    }
+    return envp;
+}
@@ -0,0 +1,87 @@
+#ifndef __TSH_ENV_H__
+#define __TSH_ENV_H__
+
+/*
+ * tsh_env.h: environment store for tshlab
+ *
+ * The shell keeps its environment as a list of "NAME=value" strings,
+ * changed by the export and unset builtins. From it an envp array is
+ * prebuilt for execve and rebuilt only after a change, so launching a
+ * job costs nothing. The array keeps spare slots at its end, so that a
+ * child can apply its VAR=value overrides to its own copy in place
+ * rather than copying the environment.
+ *
+ * Variables are found through a hash index on their names, so looking
+ * one up (as parameter expansion does for each $NAME) does not scan the
+ * whole environment.
+ *
+ * libc's environ points at the prebuilt array, so getenv sees the store.
+ */
+
+#include "tsh_helper.h"
+
+/*
+ * env_init copies the environment the shell was started with into the
+ * store.
+ */
+void env_init(char **envp);
+
+/*
+ * env_get returns the value of variable name, or NULL if it is not set.
+ */
+const char *env_get(const char *name);
+
+/*
+ * env_getn is env_get for a name given by its first len characters.
+ */
+const char *env_getn(const char *name, size_t len);
+
+/*
+ * env_set sets variable name to value. Returns false if name is not a
+ * valid variable name.
+ */
+bool env_set(const char *name, const char *value);
+
+/*
+ * env_unset removes variable name, if it is set.
+ */
+void env_unset(const char *name);
+
+/*
+ * env_print prints every variable to stdout as "export NAME=value".
+ */
+void env_print(void);
+
+/*
+ * env_name_len returns the length of the variable name at the start of
+ * str (letters, digits and underscores, not starting with a digit), or 0
+ * if there is none.
+ */
+size_t env_name_len(const char *str);
+
+/*
+ * env_is_assignment returns true if str has the form NAME=value.
+ */
+bool env_is_assignment(const char *str);
+
+/*
+ * env_generation returns a count of the changes made to the store, so
+ * that something derived from the variables can tell it is out of date.
+ */
+unsigned long env_generation(void);
+
+/*
+ * env_envp returns the prebuilt envp array, rebuilding it first if the
+ * store has changed. It has room for at least MAXARGS more entries.
+ */
+char **env_envp(void);
+
+/*
+ * env_override applies n NAME=value assignments to envp, as returned by
+ * env_envp, replacing existing entries and filling spare slots. It
+ * modifies the array in place, so it is meant for a forked child about
+ * to call execve. Returns envp. Async-signal-safe.
+ */
+char **env_override(char **envp, char *const *assigns, int n);
+
+#endif // __TSH_ENV_H__
@@ -0,0 +1,149 @@
+/* tsh_fork.c
+ * forking with retries for tshlab
+ */
+
+#include <sys/select.h>
+#include <time.h>
+
+#include "tsh_fork.h"
+
+static int fork_retries = FORK_DEFAULT_RETRIES;
+static struct fork_stats stats;
+static unsigned jitter_state = 0;       // xorshift state, 0 until seeded
+
+/* retryable - Whether fork failed for a reason that may pass */
+static bool retryable(int err) {
+    return err == EAGAIN || err == ENOMEM;
+}
+
+/* jitter - A pseudo-random number, seeded once from the pid and clock */
+static unsigned jitter(void) {
+    struct timespec now;
+
+    if (jitter_state == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        jitter_state = ((unsigned)getpid() << 16) ^ (unsigned)now.tv_nsec;
+        jitter_state |= 1;
+    }
+    jitter_state ^= jitter_state << 13;
+    jitter_state ^= jitter_state >> 17;
+    jitter_state ^= jitter_state << 5;
+    return jitter_state;
+}
+
+/* backoff - Sleep before retry number attempt (from 0), letting SIGCHLD
+ * in if reap so that children that exit meanwhile are reaped and free
+ * their slots
+ */
+static void backoff(int attempt, bool reap) {
+    long ms = FORK_BACKOFF_BASE_MS;
+    struct timespec now, end, delay;
+    sigset_t mask;
+
+    while (attempt-- > 0 && ms < FORK_BACKOFF_MAX_MS) {
+        ms *= 2;
+    }
+    ms = (ms > FORK_BACKOFF_MAX_MS) ? FORK_BACKOFF_MAX_MS : ms;
+    ms = ms / 2 + jitter() % (ms / 2 + 1);      // in [ms/2, ms]
+
+    sigprocmask(SIG_BLOCK, NULL, &mask);
+    if (reap) {
+        sigdelset(&mask, SIGCHLD);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    end.tv_sec += ms / 1000;
+    end.tv_nsec += (ms % 1000) * 1000000L;
+    if (end.tv_nsec >= 1000000000L) {
+        end.tv_sec++;
+        end.tv_nsec -= 1000000000L;
+    }
+    for (;;) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        delay.tv_sec = end.tv_sec - now.tv_sec;
+        delay.tv_nsec = end.tv_nsec - now.tv_nsec;
+        if (delay.tv_nsec < 0) {
+            delay.tv_sec--;
+            delay.tv_nsec += 1000000000L;
+        }
+        if (delay.tv_sec < 0 ||
+            pselect(0, NULL, NULL, NULL, &delay, &mask) == 0 ||
+            errno != EINTR) {
+            break;
+        }
+    }
+    stats.backoff_ms += ms;
+}
+
+/*
+ * retry - Create a process with spawn(arg), retrying within the budget,
+ * and reaping children between attempts if reap
+ */
+static pid_t retry(pid_t (*spawn)(void *), void *arg, bool reap) {
+    pid_t pid;
+    int attempt = 0, err;
+
+    while ((pid = spawn(arg)) < 0) {
+        err = errno;
+        if (!retryable(err) || attempt == fork_retries) {
+            if (retryable(err)) {
+                stats.exhausted++;
+            } else {
+                stats.failed++;
+            }
+            errno = err;
+            return -1;
+        }
+        backoff(attempt++, reap);
+        stats.retries++;
+    }
+    if (pid > 0) {
+        stats.forks++;
+        stats.recovered += (attempt > 0);
+    }
+    return pid;
+}
+
+/* spawn_retry - Create a process, retrying within the budget */
+pid_t spawn_retry(pid_t (*spawn)(void *), void *arg) {
+    return retry(spawn, arg, true);
+}
+
+/* do_fork - fork, for retry */
+static pid_t do_fork(void *arg) {
+    (void)arg;
+    return fork();
+}
+
+/* fork_retry - fork, retrying within the budget */
+pid_t fork_retry(void) {
+    return retry(do_fork, NULL, true);
+}
+
+/* fork_retry_masked - fork_retry, sleeping with the signal mask as it is */
+pid_t fork_retry_masked(void) {
+    return retry(do_fork, NULL, false);
+}
+
+/* fork_failed - Report a fork that failed */
+void fork_failed(int err) {
+    if (retryable(err) && fork_retries > 0) {
+        sio_printf("fork: %s (gave up after %d retries)\n", strerror(err),
+                   fork_retries);
+    } else {
+        sio_printf("fork: %s\n", strerror(err));
+    }
+}
+
+/* fork_set_retries - Set the retry budget */
+void fork_set_retries(int retries) {
+    fork_retries = retries;
+}
+
+/* fork_print - Describe the retry budget and the counters */
+void fork_print(void) {
+    printf("forkretry: %d retries, backoff %dms to %dms\n", fork_retries,
+           FORK_BACKOFF_BASE_MS, FORK_BACKOFF_MAX_MS);
+    printf("forks: %lu, recovered %lu, retries %lu, backoff %ldms, "
+           "gave up %lu, failed %lu\n", stats.forks, stats.recovered,
+           stats.retries, stats.backoff_ms, stats.exhausted, stats.failed);
+}
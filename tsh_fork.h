@@ -0,0 +1,75 @@
+#ifndef __TSH_FORK_H__
+#define __TSH_FORK_H__
+
+/*
+ * tsh_fork.h: forking with retries for tshlab
+ *
+ * fork fails with EAGAIN when the user is at RLIMIT_NPROC or the system
+ * is out of processes, and with ENOMEM when the kernel cannot allocate
+ * the new process; both are usually transient on a loaded host. Rather
+ * than drop the command, the shell retries such a fork a few times (the
+ * retry budget, set by the forkretry builtin), sleeping between attempts
+ * for a delay that doubles from FORK_BACKOFF_BASE_MS up to
+ * FORK_BACKOFF_MAX_MS, each drawn at random from its upper half so that
+ * shells failing together do not retry in lockstep. The worst case, with
+ * the default budget, is a little over half a second. Exited children
+ * count against RLIMIT_NPROC until reaped, so SIGCHLD is let in during
+ * the sleep, unless the caller has a child that its handler must not
+ * reap yet.
+ *
+ * Counters of forks, retries and failures are kept for forkretry to
+ * print.
+ */
+
+#include "tsh_helper.h"
+
+#define FORK_DEFAULT_RETRIES    6
+#define FORK_MAX_RETRIES        20
+#define FORK_BACKOFF_BASE_MS    10
+#define FORK_BACKOFF_MAX_MS     500
+
+struct fork_stats
+{
+    unsigned long forks;        // Processes created
+    unsigned long recovered;    // Of them, created after retrying
+    unsigned long retries;      // Failed attempts retried
+    unsigned long exhausted;    // Forks given up with the budget spent
+    unsigned long failed;       // Forks given up for other errors
+    long backoff_ms;            // Time slept between attempts
+};
+
+/*
+ * fork_retry forks, retrying within the budget if fork fails with EAGAIN
+ * or ENOMEM. Returns as fork does; on failure errno is the last error.
+ * Signals may be blocked; SIGCHLD alone is let in while a retry sleeps,
+ * so its handler must be safe to run at the call.
+ */
+pid_t fork_retry(void);
+
+/*
+ * fork_retry_masked is fork_retry for a caller that has forked a child
+ * it has not recorded yet (see add_job), which the SIGCHLD handler would
+ * reap unseen: the signal mask is left as it is while a retry sleeps.
+ */
+pid_t fork_retry_masked(void);
+
+/*
+ * spawn_retry is fork_retry for another way of creating a process:
+ * spawn(arg) returns a pid, or -1 with errno set.
+ */
+pid_t spawn_retry(pid_t (*spawn)(void *), void *arg);
+
+/*
+ * fork_failed prints a diagnostic for a fork that failed with err,
+ * saying so if it was given up after the retry budget.
+ */
+void fork_failed(int err);
+
+/*
+ * fork_set_retries sets the retry budget; fork_print prints it and the
+ * counters.
+ */
+void fork_set_retries(int retries);
+void fork_print(void);
+
+#endif // __TSH_FORK_H__
@@ -0,0 +1,312 @@
+/* tsh_func.c
+ * aliases and shell functions for tshlab
+ */
+
+#include "tsh_func.h"
+#include "tsh_script.h"
+
+/* A name in a hash table, and the alias or function it names */
+struct entry
+{
+    struct entry *next;         // Next in its bucket
+    unsigned long hash;
+    const char *name;
+    void *item;
+};
+
+struct table
+{
+    struct entry **buckets;
+    size_t nbuckets;            // A power of two, or 0
+    size_t count;               // Number of entries
+};
+
+static struct table aliases;
+static struct table funcs;
+
+/* copy_string - A copy of str */
+static char *copy_string(const char *str) {
+    size_t len = strlen(str) + 1;
+
+    return memcpy(Malloc(len), str, len);
+}
+
+/* hash_name - FNV-1a hash of a name */
+static unsigned long hash_name(const char *name) {
+    unsigned long hash = 14695981039346656037UL;
+
+    while (*name != '\0') {
+        hash = (hash ^ (unsigned char)*name++) * 1099511628211UL;
+    }
+    return hash;
+}
+
+/*
+ * table_link - The link to the entry for name in its bucket, or the
+ * null link at the end of the bucket if there is none
+ */
+static struct entry **table_link(struct table *t, const char *name,
+                                 unsigned long hash) {
+    struct entry **link = &t->buckets[hash & (t->nbuckets - 1)];
+
+    while (*link != NULL &&
+           ((*link)->hash != hash || strcmp((*link)->name, name) != 0)) {
+        link = &(*link)->next;
+    }
+    return link;
+}
+
+/* table_find - The item named name, or NULL */
+static void *table_find(struct table *t, const char *name) {
+    struct entry *e;
+
+    if (t->count == 0) {
+        return NULL;
+    }
+    e = *table_link(t, name, hash_name(name));
+    return (e != NULL) ? e->item : NULL;
+}
+
+/* table_grow - Double the buckets of a table */
+static void table_grow(struct table *t) {
+    size_t n = (t->nbuckets > 0) ? 2 * t->nbuckets : 16;
+    struct entry **buckets = Calloc(n, sizeof(buckets[0]));
+    struct entry *e, *next;
+    size_t i;
+
+    for (i = 0; i < t->nbuckets; i++) {
+        for (e = t->buckets[i]; e != NULL; e = next) {
+            next = e->next;
+            e->next = buckets[e->hash & (n - 1)];
+            buckets[e->hash & (n - 1)] = e;
+        }
+    }
+    free(t->buckets);
+    t->buckets = buckets;
+    t->nbuckets = n;
+}
+
+/*
+ * table_put - Enter item under name (which must live as long as it).
+ * Returns the item it replaces, or NULL.
+ */
+static void *table_put(struct table *t, const char *name, void *item) {
+    unsigned long hash = hash_name(name);
+    struct entry **link;
+    struct entry *e;
+    void *old;
+
+    if (t->count >= t->nbuckets) {
+        table_grow(t);
+    }
+    link = table_link(t, name, hash);
+    if ((e = *link) != NULL) {
+        old = e->item;
+        e->name = name;
+        e->item = item;
+        return old;
+    }
+
+    e = Malloc(sizeof(*e));
+    e->next = NULL;
+    e->hash = hash;
+    e->name = name;
+    e->item = item;
+    *link = e;
+    t->count++;
+    return NULL;
+}
+
+/* table_remove - Remove name from a table. Returns its item, or NULL. */
+static void *table_remove(struct table *t, const char *name) {
+    struct entry **link;
+    struct entry *e;
+    void *item;
+
+    if (t->count == 0) {
+        return NULL;
+    }
+    link = table_link(t, name, hash_name(name));
+    if ((e = *link) == NULL) {
+        return NULL;
+    }
+    *link = e->next;
+    item = e->item;
+    free(e);
+    t->count--;
+    return item;
+}
+
+/* alias_free - Free an alias */
+static void alias_free(struct alias *alias) {
+    free(alias->storage);
+    free(alias->words);
+    free(alias->expand);
+    free(alias->value);
+    free(alias->name);
+    free(alias);
+}
+
+/*
+ * split_value - Split the value of an alias into words, as parseline
+ * would, marking those that need expanding. Returns false if it is not
+ * a simple command.
+ */
+static bool split_value(struct alias *alias) {
+    const char delims[] = " \t\r\n";
+    char *p = alias->storage = copy_string(alias->value);
+    char *word, *end, *op;
+    bool quoted;
+    size_t cap = strlen(p) / 2 + 1;     // words are at least 1 char apart
+
+    alias->words = Malloc(cap * sizeof(alias->words[0]));
+    alias->expand = Malloc(cap * sizeof(alias->expand[0]));
+    alias->nwords = 0;
+
+    while (true) {
+        p += strspn(p, delims);
+        if (*p == '\0') {
+            return true;
+        }
+        quoted = (*p == '\'' || *p == '"');
+        if (quoted) {
+            word = p + 1;
+            if ((end = strchr(word, *p)) == NULL) {
+                return false;
+            }
+        } else {
+            word = p;
+            end = p + strcspn(p, delims);
+            if ((op = strpbrk(word, "<>&;|")) != NULL && op < end) {
+                return false;           // redirection or list operator
+            }
+        }
+        p = (*end == '\0') ? end : end + 1;
+        *end = '\0';
+
+        alias->words[alias->nwords] = word;
+        alias->expand[alias->nwords] = !quoted &&
+                                       word[strcspn(word, "$*?[{")] != '\0';
+        alias->nwords++;
+    }
+}
+
+/* alias_define - Define an alias */
+bool alias_define(const char *name, const char *value) {
+    struct alias *alias, *old;
+    size_t len = strlen(name);
+
+    if (len == 0 || strcspn(name, " \t\r\n=/$'\"<>&;|") != len) {
+        printf("alias: %s: invalid alias name\n", name);
+        return false;
+    }
+
+    alias = Calloc(1, sizeof(*alias));
+    alias->name = copy_string(name);
+    alias->value = copy_string(value);
+    if (!split_value(alias)) {
+        printf("alias: %s: value must be a simple command\n", name);
+        alias_free(alias);
+        return false;
+    }
+    if ((old = table_put(&aliases, alias->name, alias)) != NULL) {
+        alias_free(old);
+    }
+    return true;
+}
+
+/* alias_find - Find an alias */
+const struct alias *alias_find(const char *name) {
+    return table_find(&aliases, name);
+}
+
+/* alias_remove - Remove an alias */
+bool alias_remove(const char *name) {
+    struct alias *alias = table_remove(&aliases, name);
+
+    if (alias == NULL) {
+        return false;
+    }
+    alias_free(alias);
+    return true;
+}
+
+/* alias_clear - Remove every alias */
+void alias_clear(void) {
+    struct entry *e, *next;
+    size_t i;
+
+    for (i = 0; i < aliases.nbuckets; i++) {
+        for (e = aliases.buckets[i]; e != NULL; e = next) {
+            next = e->next;
+            alias_free(e->item);
+            free(e);
+        }
+        aliases.buckets[i] = NULL;
+    }
+    aliases.count = 0;
+}
+
+/* compare_aliases - Order aliases by name, for qsort */
+static int compare_aliases(const void *a, const void *b) {
+    return strcmp((*(struct alias *const *)a)->name,
+                  (*(struct alias *const *)b)->name);
+}
+
+/* alias_print - Print the aliases */
+void alias_print(void) {
+    struct alias **sorted;
+    struct entry *e;
+    size_t i, n = 0;
+
+    if (aliases.count == 0) {
+        return;
+    }
+    sorted = Malloc(aliases.count * sizeof(sorted[0]));
+    for (i = 0; i < aliases.nbuckets; i++) {
+        for (e = aliases.buckets[i]; e != NULL; e = e->next) {
+            sorted[n++] = e->item;
+        }
+    }
+    qsort(sorted, n, sizeof(sorted[0]), compare_aliases);
+    for (i = 0; i < n; i++) {
+        printf("alias %s='%s'\n", sorted[i]->name, sorted[i]->value);
+    }
+    free(sorted);
+}
+
+/* func_free - Free a function, letting go of its script */
+static void func_free(struct func *func) {
+    script_release(func->script);
+    free(func->name);
+    free(func);
+}
+
+/* func_define - Define a function */
+void func_define(const char *name, struct script *script, int entry) {
+    struct func *func = Malloc(sizeof(*func)), *old;
+
+    func->name = copy_string(name);
+    func->script = script;
+    func->entry = entry;
+    script_hold(script);
+    if ((old = table_put(&funcs, func->name, func)) != NULL) {
+        func_free(old);
+    }
+}
+
+/* func_find - Find a function */
+const struct func *func_find(const char *name) {
+    return table_find(&funcs, name);
+}
+
+/* func_remove - Remove a function */
+bool func_remove(const char *name) {
+    struct func *func = table_remove(&funcs, name);
+
+    if (func == NULL) {
+        return false;
+    }
+    func_free(func);
+    return true;
+}
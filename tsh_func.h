@@ -0,0 +1,89 @@
+#ifndef __TSH_FUNC_H__
+#define __TSH_FUNC_H__
+
+/*
+ * tsh_func.h: aliases and shell functions for tshlab
+ *
+ * An alias stands for the words it was defined with, which replace the
+ * command name of a line that uses it. The value is split into words
+ * once, when the alias is defined, and each word is marked as literal
+ * (quoted, or free of anything to expand) or to be expanded; using the
+ * alias only splices the words into the parsed line (see parse_splice)
+ * and expands the marked ones, as parseline would have.
+ *
+ * A function, defined by NAME() { ... } in a script or at the prompt,
+ * is a piece of a compiled script (see tsh_script.h), whose command
+ * lines were split into words as it was compiled: calling one runs its
+ * instructions, which only expand those words (for $1 ... and the
+ * variables they use), with no parsing of the text.
+ *
+ * Both are kept in hash tables on their names, and looked up before a
+ * command is dispatched; while a table is empty, the lookup costs only
+ * a test of its count.
+ */
+
+#include "tsh_helper.h"
+
+struct script;
+
+struct alias
+{
+    char *name;
+    char *value;                // As defined, for printing
+    char *storage;              // Text of its words
+    int nwords;                 // Its words
+    char **words;
+    bool *expand;               // Which of them need expanding
+};
+
+struct func
+{
+    char *name;
+    struct script *script;      // Script holding the body
+    int entry;                  // Instruction at which the body starts
+};
+
+/*
+ * alias_define defines alias name to stand for value. Returns false
+ * after printing a diagnostic if name is not a valid alias name or value
+ * is not a simple command (words only: no redirections, lists or &).
+ */
+bool alias_define(const char *name, const char *value);
+
+/*
+ * alias_find returns the alias named name, or NULL.
+ */
+const struct alias *alias_find(const char *name);
+
+/*
+ * alias_remove removes alias name. Returns false if there is none.
+ */
+bool alias_remove(const char *name);
+
+/*
+ * alias_clear removes every alias.
+ */
+void alias_clear(void);
+
+/*
+ * alias_print prints the definitions of the aliases, sorted by name.
+ */
+void alias_print(void);
+
+/*
+ * func_define defines function name as the body starting at instruction
+ * entry of script, which it holds on to.
+ */
+void func_define(const char *name, struct script *script, int entry);
+
+/*
+ * func_find returns the function named name, or NULL.
+ */
+const struct func *func_find(const char *name);
+
+/*
+ * func_remove removes function name. Returns false if there is none.
+ */
+bool func_remove(const char *name);
+
+#endif // __TSH_FUNC_H__
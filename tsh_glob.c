@@ -0,0 +1,494 @@
+/* tsh_glob.c
+ * pathname expansion for tshlab
+ */
+
+#include <stdint.h>
+#include <limits.h>
+#include <sys/syscall.h>
+
+#include "tsh_glob.h"
+
+#define GLOB_MAXCOMPS   128             /* max components in a pattern */
+#define GLOB_DENTS_BUF  (128 * 1024)    /* bytes read per getdents64 */
+#define GLOB_CHUNK      (64 * 1024)     /* bytes per chunk of matches */
+
+/* Operations of a compiled component */
+typedef enum glob_op_kind
+{
+    OP_CHAR,                    // The character ch
+    OP_ANY,                     // Any character (?)
+    OP_STAR,                    // Any string (*)
+    OP_CLASS                    // Any character in set ([...])
+} glob_op_kind;
+
+struct glob_op
+{
+    glob_op_kind kind;
+    unsigned char ch;           // OP_CHAR: the character
+    uint32_t set[8];            // OP_CLASS: bit c set if c is in the class
+};
+
+/* A component of a pattern, between slashes */
+struct glob_comp
+{
+    const char *text;           // The component, in the pattern
+    size_t len;                 // Its length
+    struct glob_op *ops;        // Its compiled form, or NULL if literal
+    int nops;                   // Number of ops
+};
+
+struct glob_pattern
+{
+    bool absolute;              // Starts with /
+    bool dir_only;              // Ends with /: only matches directories
+    int ncomps;                 // Number of components
+    size_t prefix_len;          // Length of the start every match shares
+    struct glob_comp comps[GLOB_MAXCOMPS];
+    struct glob_op *ops;        // Storage of the compiled components
+};
+
+/* Storage of the matches of a list */
+struct glob_chunk
+{
+    struct glob_chunk *next;
+    size_t used;                // Bytes of data in use
+    size_t size;                // Bytes of data
+    char data[];
+};
+
+/* Directory entry, as returned by getdents64 */
+struct glob_dirent
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+static char *dents = NULL;      // getdents64 buffer, allocated on first use
+
+/* glob_is_pattern - Test a word for wildcards */
+bool glob_is_pattern(const char *word) {
+    return strpbrk(word, "*?[") != NULL;
+}
+
+/*
+ * class_end - The ] closing the class whose contents start at p, or NULL
+ * if there is none (the [ is then an ordinary character)
+ */
+static const char *class_end(const char *p, const char *end) {
+    if (p < end && (*p == '!' || *p == '^')) {
+        p++;
+    }
+    if (p < end && *p == ']') {
+        p++;                    // a leading ] is part of the class
+    }
+    while (p < end && *p != ']') {
+        p++;
+    }
+    return (p < end) ? p : NULL;
+}
+
+/*
+ * compile_comp - Compile the component text (of length len) into ops,
+ * returning their number. Sets *magic if any of them is a wildcard.
+ */
+static int compile_comp(const char *text, size_t len, struct glob_op *ops,
+                        bool *magic) {
+    const char *p = text;
+    const char *end = text + len;
+    const char *close;
+    struct glob_op *op;
+    unsigned c, hi;
+    bool negate;
+    int n = 0;
+
+    *magic = false;
+    while (p < end) {
+        op = &ops[n++];
+        if (*p == '*') {
+            op->kind = OP_STAR;
+            while (p < end && *p == '*') {
+                p++;            // ** is the same as *
+            }
+            *magic = true;
+        } else if (*p == '?') {
+            op->kind = OP_ANY;
+            p++;
+            *magic = true;
+        } else if (*p == '[' && (close = class_end(p + 1, end)) != NULL) {
+            op->kind = OP_CLASS;
+            memset(op->set, 0, sizeof(op->set));
+            p++;
+            negate = (*p == '!' || *p == '^');
+            if (negate) {
+                p++;
+            }
+            do {
+                c = hi = (unsigned char)*p++;
+                if (p + 1 < close && *p == '-') {
+                    hi = (unsigned char)p[1];
+                    p += 2;
+                }
+                for (; c <= hi; c++) {
+                    op->set[c / 32] |= 1u << (c % 32);
+                }
+            } while (p < close);
+            if (negate) {
+                for (c = 0; c < 8; c++) {
+                    op->set[c] = ~op->set[c];
+                }
+            }
+            p = close + 1;
+            *magic = true;
+        } else {
+            op->kind = OP_CHAR;
+            op->ch = *p++;
+        }
+    }
+    return n;
+}
+
+/*
+ * compile - Split pattern into components and compile those with
+ * wildcards. Returns false if there are none, or too many components.
+ */
+static bool compile(const char *pattern, struct glob_pattern *pat) {
+    struct glob_comp *comp;
+    struct glob_op *ops;
+    const char *p, *slash;
+    bool magic, any = false;
+    int n;
+
+    pat->absolute = (pattern[0] == '/');
+    pat->dir_only = (pattern[0] != '\0' &&
+                     pattern[strlen(pattern) - 1] == '/');
+    pat->ncomps = 0;
+    pat->prefix_len = pat->absolute ? 1 : 0;
+    pat->ops = ops = Malloc((strlen(pattern) + 1) * sizeof(*ops));
+
+    for (p = pattern; *p != '\0'; p = slash) {
+        while (*p == '/') {
+            p++;
+        }
+        if (*p == '\0') {
+            break;
+        }
+        if ((slash = strchr(p, '/')) == NULL) {
+            slash = p + strlen(p);
+        }
+        if (pat->ncomps == GLOB_MAXCOMPS) {
+            any = false;
+            break;
+        }
+        comp = &pat->comps[pat->ncomps++];
+        comp->text = p;
+        comp->len = slash - p;
+        comp->nops = compile_comp(p, comp->len, ops, &magic);
+        comp->ops = magic ? ops : NULL;
+        if (magic && !any) {
+            /* the literal start of the first wildcard component */
+            for (n = 0; n < comp->nops && ops[n].kind == OP_CHAR; n++) {
+                pat->prefix_len++;
+            }
+        } else if (!any) {
+            pat->prefix_len += comp->len + 1;
+        }
+        if (magic) {
+            ops += comp->nops;
+            any = true;
+        }
+    }
+
+    if (!any) {
+        Free(pat->ops);
+    }
+    return any;
+}
+
+/* match_op - Test a character against one op (not OP_STAR) */
+static bool match_op(const struct glob_op *op, unsigned char c) {
+    switch (op->kind) {
+    case OP_CHAR:
+        return c == op->ch;
+    case OP_CLASS:
+        return (op->set[c / 32] >> (c % 32)) & 1;
+    default:
+        return true;
+    }
+}
+
+/*
+ * match_comp - Test a file name against a compiled component. A * that
+ * fails to match is retried one character further on; only the last *
+ * needs to be retried, so matching never backtracks further.
+ */
+static bool match_comp(const struct glob_comp *comp, const char *name) {
+    const struct glob_op *ops = comp->ops;
+    const char *retry = NULL;
+    int p = 0;
+    int star = -1;
+
+    /* a leading . must be matched explicitly */
+    if (name[0] == '.' && (ops[0].kind != OP_CHAR || ops[0].ch != '.')) {
+        return false;
+    }
+
+    while (*name != '\0') {
+        if (p < comp->nops && ops[p].kind == OP_STAR) {
+            star = ++p;
+            retry = name;
+        } else if (p < comp->nops && match_op(&ops[p], *name)) {
+            p++;
+            name++;
+        } else if (star >= 0) {
+            p = star;
+            name = ++retry;
+        } else {
+            return false;
+        }
+    }
+    while (p < comp->nops && ops[p].kind == OP_STAR) {
+        p++;
+    }
+    return p == comp->nops;
+}
+
+/* add_path - Append a copy of path (of length len) to list */
+static void add_path(struct glob_list *list, const char *path, size_t len) {
+    struct glob_chunk *chunk = list->chunks;
+    size_t size;
+
+    if (chunk == NULL || chunk->size - chunk->used < len + 1) {
+        size = (len + 1 > GLOB_CHUNK) ? len + 1 : GLOB_CHUNK;
+        chunk = Malloc(sizeof(*chunk) + size);
+        chunk->next = list->chunks;
+        chunk->used = 0;
+        chunk->size = size;
+        list->chunks = chunk;
+    }
+    if (list->count == list->cap) {
+        list->cap = (list->cap == 0) ? 256 : list->cap * 2;
+        list->paths = Realloc(list->paths, list->cap * sizeof(char *));
+    }
+
+    list->paths[list->count] = chunk->data + chunk->used;
+    memcpy(chunk->data + chunk->used, path, len);
+    chunk->data[chunk->used + len] = '\0';
+    chunk->used += len + 1;
+    list->count++;
+}
+
+/*
+ * is_dir - Test whether the entry d, at path (of length len), is a
+ * directory, using stat only if the entry does not say
+ */
+static bool is_dir(const struct glob_dirent *d, char *path, size_t len) {
+    struct stat st;
+
+    if (d->d_type == DT_DIR) {
+        return true;
+    }
+    if (d->d_type != DT_LNK && d->d_type != DT_UNKNOWN) {
+        return false;
+    }
+    path[len] = '\0';
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static void glob_from(const struct glob_pattern *pat, int i, char *path,
+                      size_t len, struct glob_list *list);
+
+/*
+ * glob_dir - Add the matches of components i.. of pat, where component
+ * i has wildcards, in the directory path (of length len: empty, or
+ * ending with /)
+ */
+static void glob_dir(const struct glob_pattern *pat, int i, char *path,
+                     size_t len, struct glob_list *list) {
+    const struct glob_comp *comp = &pat->comps[i];
+    bool last = (i == pat->ncomps - 1);
+    struct glob_list subdirs = { NULL, 0, 0, NULL };
+    struct glob_dirent *d;
+    size_t nlen, j;
+    long n, off;
+    int fd;
+
+    path[len] = '\0';
+    fd = open((len > 0) ? path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    if (dents == NULL) {
+        dents = Malloc(GLOB_DENTS_BUF);
+    }
+
+    while ((n = syscall(SYS_getdents64, fd, dents, GLOB_DENTS_BUF)) > 0) {
+        for (off = 0; off < n; off += d->d_reclen) {
+            d = (struct glob_dirent *)(dents + off);
+            if (!match_comp(comp, d->d_name) ||
+                strcmp(d->d_name, ".") == 0 ||
+                strcmp(d->d_name, "..") == 0) {
+                continue;
+            }
+            nlen = strlen(d->d_name);
+            if (len + nlen + 2 > PATH_MAX) {
+                continue;
+            }
+            memcpy(path + len, d->d_name, nlen);
+
+            if (!last) {
+                /* anything that may be a directory is read later, once
+                 * this directory's entries are no longer needed */
+                if (d->d_type == DT_DIR || d->d_type == DT_LNK ||
+                    d->d_type == DT_UNKNOWN) {
+                    add_path(&subdirs, d->d_name, nlen);
+                }
+            } else if (!pat->dir_only) {
+                add_path(list, path, len + nlen);
+            } else if (is_dir(d, path, len + nlen)) {
+                path[len + nlen] = '/';
+                add_path(list, path, len + nlen + 1);
+            }
+        }
+    }
+    close(fd);
+
+    for (j = 0; j < subdirs.count; j++) {
+        nlen = strlen(subdirs.paths[j]);
+        memcpy(path + len, subdirs.paths[j], nlen);
+        path[len + nlen] = '/';
+        glob_from(pat, i + 1, path, len + nlen + 1, list);
+    }
+    glob_reset(&subdirs);
+    Free(subdirs.paths);
+}
+
+/*
+ * glob_from - Add the matches of components i.. of pat below the
+ * directory path (of length len: empty, or ending with /)
+ */
+static void glob_from(const struct glob_pattern *pat, int i, char *path,
+                      size_t len, struct glob_list *list) {
+    const struct glob_comp *comp;
+    struct stat st;
+
+    /* literal components are taken as they are, without reading */
+    for (; i < pat->ncomps && pat->comps[i].ops == NULL; i++) {
+        comp = &pat->comps[i];
+        if (len + comp->len + 2 > PATH_MAX) {
+            return;
+        }
+        memcpy(path + len, comp->text, comp->len);
+        len += comp->len;
+        path[len++] = '/';
+    }
+
+    if (i < pat->ncomps) {
+        glob_dir(pat, i, path, len, list);
+        return;
+    }
+
+    /* the pattern ends with literal components: they must exist */
+    path[len - 1] = '\0';
+    if (pat->dir_only ? stat(path, &st) == 0 && S_ISDIR(st.st_mode)
+                      : lstat(path, &st) == 0) {
+        add_path(list, path, pat->dir_only ? len : len - 1);
+    }
+    path[len - 1] = '/';
+}
+
+/* byte_at - Byte depth of path, as strcmp compares it */
+#define byte_at(path, depth) ((unsigned char)(path)[depth])
+
+/*
+ * sort_paths - Sort n paths, which agree on their first depth bytes, in
+ * strcmp order. This is a three-way radix quicksort: it partitions on
+ * one byte at a time, so the prefix that matches of a pattern usually
+ * share (their directory, at least) is looked at once per level rather
+ * than in every comparison, as qsort would.
+ */
+static void sort_paths(char **paths, size_t n, size_t depth) {
+    size_t lt, gt, i, j;
+    unsigned pivot, a, b, c;
+    char *t;
+
+    while (n > 1) {
+        if (n < 16) {
+            /* insertion sort for small ranges */
+            for (i = 1; i < n; i++) {
+                t = paths[i];
+                for (j = i; j > 0 &&
+                     strcmp(paths[j - 1] + depth, t + depth) > 0; j--) {
+                    paths[j] = paths[j - 1];
+                }
+                paths[j] = t;
+            }
+            return;
+        }
+
+        /* median of three bytes as the pivot */
+        a = byte_at(paths[0], depth);
+        b = byte_at(paths[n / 2], depth);
+        c = byte_at(paths[n - 1], depth);
+        pivot = (a < b) ? ((b < c) ? b : (a < c) ? c : a)
+                        : ((a < c) ? a : (b < c) ? c : b);
+
+        /* [0, lt) below the pivot, [lt, gt) equal, [gt, n) above */
+        lt = i = 0;
+        gt = n;
+        while (i < gt) {
+            c = byte_at(paths[i], depth);
+            if (c < pivot) {
+                t = paths[lt];
+                paths[lt++] = paths[i];
+                paths[i++] = t;
+            } else if (c > pivot) {
+                t = paths[--gt];
+                paths[gt] = paths[i];
+                paths[i] = t;
+            } else {
+                i++;
+            }
+        }
+
+        sort_paths(paths, lt, depth);
+        sort_paths(paths + gt, n - gt, depth);
+        if (pivot == 0) {
+            return;             // the equal range holds equal paths
+        }
+        paths += lt;
+        n = gt - lt;
+        depth++;
+    }
+}
+
+/* glob_expand - Append the sorted matches of a pattern to a list */
+size_t glob_expand(const char *pattern, struct glob_list *list) {
+    struct glob_pattern pat;
+    char path[PATH_MAX];
+    size_t start = list->count;
+
+    if (!compile(pattern, &pat)) {
+        return 0;
+    }
+    path[0] = '/';
+    glob_from(&pat, 0, path, pat.absolute ? 1 : 0, list);
+    Free(pat.ops);
+
+    sort_paths(list->paths + start, list->count - start, pat.prefix_len);
+    return list->count - start;
+}
+
+/* glob_reset - Empty a list */
+void glob_reset(struct glob_list *list) {
+    struct glob_chunk *chunk, *next;
+
+    for (chunk = list->chunks; chunk != NULL; chunk = next) {
+        next = chunk->next;
+        Free(chunk);
+    }
+    list->chunks = NULL;
+    list->count = 0;
+}
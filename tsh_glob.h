@@ -0,0 +1,57 @@
+#ifndef __TSH_GLOB_H__
+#define __TSH_GLOB_H__
+
+/*
+ * tsh_glob.h: pathname expansion for tshlab
+ *
+ * A word containing *, ? or [...] is a pattern for the file names it
+ * matches. The pattern is compiled once, component by component: a
+ * component without wildcards is used as it is, without reading its
+ * directory, and only the directories a wildcard component applies to
+ * are read, in large getdents64 batches.
+ *
+ * No file is stat'ed unless the pattern needs it: to check that a
+ * trailing literal component exists, or that a match of a pattern
+ * ending in / is a directory when its directory entry does not say.
+ * Names starting with . are only matched by a component starting with
+ * an explicit ., and . and .. are never matched.
+ *
+ * The matches of each pattern are sorted by strcmp, which is the order
+ * of the POSIX locale the shell runs in.
+ */
+
+#include "tsh_helper.h"
+
+/*
+ * Matches of one or more patterns, in order. The paths are kept in
+ * chunks owned by the list, and stay valid until glob_reset.
+ */
+struct glob_chunk;
+
+struct glob_list
+{
+    char **paths;               // The matches
+    size_t count;               // Number of matches
+    size_t cap;                 // Size of paths
+    struct glob_chunk *chunks;  // Storage of the matches
+};
+
+/*
+ * glob_is_pattern returns true if word contains a wildcard.
+ */
+bool glob_is_pattern(const char *word);
+
+/*
+ * glob_expand appends the sorted matches of pattern to list. Returns the
+ * number of matches, or 0 if there is none (the word is then used as
+ * it is).
+ */
+size_t glob_expand(const char *pattern, struct glob_list *list);
+
+/*
+ * glob_reset empties list, freeing the storage of its matches but
+ * keeping paths for reuse. A list that is all zeros is empty.
+ */
+void glob_reset(struct glob_list *list);
+
+#endif // __TSH_GLOB_H__
@@ -0,0 +1,345 @@
+/* tsh_governor.c
+ * resource governor for tshlab background jobs
+ */
+
+#include "tsh_governor.h"
+#include "tsh_proc.h"
+#include "tsh_timer.h"
+
+/* RSS thresholds in kbytes (0 for none) and the sampling interval */
+static long rss_soft_kb = 0;
+static long rss_hard_kb = 0;
+static long rss_interval_ms = GOVERNOR_DEFAULT_INTERVAL;
+
+/* Load and CPU pressure thresholds in hundredths (high 0 for none) */
+static struct throttle_limits throttle = { 0, 0, 0, 0 };
+static long throttle_interval_ms = GOVERNOR_DEFAULT_INTERVAL;
+
+/* Demotion of background jobs: nice increment and SCHED_BATCH */
+static int autonice_increment = 0;
+static bool autonice_batch = false;
+
+/* Time of the next sample of each kind, or 0 if none is scheduled */
+static long next_rss_ms = 0;
+static long next_load_ms = 0;
+static volatile sig_atomic_t samples_due = 0;   // Set by governor_tick
+
+/* parse_size_kb - Parse a size with an optional K, M or G suffix */
+bool parse_size_kb(const char *str, long *kb) {
+    char *end;
+    double value;
+    double scale;
+
+    value = strtod(str, &end);
+    if (end == str || value < 0) {
+        return false;
+    }
+
+    if (*end == '\0' || strcasecmp(end, "k") == 0) {
+        scale = 1;
+    } else if (strcasecmp(end, "m") == 0) {
+        scale = 1024;
+    } else if (strcasecmp(end, "g") == 0) {
+        scale = 1024 * 1024;
+    } else {
+        return false;
+    }
+
+    *kb = (long)(value * scale);
+    return true;
+}
+
+/* parse_watermarks - Parse "HIGH[:LOW]" in hundredths */
+bool parse_watermarks(const char *str, long *high_x100, long *low_x100) {
+    char *end;
+    double high, low;
+
+    high = strtod(str, &end);
+    if (end == str || high <= 0) {
+        return false;
+    }
+    if (*end == ':') {
+        str = end + 1;
+        low = strtod(str, &end);
+        if (end == str || low < 0 || low >= high) {
+            return false;
+        }
+    } else {
+        low = high * 3 / 4;
+    }
+    if (*end != '\0') {
+        return false;
+    }
+
+    *high_x100 = (long)(high * 100);
+    *low_x100 = (long)(low * 100);
+    return true;
+}
+
+/* governor_set_rss - Configure the RSS thresholds */
+void governor_set_rss(long soft_kb, long hard_kb, long interval_ms) {
+    rss_soft_kb = soft_kb;
+    rss_hard_kb = hard_kb;
+    rss_interval_ms = interval_ms;
+    next_rss_ms = 0;
+    job_timer_arm();
+}
+
+/* governor_set_throttle - Configure the load and pressure watermarks */
+void governor_set_throttle(const struct throttle_limits *limits,
+                           long interval_ms) {
+    struct job_t *job = NULL;
+
+    throttle = *limits;
+    throttle_interval_ms = interval_ms;
+    next_load_ms = 0;
+
+    /* nothing stays throttled once throttling is off */
+    if (throttle.load_high == 0 && throttle.psi_high == 0) {
+        while ((job = get_next_job(job)) != NULL) {
+            if (get_state_of_job(job) == TH) {
+                kill(-get_pid_of_job(job), SIGCONT);
+                set_state_of_job(job, BG);
+            }
+        }
+    }
+    job_timer_arm();
+}
+
+/* governor_print_rss - Describe the RSS governor settings */
+void governor_print_rss(void) {
+    if (rss_soft_kb == 0 && rss_hard_kb == 0) {
+        printf("rssguard: off\n");
+        return;
+    }
+    printf("rssguard: soft %ldK, hard %ldK, every %ldms\n",
+           rss_soft_kb, rss_hard_kb, rss_interval_ms);
+}
+
+/* governor_print_throttle - Describe the throttle settings and the load */
+void governor_print_throttle(void) {
+    long load, psi;
+
+    if (throttle.load_high == 0 && throttle.psi_high == 0) {
+        printf("throttle: off\n");
+    } else {
+        printf("throttle:");
+        if (throttle.load_high != 0) {
+            printf(" load %ld.%02ld:%ld.%02ld,",
+                   throttle.load_high / 100, throttle.load_high % 100,
+                   throttle.load_low / 100, throttle.load_low % 100);
+        }
+        if (throttle.psi_high != 0) {
+            printf(" cpu pressure %ld.%02ld%%:%ld.%02ld%%,",
+                   throttle.psi_high / 100, throttle.psi_high % 100,
+                   throttle.psi_low / 100, throttle.psi_low % 100);
+        }
+        printf(" every %ldms\n", throttle_interval_ms);
+    }
+
+    if (proc_loadavg(&load)) {
+        printf("load average %ld.%02ld", load / 100, load % 100);
+        if (proc_cpu_pressure(&psi)) {
+            printf(", cpu pressure %ld.%02ld%%", psi / 100, psi % 100);
+        }
+        printf("\n");
+    }
+}
+
+/* governor_set_autonice - Configure the demotion of background jobs */
+void governor_set_autonice(int increment, bool batch) {
+    autonice_increment = increment;
+    autonice_batch = batch;
+}
+
+/* governor_print_autonice - Describe the demotion settings */
+void governor_print_autonice(void) {
+    if (autonice_increment == 0 && !autonice_batch) {
+        printf("autonice: off\n");
+        return;
+    }
+    printf("autonice: nice +%d%s\n", autonice_increment,
+           autonice_batch ? ", SCHED_BATCH" : "");
+}
+
+/* governor_demote - Lower the priority of a job leaving the foreground */
+int governor_demote(struct job_t *job) {
+    struct job_sched *sched = get_sched_of_job(job);
+    struct placement place;
+    pid_t pid = get_pid_of_job(job);
+
+    if ((autonice_increment == 0 && !autonice_batch) ||
+        (get_flags_of_job(job) & JOB_DEMOTED)) {
+        return 0;
+    }
+    if (!proc_sched_of(pid, &sched->nice, &sched->policy)) {
+        return -1;
+    }
+
+    place.flags = PLACE_NICE;
+    place.nice = sched->nice + autonice_increment;
+    place.nice = (place.nice > 19) ? 19 : place.nice;
+    if (autonice_batch && sched->policy == SCHED_OTHER) {
+        place.flags |= PLACE_POLICY;
+        place.policy = SCHED_BATCH;
+    }
+    set_flags_of_job(job, get_flags_of_job(job) | JOB_DEMOTED);
+    return placement_apply_pgrp(pid, &place);
+}
+
+/* governor_restore - Give a demoted job its original priority back */
+int governor_restore(struct job_t *job) {
+    struct job_sched *sched = get_sched_of_job(job);
+    struct placement place;
+
+    if (!(get_flags_of_job(job) & JOB_DEMOTED)) {
+        return 0;
+    }
+    set_flags_of_job(job, get_flags_of_job(job) & ~JOB_DEMOTED);
+
+    place.flags = PLACE_NICE;
+    place.nice = sched->nice;
+    if (sched->policy == SCHED_OTHER || sched->policy == SCHED_BATCH) {
+        place.flags |= PLACE_POLICY;
+        place.policy = sched->policy;
+    }
+    return placement_apply_pgrp(get_pid_of_job(job), &place);
+}
+
+/* schedule - Next sample time of one kind, or 0 if it is off */
+static long schedule(long *next, bool enabled, long interval_ms) {
+    if (!enabled) {
+        *next = 0;
+    } else if (*next == 0) {
+        *next = timer_now_ms() + interval_ms;
+    }
+    return *next;
+}
+
+/* governor_next_ms - Time of the next sample, or 0 */
+long governor_next_ms(void) {
+    bool jobs = (get_next_job(NULL) != NULL);
+    long rss, load;
+
+    /* the timer waits for the samples due to be taken first */
+    if (samples_due) {
+        return 0;
+    }
+
+    rss = schedule(&next_rss_ms, jobs && (rss_soft_kb || rss_hard_kb),
+                   rss_interval_ms);
+    load = schedule(&next_load_ms,
+                    jobs && (throttle.load_high || throttle.psi_high),
+                    throttle_interval_ms);
+    if (rss == 0 || (load != 0 && load < rss)) {
+        return load;
+    }
+    return rss;
+}
+
+/* rss_tick - Stop or kill the background jobs over an RSS threshold */
+static void rss_tick(void) {
+    struct job_t *jobs[MAXJOBS];
+    pid_t pgids[MAXJOBS];
+    long rss_kb[MAXJOBS];
+    struct job_t *job = NULL;
+    unsigned flags;
+    int i, n = 0;
+
+    while ((job = get_next_job(job)) != NULL && n < MAXJOBS) {
+        if (get_state_of_job(job) == BG) {
+            jobs[n] = job;
+            pgids[n] = get_pid_of_job(job);
+            n++;
+        }
+    }
+    if (n == 0) {
+        return;
+    }
+
+    proc_pgrp_rss(pgids, rss_kb, n);
+    for (i = 0; i < n; i++) {
+        flags = get_flags_of_job(jobs[i]);
+        if (rss_hard_kb > 0 && rss_kb[i] >= rss_hard_kb) {
+            set_flags_of_job(jobs[i], flags | JOB_RSS_KILLED);
+            kill(-pgids[i], SIGKILL);
+        } else if (rss_soft_kb > 0 && rss_kb[i] >= rss_soft_kb &&
+                   !(flags & JOB_RSS_EXEMPT)) {
+            set_flags_of_job(jobs[i], flags | JOB_RSS_STOPPED);
+            kill(-pgids[i], SIGSTOP);
+            set_state_of_job(jobs[i], ST);
+        }
+    }
+}
+
+/*
+ * load_tick - Under pressure, throttle the most recent running background
+ * job; once pressure is below the low watermarks, resume the oldest
+ * throttled job. One job changes per sample, so the load can settle.
+ */
+static void load_tick(void) {
+    struct job_t *job = NULL;
+    struct job_t *victim = NULL;
+    long load = 0, psi = 0;
+    bool have_load, have_psi, high, low;
+
+    have_load = throttle.load_high && proc_loadavg(&load);
+    have_psi = throttle.psi_high && proc_cpu_pressure(&psi);
+    high = (have_load && load >= throttle.load_high) ||
+           (have_psi && psi >= throttle.psi_high);
+    low = (!have_load || load < throttle.load_low) &&
+          (!have_psi || psi < throttle.psi_low);
+
+    while ((job = get_next_job(job)) != NULL) {
+        if (high && get_state_of_job(job) == BG &&
+            !(get_flags_of_job(job) & JOB_THROTTLE_EXEMPT) &&
+            (victim == NULL || get_jid_of_job(job) > get_jid_of_job(victim))) {
+            victim = job;
+        }
+        if (low && get_state_of_job(job) == TH &&
+            (victim == NULL || get_jid_of_job(job) < get_jid_of_job(victim))) {
+            victim = job;
+        }
+    }
+    if (victim == NULL) {
+        return;
+    }
+
+    if (high) {
+        set_state_of_job(victim, TH);
+        kill(-get_pid_of_job(victim), SIGSTOP);
+    } else {
+        set_state_of_job(victim, BG);
+        kill(-get_pid_of_job(victim), SIGCONT);
+        sio_printf("Job [%d] (%d) resumed after throttling\n",
+                   get_jid_of_job(victim), get_pid_of_job(victim));
+    }
+}
+
+/* governor_tick - Note that samples are due */
+void governor_tick(long now) {
+    if ((next_rss_ms != 0 && now >= next_rss_ms) ||
+        (next_load_ms != 0 && now >= next_load_ms)) {
+        samples_due = 1;
+    }
+}
+
+/* governor_sample - Take the samples that are due */
+bool governor_sample(void) {
+    long now;
+
+    if (!samples_due) {
+        return false;
+    }
+    samples_due = 0;
+    now = timer_now_ms();
+    if (next_rss_ms != 0 && now >= next_rss_ms) {
+        next_rss_ms = now + rss_interval_ms;
+        rss_tick();
+    }
+    if (next_load_ms != 0 && now >= next_load_ms) {
+        next_load_ms = now + throttle_interval_ms;
+        load_tick();
+    }
+    return true;
+}
@@ -0,0 +1,125 @@
+#ifndef __TSH_GOVERNOR_H__
+#define __TSH_GOVERNOR_H__
+
+/*
+ * tsh_governor.h: resource governor for tshlab background jobs
+ *
+ * When enabled, the governor samples the resident set size of every job's
+ * process group at a fixed interval. A background job above the soft
+ * threshold is stopped (and may be resumed with bg, after which only the
+ * hard threshold applies to it); a background job above the hard
+ * threshold is killed.
+ *
+ * It can also throttle background jobs while the system is overloaded:
+ * when the load average or the CPU pressure (PSI) reaches its high
+ * watermark, the most recent running background job is stopped and put in
+ * the TH state; once both are below their low watermarks, throttled jobs
+ * are resumed, oldest first. One job changes state per sample.
+ *
+ * Finally, it can demote jobs that leave the foreground (launched with &,
+ * stopped with ctrl-z, or resumed with bg) to a lower priority, and
+ * possibly SCHED_BATCH, restoring their priority when fg brings them
+ * back.
+ *
+ * Sampling is driven by the job timer: job_timer_arm also wakes up for
+ * governor_next_ms, and job_timer_tick calls governor_tick, which only
+ * notes that samples are due. Sampling scans /proc, which is no work for
+ * a signal handler, so the samples are taken by job_timer_poll, which the
+ * shell calls wherever it waits.
+ */
+
+#include "tsh_helper.h"
+
+#define GOVERNOR_DEFAULT_INTERVAL  1000     /* ms between samples */
+#define AUTONICE_DEFAULT_INCREMENT 10       /* nice added in the background */
+
+/*
+ * parse_size_kb converts a size such as "512K", "200M" or "2G" (kbytes by
+ * default) to kbytes. It returns false if the size is malformed.
+ */
+bool parse_size_kb(const char *str, long *kb);
+
+/* Watermarks for throttling, in hundredths (high 0 to ignore one) */
+struct throttle_limits
+{
+    long load_high;             // 1-minute load average that throttles
+    long load_low;              // Load average that resumes
+    long psi_high;              // CPU pressure (some avg10 %) that throttles
+    long psi_low;               // CPU pressure that resumes
+};
+
+/*
+ * parse_watermarks parses "HIGH[:LOW]" (LOW defaults to 3/4 of HIGH)
+ * into hundredths. It returns false if malformed or if LOW >= HIGH.
+ */
+bool parse_watermarks(const char *str, long *high_x100, long *low_x100);
+
+/*
+ * governor_set_rss configures the RSS thresholds, in kbytes (0 for none),
+ * and the sampling interval in ms. Both thresholds 0 disables the RSS
+ * governor. Signals must be blocked.
+ */
+void governor_set_rss(long soft_kb, long hard_kb, long interval_ms);
+
+/*
+ * governor_set_throttle configures the throttle watermarks and sampling
+ * interval. All high watermarks 0 disables throttling and resumes every
+ * throttled job. Signals must be blocked.
+ */
+void governor_set_throttle(const struct throttle_limits *limits,
+                           long interval_ms);
+
+/*
+ * governor_set_autonice configures the demotion of background jobs: the
+ * nice increment, and whether they also move to SCHED_BATCH. Increment 0
+ * without batch disables it (jobs already demoted are still restored).
+ */
+void governor_set_autonice(int increment, bool batch);
+
+/*
+ * governor_print_rss, governor_print_throttle and governor_print_autonice
+ * describe the settings on stdout; governor_print_throttle also shows
+ * the current load and CPU pressure.
+ */
+void governor_print_rss(void);
+void governor_print_throttle(void);
+void governor_print_autonice(void);
+
+/*
+ * governor_demote lowers the priority of every process of a job that is
+ * leaving the foreground, remembering the priority of its leader, and
+ * marks it JOB_DEMOTED. It does nothing if autonice is off or the job is
+ * already demoted. Returns 0 on success, or -1 with errno set.
+ * Signals must be blocked; async-signal-safe.
+ */
+int governor_demote(struct job_t *job);
+
+/*
+ * governor_restore gives a demoted job its original priority back.
+ * Returns 0 on success (or if the job was not demoted), or -1 with errno
+ * set; raising a priority again needs CAP_SYS_NICE or RLIMIT_NICE.
+ * Signals must be blocked.
+ */
+int governor_restore(struct job_t *job);
+
+/*
+ * governor_next_ms returns the time (timer_now_ms) of the next sample, or
+ * 0 if there is nothing to sample or samples are due but not yet taken.
+ * Signals must be blocked.
+ */
+long governor_next_ms(void);
+
+/*
+ * governor_tick notes whether samples are due at time now. Called from
+ * the SIGALRM handler with signals blocked.
+ */
+void governor_tick(long now);
+
+/*
+ * governor_sample takes the samples noted as due, and stops, kills,
+ * throttles or resumes background jobs accordingly. Returns false if no
+ * sample was due. Signals must be blocked; not for a signal handler.
+ */
+bool governor_sample(void);
+
+#endif // __TSH_GOVERNOR_H__
@@ -10,12 +10,17 @@
 #include <ctype.h>
 //#include <signal.h>
 #include <sys/types.h>
+#include <sys/socket.h>
 #include <fcntl.h>
 #include <sys/wait.h>
 #include <errno.h>
 #endif
 
 #include "tsh_helper.h"
+#include "tsh_proc.h"
+#include "tsh_env.h"
+#include "tsh_glob.h"
+#include "tsh_brace.h"
 
 /* Global variables */
 extern char **environ;          // Defined in libc
@@ -23,26 +28,788 @@ char prompt[] = "tsh> ";        // Command line prompt (do not change)
 bool verbose = false;           // If true, prints additional output
 bool check_block = true;        // If true, check that signals are blocked
 int nextjid = 1;                // Next job ID to allocate
+static unsigned long job_seq = 0;   // Last seq given to a job
 
 struct job_t                    // The job struct
 {
     pid_t pid;                  // Job PID
     int jid;                    // Job ID [1, 2, ...] defined in tsh_helper.c
-    job_state state;            // UNDEF, BG, FG, or ST
+    job_state state;            // UNDEF, BG, FG, ST, or TH
+    unsigned flags;             // JOB_* flags
+    struct job_timeout timeout; // Wall-clock deadline
+    struct job_sched sched;     // Priority before demotion
+    long cpu_limit;             // CPU seconds it may use, or 0 if unlimited
+    unsigned long seq;          // When it was started or last stopped
     char cmdline[MAXLINE_TSH];  // Command line
+    char name[MAXCMDNAME];      // Command name, for %name
+    pid_t driver;               // Driver of the rest of its list, or 0
+    int relay_fd;               // Where its leader's status goes, or -1
 };
 
-// Parsing states, used for parseline
-typedef enum parse_state
+// What parse_words finds on a command line, for parse_expand
+#define WORD_ARG        0       // An argument
+#define WORD_PSUB       1       // A process substitution, as an argument
+#define WORD_REDIR      2       // A redirection, with its file name
+#define WORD_DUP        3       // A descriptor duplication, n>&m
+
+struct word_t
 {
-    ST_NORMAL,
-    ST_INFILE,
-    ST_OUTFILE
-} parse_state;
+    unsigned char kind;         // WORD_...
+    bool plain;                 // Nothing to expand: quoted, or no $*?[{
+    bool psub;                  // WORD_REDIR: the file is a process
+                                //   substitution
+    bool write;                 // Process substitutions: >(cmd)
+    bool heredoc;               // REDIR_DATA: << rather than <<<
+    redir_kind redir;           // Redirections: their kind, descriptor
+    int fd;                     //   and the descriptor duplicated
+    int src_fd;
+    size_t at;                  // Offset of the word in the text (of the
+                                //   command, for a process substitution)
+};
 
+struct cmdline_words
+{
+    char *text;                 // The first line, cut into words
+    size_t len;
+    size_t body;                // Offset of the lines after it, or 0
+    struct word_t *list;        // What it is made of, in order
+    int count;
+};
+
+/*
+ * The words of the line parseline parses. A word takes at least two
+ * characters of the line, with the blank after it.
+ */
+#define MAXWORDS (MAXLINE_TSH / 2 + 1)
+
+static char lex_text[MAXLINE_TSH];
+static struct word_t lex_list[MAXWORDS];
+static struct cmdline_words lex_words = { lex_text, 0, 0, lex_list, 0 };
 
 static struct job_t job_list[MAXJOBS]; // The job list
 
+struct helper_t                 // A process substitution helper
+{
+    pid_t pid;                  // Helper PID, or 0 if the slot is free
+    pid_t pgid;                 // Process group of its job
+    char cmdline[MAXLINE_TSH];  // Its command line
+};
+
+static struct helper_t helper_list[MAXHELPERS];
+static int nhelpers;            // Slots in use
+
+#define MAXREAPED (2*MAXJOBS)   // Number of job statuses remembered
+
+struct reaped_t                 // A status reported by waitpid
+{
+    pid_t pid;                  // Process that reported it
+    int status;                 // Raw wait status
+    unsigned flags;             // Flags of its job at the time
+};
+
+static struct reaped_t reaped_list[MAXREAPED]; // Most recent statuses
+static int reaped_next;                         // Next slot to overwrite
+static volatile unsigned long reap_count;       // Terminations so far
+static volatile int last_reaped;                // Slot of latest one
+
+/*
+ * Storage for the arguments of the last line parsed that do not fit in
+ * its cmdline_tokens: the matches of its patterns, and its argv if there
+ * are more than MAXARGS arguments. Reused by the next parseline.
+ */
+static struct glob_list parse_globs;
+
+/*
+ * Lines parsed ahead of their turn by parse_ahead, oldest first, each
+ * with the state its words were expanded in; and spare tokens for them.
+ */
+struct ahead_t
+{
+    const char *cmdline;        // The line, as it will be evaluated
+    char text[MAXLINE_TSH];     // What it said then
+    struct cmdline_tokens *token;
+    parseline_return result;
+    unsigned depends;           // AHEAD_* state its words depend on
+    unsigned long env_gen;      // env_generation then
+    int status;                 // $? and $! then
+    pid_t bg_pid;
+    char *const *args;          // Positional parameters then
+    int nargs;
+};
+
+#define AHEAD_PARAMS    0x1     // Variables and positional parameters
+#define AHEAD_STATUS    0x2     // $?
+#define AHEAD_BG_PID    0x4     // $!
+
+static struct ahead_t ahead_list[MAXAHEAD];
+static int nahead;
+static struct cmdline_tokens *ahead_spare[MAXAHEAD];
+static int nspare;
+
+/*
+ * Set while parsing a line ahead: its diagnostics wait for its turn, and
+ * a line that would use the storage above, or whose wildcards match
+ * files that may change before it runs, is not kept (ahead_unsafe).
+ */
+static bool parsing_ahead;
+static bool ahead_unsafe;
+
+#define parse_error(...) \
+    do { if (!parsing_ahead) fprintf(stderr, __VA_ARGS__); } while (0)
+static char **parse_argv;
+static size_t parse_argv_cap;
+
+static int param_status;        // Value of $?
+static pid_t param_bg_pid;      // Value of $!, or 0 if it has none
+static char *const *param_args; // Values of $1 ..., and their number
+static int param_nargs;
+static char param_joined[MAXEXPAND];    // Value of $@ and $*
+
+/* set_expansion_params - Set the values of $? and $! */
+void set_expansion_params(int status, pid_t bg_pid) {
+    param_status = status;
+    param_bg_pid = bg_pid;
+}
+
+/* set_positional_params - Set $1 ... */
+void set_positional_params(char *const *args, int nargs,
+                           char *const **saved_args, int *saved_nargs) {
+    *saved_args = param_args;
+    *saved_nargs = param_nargs;
+    param_args = args;
+    param_nargs = nargs;
+}
+
+/* special_param_len - Length of the special parameter at name, or 0 */
+static size_t special_param_len(const char *name) {
+    if (isdigit((unsigned char)name[0])) {
+        return 1;
+    }
+    return (name[0] != '\0' && strchr("?!#@*", name[0]) != NULL) ? 1 : 0;
+}
+
+/*
+ * param_value - Value of the parameter named by len characters of name,
+ * or NULL if it is not set. num holds the text of a numeric value.
+ */
+static const char *param_value(const char *name, size_t len, char num[16]) {
+    size_t used, n;
+    int i;
+
+    if (len == 1 && isdigit((unsigned char)name[0])) {
+        i = name[0] - '0';
+        return (i == 0) ? "tsh" : (i <= param_nargs) ? param_args[i - 1]
+                                                     : NULL;
+    }
+    if (len == 1 && name[0] == '#') {
+        snprintf(num, 16, "%d", param_nargs);
+        return num;
+    }
+    if (len == 1 && (name[0] == '@' || name[0] == '*')) {
+        /* the arguments, joined by spaces (as far as they fit) */
+        for (i = 0, used = 0; i < param_nargs; i++) {
+            n = strlen(param_args[i]);
+            if (used + (i > 0) + n >= sizeof(param_joined)) {
+                break;
+            }
+            if (i > 0) {
+                param_joined[used++] = ' ';
+            }
+            memcpy(param_joined + used, param_args[i], n);
+            used += n;
+        }
+        param_joined[used] = '\0';
+        return param_joined;
+    }
+    if (len == 1 && name[0] == '?') {
+        snprintf(num, 16, "%d", param_status);
+        return num;
+    }
+    if (len == 1 && name[0] == '!') {
+        if (param_bg_pid == 0) {
+            return NULL;
+        }
+        snprintf(num, 16, "%d", (int)param_bg_pid);
+        return num;
+    }
+    return env_getn(name, len);
+}
+
+/*
+ * expand_word - Expand $NAME, ${NAME} and the special parameters ($?,
+ * $!, $#, $@, $* and $0 ... $9, also in braces) in word, writing the
+ * result into the arena at *pos and advancing *pos past it. Each piece
+ * is copied once, straight to its place. A $ not followed by a name is
+ * kept. Returns the expanded word, or NULL after printing a diagnostic.
+ */
+static char *expand_word(const char *word, char **pos, const char *end) {
+    char *start = *pos;
+    char *out = *pos;
+    const char *value;
+    char num[16];
+    size_t len, vlen;
+
+    while (*word != '\0') {
+        if (*word != '$') {
+            /* a literal run, up to the next $ */
+            value = word;
+            vlen = strcspn(word, "$");
+            word += vlen;
+        } else {
+            if (word[1] == '{') {
+                len = special_param_len(word + 2);
+                if (len == 0) {
+                    len = env_name_len(word + 2);
+                }
+                if (len == 0 || word[len + 2] != '}') {
+                    parse_error("Error: %s: bad substitution\n", word);
+                    return NULL;
+                }
+                value = param_value(word + 2, len, num);
+                word += len + 3;
+            } else if (special_param_len(word + 1) > 0) {
+                value = param_value(word + 1, 1, num);
+                word += 2;
+            } else if ((len = env_name_len(word + 1)) > 0) {
+                value = param_value(word + 1, len, num);
+                word += len + 1;
+            } else {
+                value = "$";
+                word++;
+            }
+            if (value == NULL) {
+                value = "";         // unset parameters expand to nothing
+            }
+            vlen = strlen(value);
+        }
+
+        if (vlen >= (size_t)(end - out)) {
+            parse_error("Error: expansion too long\n");
+            return NULL;
+        }
+        memcpy(out, value, vlen);
+        out += vlen;
+    }
+    *out++ = '\0';
+    *pos = out;
+    return start;
+}
+
+/* push_arg - Append an argument to token->argv, growing it if needed */
+static void push_arg(struct cmdline_tokens *token, char *arg) {
+    bool moving = (token->argv != parse_argv);
+
+    if (token->argc + 1 >= token->argv_cap) {   // keep room for NULL
+        if (parsing_ahead) {
+            ahead_unsafe = true;
+            return;
+        }
+        if (parse_argv_cap < 2 * (size_t)token->argv_cap) {
+            parse_argv_cap = 2 * (size_t)token->argv_cap;
+            parse_argv = Realloc(parse_argv,
+                                 parse_argv_cap * sizeof(parse_argv[0]));
+        }
+        if (moving) {
+            memcpy(parse_argv, token->argv,
+                   token->argc * sizeof(token->argv[0]));
+        }
+        token->argv = parse_argv;
+        token->argv_cap = parse_argv_cap;
+    }
+    token->argv[token->argc++] = arg;
+}
+
+/*
+ * add_arg - Expand an argument as parseline does, unless it is quoted,
+ * and append what it expands to to token->argv. *assigning tells whether
+ * only NAME=value words came before it. Returns false after printing a
+ * diagnostic.
+ */
+static bool add_arg(struct cmdline_tokens *token, char *arg, bool quoted,
+                    char **arena, bool *assigning) {
+    char *word = arg;
+    bool special = !quoted && arg[strcspn(arg, "$*?[{")] != '\0';
+    size_t nmatches, i;
+    int j;
+
+    if (special && (strcmp(arg, "$@") == 0 || strcmp(arg, "$*") == 0)) {
+        /* the positional parameters, as separate arguments */
+        for (j = 0; j < param_nargs; j++) {
+            push_arg(token, param_args[j]);
+        }
+        *assigning = false;
+        return true;
+    }
+
+    /* Expand parameters */
+    if (special && strchr(arg, '$') != NULL) {
+        word = expand_word(arg, arena, token->arena + MAXEXPAND);
+        if (word == NULL) {
+            return false;
+        }
+        if (*word == '\0') {
+            return true;                // nothing left of the argument
+        }
+    }
+
+    /* Expand braces and file name patterns, unless the word is a leading
+     * NAME=value */
+    *assigning = *assigning && env_is_assignment(word);
+    special = special && !*assigning;
+    if (special && token->nbraces < MAXBRACES && brace_is_pattern(word)) {
+        token->braces[token->nbraces++] = word;
+    } else if (special && parsing_ahead && glob_is_pattern(word)) {
+        ahead_unsafe = true;
+    } else if (special && glob_is_pattern(word) &&
+               (nmatches = glob_expand(word, &parse_globs)) > 0) {
+        for (i = parse_globs.count - nmatches; i < parse_globs.count; i++) {
+            push_arg(token, parse_globs.paths[i]);
+        }
+        return true;
+    }
+    push_arg(token, word);
+    return true;
+}
+
+/*
+ * delim_line - Find the line of text that is delim, which ends a
+ * here-document. Returns its start, or NULL if there is none.
+ */
+static const char *delim_line(const char *text, const char *delim,
+                              size_t len) {
+    const char *line;
+
+    for (line = text; *line != '\0'; line += strcspn(line, "\n") + 1) {
+        if (strncmp(line, delim, len) == 0 &&
+            (line[len] == '\n' || line[len] == '\0')) {
+            return line;
+        }
+        if (line[strcspn(line, "\n")] == '\0') {
+            break;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * find_heredocs - Give the here-documents of a parsed line their text,
+ * taking the lines of body in turn. Returns false after printing a
+ * diagnostic if one is not ended.
+ */
+static bool find_heredocs(struct cmdline_tokens *token, const char *body) {
+    struct redirection *redir;
+    const char *end;
+    int i;
+
+    for (i = 0; i < token->nredirs; i++) {
+        redir = &token->redirs[i];
+        if (redir->kind != REDIR_DATA || redir->data != NULL) {
+            continue;                   // not a here-document
+        }
+        if ((end = delim_line(body, redir->path,
+                              strlen(redir->path))) == NULL) {
+            parse_error("Error: here-document not ended by '%s'\n",
+                        redir->path);
+            return false;
+        }
+        redir->data = body;
+        redir->len = end - body;
+        body = end + strcspn(end, "\n");
+        body += (*body == '\n');
+    }
+    return true;
+}
+
+/*
+ * psub_end - Find the ) closing the process substitution <( or >( at
+ * open, skipping quoted text and nested parentheses. Returns NULL if
+ * there is none before end.
+ */
+static const char *psub_end(const char *open, const char *end) {
+    const char *p, *close;
+    int depth = 1;
+
+    for (p = open + 1; p < end; p++) {
+        if (*p == '\'' || *p == '"') {
+            if ((close = strchr(p + 1, *p)) == NULL || close >= end) {
+                return NULL;
+            }
+            p = close;
+        } else if (*p == '(') {
+            depth++;
+        } else if (*p == ')' && --depth == 0) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * add_psub - Record the process substitution of cmd, written to if
+ * write, and return the file name that stands for it, for now just
+ * /dev/fd/. Returns NULL after printing a diagnostic.
+ */
+static char *add_psub(struct cmdline_tokens *token, char *cmd, bool write,
+                      char **pos) {
+    struct proc_subst *psub;
+
+    if (*pos + PSUB_PATHLEN > token->arena + MAXEXPAND) {
+        parse_error("Error: expansion too long\n");
+        return NULL;
+    }
+
+    psub = &token->psubs[token->npsubs++];
+    psub->write = write;
+    psub->cmd = cmd;
+    psub->path = *pos;
+    strcpy(*pos, "/dev/fd/");
+    *pos += PSUB_PATHLEN;
+    return psub->path;
+}
+
+/*
+ * add_herestring - Make word and a newline, written into the arena at
+ * *pos, the text of a here-string
+ */
+static bool add_herestring(struct redirection *redir, const char *word,
+                           char **pos, const char *end) {
+    size_t len = strlen(word);
+
+    if (*pos + len + 2 > end) {
+        parse_error("Error: expansion too long\n");
+        return false;
+    }
+    memmove(*pos, word, len);
+    (*pos)[len] = '\n';
+    (*pos)[len + 1] = '\0';
+    redir->data = *pos;
+    redir->len = len + 1;
+    *pos += len + 2;
+    return true;
+}
+
+/*
+ * lex_line - Split the first line of cmdline into the words of w, whose
+ * text holds MAXLINE_TSH bytes and list MAXWORDS words: arguments,
+ * redirections with their file names, and process substitutions, as
+ * parseline takes them. Nothing is expanded. Returns false after
+ * printing a diagnostic.
+ */
+static bool lex_line(const char *cmdline, struct cmdline_words *w) {
+    const char delims[] = " \t\r\n";    // argument delimiters (white-space)
+    char *buf;                          // ptr that traverses command line
+    char *next;                         // ptr to the end of the current arg
+    char *endbuf;                       // ptr to end of the first line
+    char *op;                           // ptr to a redirection operator
+    struct word_t *word;                // the word being taken
+    struct word_t *redir;               // redirection waiting for its file
+    int redir_fd;                       // descriptor being redirected
+    int nredirs, npsubs, i;
+    bool quoted;                        // the token is quoted
+
+    strncpy(w->text, cmdline, MAXLINE_TSH);
+    w->text[MAXLINE_TSH - 1] = '\0';
+
+    /* Only the first line is parsed: any others are here-documents */
+    buf = w->text;
+    endbuf = w->text + strcspn(w->text, "\n");
+    w->len = endbuf - w->text;
+    w->body = (*endbuf == '\n') ? w->len + 1 : 0;
+    w->count = 0;
+    redir = NULL;
+    nredirs = npsubs = 0;
+
+    while (buf < endbuf) {
+        /* Skip the white-spaces */
+        buf += strspn(buf, delims);
+        if (buf >= endbuf) break;
+
+        /* Process substitution: an argument or a file name */
+        if ((*buf == '<' || *buf == '>') && buf[1] == '(') {
+            if ((next = (char *)psub_end(buf + 1, endbuf)) == NULL) {
+                parse_error("Error: unmatched (.\n");
+                return false;
+            }
+            if (next[1] != '\0' && !isspace((unsigned char)next[1])) {
+                parse_error("Error: process substitution must be a word\n");
+                return false;
+            }
+            if (npsubs++ == MAXPSUBS) {
+                parse_error("Error: too many process substitutions\n");
+                return false;
+            }
+            if (redir != NULL && redir->redir == REDIR_DATA) {
+                parse_error("Error: process substitution after <<\n");
+                return false;
+            }
+            if (redir != NULL) {
+                word = redir;
+                word->psub = true;
+                redir = NULL;
+            } else {
+                word = &w->list[w->count++];
+                word->kind = WORD_PSUB;
+            }
+            word->write = (*buf == '>');
+            word->at = buf + 2 - w->text;
+            *next = '\0';
+            buf = next + 1;
+            continue;
+        }
+
+        /* Check for I/O redirection specifiers */
+        quoted = false;
+        op = buf;
+        redir_fd = -1;
+        if (isdigit((unsigned char)op[0]) && (op[1] == '<' || op[1] == '>')) {
+            redir_fd = op[0] - '0';
+            op++;
+        }
+        if (*op == '<' || *op == '>') {
+            if (redir != NULL) {                // e.g. "< >"
+                parse_error("Error: must provide file name "
+                            "for redirection\n");
+                return false;
+            }
+            if (nredirs >= MAXREDIRS) {
+                parse_error("Error: too many I/O redirections\n");
+                return false;
+            }
+            word = &w->list[w->count++];
+            word->kind = WORD_REDIR;
+            word->psub = false;
+            word->heredoc = false;
+            word->at = 0;
+            if (redir_fd < 0) {
+                redir_fd = (*op == '<') ? STDIN_FILENO : STDOUT_FILENO;
+            }
+            word->fd = redir_fd;
+            word->src_fd = -1;
+
+            if (op[0] == '>' && op[1] == '>') {
+                word->redir = REDIR_APPEND;
+                op += 2;
+            } else if (op[0] == '<' && op[1] == '<') {
+                word->redir = REDIR_DATA;
+                word->heredoc = (op[2] != '<');
+                op += word->heredoc ? 2 : 3;
+            } else {
+                word->redir = (*op == '<') ? REDIR_IN : REDIR_OUT;
+                op++;
+            }
+
+            if (*op == '&') {
+                /* Descriptor duplication: n>&m */
+                op++;
+                if (!isdigit((unsigned char)*op)) {
+                    parse_error("Error: bad file descriptor "
+                                "in redirection\n");
+                    return false;
+                }
+                word->kind = WORD_DUP;
+                word->redir = REDIR_DUP;
+                word->src_fd = (int)strtol(op, &next, 10);
+                if (*next != '\0' && !strchr(delims, *next)) {
+                    parse_error("Error: bad file descriptor "
+                                "in redirection\n");
+                    return false;
+                }
+                nredirs++;
+                buf = next;
+                continue;
+            }
+
+            for (i = 0; i < w->count - 1; i++) {
+                if (w->list[i].kind == WORD_REDIR &&
+                    w->list[i].fd == redir_fd) {
+                    // file already exists for this descriptor
+                    parse_error("Error: Ambiguous I/O redirection\n");
+                    return false;
+                }
+            }
+            nredirs++;
+            redir = word;
+            buf = op;
+            continue;
+        } else if (*buf == '\'' || *buf == '\"') {
+            /* Detect quoted tokens */
+            quoted = true;
+            buf++;
+            next = strchr(buf, *(buf - 1));
+        } else {
+            /* Find next delimiter */
+            next = buf + strcspn(buf, delims);
+        }
+
+        if (next == NULL || next > endbuf) {
+            /* Returned by strchr(); this means that the closing
+               quote was not found. */
+            parse_error("Error: unmatched %c.\n", *(buf - 1));
+            return false;
+        }
+
+        /* Terminate the token: an argument, or the file name of the
+         * redirection before it */
+        *next = '\0';
+        if (redir != NULL) {
+            word = redir;
+            redir = NULL;
+        } else {
+            word = &w->list[w->count++];
+            word->kind = WORD_ARG;
+        }
+        word->at = buf - w->text;
+        word->plain = quoted || buf[strcspn(buf, "$*?[{")] == '\0';
+        buf = next + 1;
+    }
+
+    if (redir != NULL) { // buf ends with < or >
+        parse_error("Error: must provide file name for redirection\n");
+        return false;
+    }
+    return true;
+}
+
+/*
+ * add_file - Make word the file name of redir, expanding parameters and
+ * file name patterns unless it is plain: it must remain a single word.
+ * The word of a here-string is not globbed. Returns false after printing
+ * a diagnostic.
+ */
+static bool add_file(struct cmdline_tokens *token, struct redirection *redir,
+                     char *word, bool plain, char **arena) {
+    size_t nmatches;
+
+    if (!plain && strchr(word, '$') != NULL) {
+        word = expand_word(word, arena, token->arena + MAXEXPAND);
+        if (word == NULL) {
+            return false;
+        }
+    }
+    if (redir->kind == REDIR_DATA) {
+        return add_herestring(redir, word, arena, token->arena + MAXEXPAND);
+    }
+    if (!plain && parsing_ahead && glob_is_pattern(word)) {
+        ahead_unsafe = true;
+    } else if (!plain && glob_is_pattern(word)) {
+        nmatches = glob_expand(word, &parse_globs);
+        if (nmatches > 1) {
+            parse_error("Error: %s: ambiguous redirect\n", word);
+            return false;
+        }
+        if (nmatches == 1) {
+            word = parse_globs.paths[parse_globs.count - 1];
+        }
+    }
+
+    /* Record the token as the i/o file */
+    redir->path = word;
+    if (redir->kind == REDIR_IN && redir->fd == STDIN_FILENO) {
+        token->infile = word;
+    } else if (redir->kind != REDIR_IN && redir->fd == STDOUT_FILENO) {
+        token->outfile = word;
+    }
+    return true;
+}
+
+/*
+ * expand_line - Build token from the words w of cmdline, as parseline
+ * does
+ */
+static parseline_return expand_line(const char *cmdline,
+                                    const struct cmdline_words *w,
+                                    struct cmdline_tokens *token) {
+    const struct word_t *word;          // the word being expanded
+    struct redirection *redir;          // redirection being built
+    char *text;                         // its text, in token->text
+    char *arena;                        // next free byte of token->arena
+    bool assigning;                     // only NAME=value words so far
+    int i;
+
+    memcpy(token->text, w->text, w->len);
+    token->text[w->len] = '\0';
+
+    // initialize default values
+    token->argc = 0;
+    token->argv = token->argv_inline;
+    token->argv_cap = MAXARGS;
+    token->infile = NULL;
+    token->outfile = NULL;
+    token->nredirs = 0;
+    token->nbraces = 0;
+    token->npsubs = 0;
+    arena = token->arena;
+    assigning = true;
+    if (!parsing_ahead) {
+        glob_reset(&parse_globs);
+    }
+
+    /* Build the argv list */
+    for (i = 0; i < w->count; i++) {
+        word = &w->list[i];
+        text = token->text + word->at;
+        if (word->kind == WORD_ARG) {
+            if (!add_arg(token, text, word->plain, &arena, &assigning)) {
+                return PARSELINE_ERROR;
+            }
+            continue;
+        }
+        if (word->kind == WORD_PSUB) {
+            if ((text = add_psub(token, text, word->write, &arena)) == NULL) {
+                return PARSELINE_ERROR;
+            }
+            add_arg(token, text, true, &arena, &assigning);
+            continue;
+        }
+
+        redir = &token->redirs[token->nredirs++];
+        redir->kind = word->redir;
+        redir->fd = word->fd;
+        redir->src_fd = word->src_fd;
+        redir->path = NULL;
+        redir->data = NULL;
+        redir->len = 0;
+        if (word->kind == WORD_DUP) {
+            continue;
+        }
+        if (word->psub) {
+            redir->path = add_psub(token, text, word->write, &arena);
+            if (redir->path == NULL) {
+                return PARSELINE_ERROR;
+            }
+        } else if (word->heredoc) {
+            /* A here-document delimiter, taken as it is; its lines are
+             * found once the whole line is parsed */
+            redir->path = text;
+        } else if (!add_file(token, redir, text, word->plain, &arena)) {
+            return PARSELINE_ERROR;
+        }
+    }
+
+    if (!find_heredocs(token, (w->body != 0) ? cmdline + w->body : "")) {
+        return PARSELINE_ERROR;
+    }
+
+    /* The argument list must end with a NULL pointer */
+    token->argv[token->argc] = NULL;
+    token->arena_used = arena - token->arena;
+
+    if (token->argc == 0) {                     /* ignore blank line */
+        return PARSELINE_EMPTY;
+    }
+
+    token->builtin = lookup_builtin(token->argv[0]);
+
+    // Returns 1 if job runs on background; 0 if job runs on foreground
+
+    if (*token->argv[(token->argc)-1] == '&') {
+        token->argv[--(token->argc)] = NULL;
+        return PARSELINE_BG;
+    } else {
+        return PARSELINE_FG;
+    }
+}
+
 /*
  * parseline - Parse the command line and build the argv array.
  *
@@ -50,11 +817,53 @@ static struct job_t job_list[MAXJOBS]; // The job list
  *
  *                command [arguments...] [< infile] [> oufile] [&]
  *
+ *             Each redirection may be prefixed by a single-digit descriptor
+ *             number, and may take the forms n<file, n>file, n>>file and
+ *             n>&m (e.g. 2>errfile, 2>&1). Redirections are recorded in
+ *             command order in token->redirs; infile and outfile are set to
+ *             the files named for descriptors 0 and 1.
+ *
+ *             <(cmd) and >(cmd) are process substitutions, recorded in
+ *             token->psubs: each stands for a file name, /dev/fd/N,
+ *             that the caller fills in once it has made the pipe from or
+ *             to cmd (see struct proc_subst).
+ *
+ *             n<<WORD reads the here-document made of the lines of
+ *             cmdline after its first, up to the line WORD (see
+ *             heredoc_pending); several take their lines in turn. The
+ *             text is taken as it is, and stays in cmdline. n<<<word
+ *             reads word, expanded as a file name would be but not
+ *             globbed, and a newline.
+ *
  *   token:    Pointer to a cmdline_tokens structure. The elements of this
  *             structure will be populated with the parsed tokens. Characters
  *             enclosed in single or double quotes are treated as a single
  *             argument.
  *
+ *             In unquoted arguments and file names, $NAME and ${NAME} are
+ *             replaced by the value of shell variable NAME, $? by the last
+ *             exit status and $! by the pid of the last background job
+ *             (see set_expansion_params), and $1 ... $9, $# and $@ by the
+ *             positional parameters (see set_positional_params); an
+ *             unquoted $@ alone gives each parameter as an argument of
+ *             its own. Expanded words are built in
+ *             token->arena; an argument that expands to nothing is
+ *             dropped.
+ *
+ *             An unquoted word with wildcards (*, ? and [...]) is then
+ *             replaced by the file names it matches, in sorted order, or
+ *             kept if there are none (see tsh_glob.h); a file name must
+ *             match only one. Leading NAME=value words are not globbed.
+ *             There may be more than MAXARGS arguments; the matches and
+ *             an argv that outgrows token->argv_inline are valid until
+ *             the next call to parseline.
+ *
+ *             Unquoted arguments with braces to expand (see tsh_brace.h)
+ *             are instead listed in token->braces and left as they are
+ *             in argv, since they may stand for more words than could be
+ *             stored: they are expanded as the command is run. Builtins
+ *             see them unexpanded.
+ *
  * Returns:
  *   PARSELINE_EMPTY:        if the command line is empty
  *   PARSELINE_BG:           if the user has requested a BG job
@@ -64,129 +873,328 @@ static struct job_t job_list[MAXJOBS]; // The job list
  */
 parseline_return parseline(const char *cmdline,
                            struct cmdline_tokens *token) {
-    const char delims[] = " \t\r\n";    // argument delimiters (white-space)
-    char *buf;                          // ptr that traverses command line
-    char *next;                         // ptr to the end of the current arg
-    char *endbuf;                       // ptr to end of cmdline string
-
-    parse_state parsing_state;          // indicates if the next token is the
-                                        // input or output file
-
     if (cmdline == NULL) {
-        fprintf(stderr, "Error: command line is NULL\n");
+        parse_error("Error: command line is NULL\n");
         return PARSELINE_EMPTY;
     }
+    if (!lex_line(cmdline, &lex_words)) {
+        return PARSELINE_ERROR;
+    }
+    return expand_line(cmdline, &lex_words, token);
+}
 
-    strncpy(token->text, cmdline, MAXLINE_TSH);
+/* parse_words - Split a command line into words, once for many runs */
+struct cmdline_words *parse_words(const char *cmdline) {
+    struct cmdline_words *words;
+    bool ok;
 
-    buf = token->text;
-    endbuf = token->text + strlen(token->text);
+    parsing_ahead = true;               // its diagnostics wait for its turn
+    ok = lex_line(cmdline, &lex_words);
+    parsing_ahead = false;
+    if (!ok) {
+        return NULL;
+    }
 
-    // initialize default values
-    token->argc = 0;
-    token->infile = NULL;
-    token->outfile = NULL;
+    words = Malloc(sizeof(*words));
+    *words = lex_words;
+    words->text = Malloc(lex_words.len + 1);
+    memcpy(words->text, lex_words.text, lex_words.len + 1);
+    words->list = Malloc(lex_words.count * sizeof(words->list[0]) + 1);
+    memcpy(words->list, lex_words.list,
+           lex_words.count * sizeof(words->list[0]));
+    return words;
+}
+
+/* parse_expand - Parse a command line from its words */
+parseline_return parse_expand(const char *cmdline,
+                              const struct cmdline_words *words,
+                              struct cmdline_tokens *token) {
+    return expand_line(cmdline, words, token);
+}
+
+/* parse_words_free - Free the words of parse_words */
+void parse_words_free(struct cmdline_words *words) {
+    if (words != NULL) {
+        free(words->text);
+        free(words->list);
+        free(words);
+    }
+}
+
+
+/* Builtin commands, by name */
+static const struct {
+    const char *name;
+    builtin_state builtin;
+} builtin_table[] = {
+    { "quit",     BUILTIN_QUIT },
+    { "jobs",     BUILTIN_JOBS },
+    { "bg",       BUILTIN_BG },
+    { "fg",       BUILTIN_FG },
+    { "wait",     BUILTIN_WAIT },
+    { "timeout",  BUILTIN_TIMEOUT },
+    { "renice",   BUILTIN_RENICE },
+    { "ulimit",   BUILTIN_ULIMIT },
+    { "rssguard", BUILTIN_RSSGUARD },
+    { "throttle", BUILTIN_THROTTLE },
+    { "autonice", BUILTIN_AUTONICE },
+    { "history",  BUILTIN_HISTORY },
+    { "export",   BUILTIN_EXPORT },
+    { "unset",    BUILTIN_UNSET },
+    { "source",   BUILTIN_SOURCE },
+    { ".",        BUILTIN_SOURCE },
+    { "alias",    BUILTIN_ALIAS },
+    { "unalias",  BUILTIN_UNALIAS },
+    { "forkretry", BUILTIN_FORKRETRY },
+    { "kill",     BUILTIN_KILL },
+};
+
+/* parse_splice - Replace an argument of a parsed line by words */
+bool parse_splice(struct cmdline_tokens *token, int index,
+                  char *const *words, const bool *expand, int nwords) {
+    char *arena = token->arena + token->arena_used;
+    char *tail_inline[MAXARGS];
+    char **tail = tail_inline;
+    int ntail = token->argc - index - 1;
+    bool assigning = false;
+    bool ok = true;
+    int i;
+
+    /* set the arguments after it aside */
+    if (ntail > MAXARGS) {
+        tail = Malloc(ntail * sizeof(tail[0]));
+    }
+    memcpy(tail, &token->argv[index + 1], ntail * sizeof(tail[0]));
+    token->argc = index;
+
+    for (i = 0; i < nwords && ok; i++) {
+        ok = add_arg(token, words[i], !expand[i], &arena, &assigning);
+    }
+    for (i = 0; i < ntail; i++) {
+        push_arg(token, tail[i]);
+    }
+    token->argv[token->argc] = NULL;
+    token->arena_used = arena - token->arena;
 
-    /* Build the argv list */
-    parsing_state = ST_NORMAL;
+    if (tail != tail_inline) {
+        free(tail);
+    }
+    if (token->argc > 0) {
+        token->builtin = lookup_builtin(token->argv[0]);
+    }
+    return ok;
+}
 
-    while (buf < endbuf) {
-        /* Skip the white-spaces */
-        buf += strspn(buf, delims);
-        if (buf >= endbuf) break;
+/*
+ * split_list - Find the first ;, && or || of a command list. Quotes are
+ * recognized where parseline recognizes them, at the start of a word.
+ * The list ends at the first newline: what follows is here-documents.
+ */
+size_t split_list(const char *list, list_op *op) {
+    const char *p, *close;
+
+    for (p = list; *p != '\0' && *p != '\n'; p++) {
+        if ((*p == '\'' || *p == '"') &&
+            (p == list || strchr(" \t\r\n;&|", p[-1]) != NULL)) {
+            if ((close = strchr(p + 1, *p)) == NULL) {
+                break;          // unmatched: parseline reports it
+            }
+            p = close;
+        } else if ((*p == '<' || *p == '>') && p[1] == '(') {
+            if ((close = psub_end(p + 1, p + strlen(p))) == NULL) {
+                break;          // unmatched: parseline reports it
+            }
+            p = close;
+        } else if (*p == ';') {
+            *op = LIST_SEQ;
+            return p - list;
+        } else if (p[0] == '&' && p[1] == '&') {
+            *op = LIST_AND;
+            return p - list;
+        } else if (p[0] == '|' && p[1] == '|') {
+            *op = LIST_OR;
+            return p - list;
+        }
+    }
+    *op = LIST_END;
+    return p - list + strlen(p);
+}
 
-        /* Check for I/O redirection specifiers */
-        if (*buf == '<') {
-            if (token->infile) {    // infile already exists
-                fprintf(stderr, "Error: Ambiguous I/O redirection\n");
-                return PARSELINE_ERROR;
+/*
+ * heredoc_pending - Test whether the here-documents of the first line of
+ * text are all ended by the lines after it. The delimiters are found as
+ * parseline finds them, in the commands split_list cuts the line into.
+ */
+bool heredoc_pending(const char *text) {
+    const char *p, *end, *close, *body;
+    size_t len;
+
+    end = text + strcspn(text, "\n");
+    body = (*end == '\n') ? end + 1 : end;
+
+    for (p = text; p < end; p++) {
+        if ((*p == '\'' || *p == '"') &&
+            (p == text || strchr(" \t\r", p[-1]) != NULL)) {
+            if ((close = strchr(p + 1, *p)) == NULL || close > end) {
+                return false;   // unmatched: parseline reports it
             }
-            parsing_state = ST_INFILE;
-            buf++;
+            p = close;
             continue;
-        } else if (*buf == '>') {
-            if (token->outfile) {   // outfile already exists
-                fprintf(stderr, "Error: Ambiguous I/O redirection\n");
-                return PARSELINE_ERROR;
-            }
-            parsing_state = ST_OUTFILE;
-            buf++;
+        }
+        if (p[0] != '<' || p[1] != '<') {
+            continue;
+        }
+        if (p[2] == '<') {
+            p += 2;             // a here-string
             continue;
-        } else if (*buf == '\'' || *buf == '\"') {
-            /* Detect quoted tokens */
-            buf++;
-            next = strchr(buf, *(buf - 1));
-        } else {
-            /* Find next delimiter */
-            next = buf + strcspn(buf, delims);
         }
 
-        if (next == NULL) {
-            /* Returned by strchr(); this means that the closing
-               quote was not found. */
-            fprintf (stderr, "Error: unmatched %c.\n", *(buf - 1));
-            return PARSELINE_ERROR;
+        /* the delimiter, as parseline takes the next token */
+        p += 2;
+        p += strspn(p, " \t\r");
+        if ((*p == '\'' || *p == '"') &&
+            (close = strchr(p + 1, *p)) != NULL && close < end) {
+            len = close - ++p;
+        } else {
+            for (len = 0; p[len] != '\0' && !strchr(" \t\r\n;", p[len]) &&
+                          !((p[len] == '&' || p[len] == '|') &&
+                            p[len + 1] == p[len]); len++) {
+                continue;
+            }
+            close = p + len - 1;
+        }
+        if (len == 0) {
+            return false;       // parseline reports it
+        }
+        if ((body = delim_line(body, p, len)) == NULL) {
+            return true;
         }
+        body += strcspn(body, "\n");
+        body += (*body == '\n');
+        p = close;
+    }
+    return false;
+}
 
-        /* Terminate the token */
-        *next = '\0';
+/*
+ * ahead_depends - The state the words of a line depend on: none unless
+ * its first line (the rest is here-documents) has something to expand
+ */
+static unsigned ahead_depends(const char *cmdline) {
+    size_t len = strcspn(cmdline, "\n");
+    const char *p = cmdline;
+    unsigned depends = 0;
+
+    while ((p = memchr(p, '$', cmdline + len - p)) != NULL) {
+        p += (p[1] == '{') ? 2 : 1;
+        depends |= AHEAD_PARAMS;
+        depends |= (*p == '?') ? AHEAD_STATUS : (*p == '!') ? AHEAD_BG_PID : 0;
+    }
+    return depends;
+}
 
-        /* Record the token as either the next argument or the i/o file */
-        switch (parsing_state) {
-        case ST_NORMAL:
-            token->argv[token->argc] = buf;
-            token->argc = token->argc + 1;
-            break;
-        case ST_INFILE:
-            token->infile = buf;
-            break;
-        case ST_OUTFILE:
-            token->outfile = buf;
-            break;
-        default:
-            fprintf(stderr, "Error: Ambiguous I/O redirection\n");
-            return PARSELINE_ERROR;
-        }
-        parsing_state = ST_NORMAL;
+/* ahead_current - Whether a line parsed ahead is still as parsed now */
+static bool ahead_current(const struct ahead_t *a, const char *cmdline) {
+    if (a->cmdline != cmdline ||
+        strncmp(a->text, cmdline, MAXLINE_TSH - 1) != 0) {
+        return false;
+    }
+    if ((a->depends & AHEAD_PARAMS) &&
+        (a->env_gen != env_generation() || a->args != param_args ||
+         a->nargs != param_nargs)) {
+        return false;
+    }
+    return (!(a->depends & AHEAD_STATUS) || a->status == param_status) &&
+           (!(a->depends & AHEAD_BG_PID) || a->bg_pid == param_bg_pid);
+}
 
-        /* Check if argv is full */
-        if (token->argc >= MAXARGS - 1) break;
+/* parse_ahead - Parse a line ahead of its turn */
+bool parse_ahead(const char *cmdline, const struct cmdline_words *words) {
+    struct ahead_t *a;
+    list_op op;
+    int i;
 
-        buf = next + 1;
+    for (i = 0; i < nahead; i++) {
+        if (ahead_list[i].cmdline == cmdline) {
+            return true;
+        }
+    }
+    split_list(cmdline, &op);
+    if (nahead == MAXAHEAD || op != LIST_END) {
+        return false;                   // a list is not parsed whole
     }
 
-    if (parsing_state != ST_NORMAL) { // buf ends with < or >
-        fprintf(stderr, "Error: must provide file name for redirection\n");
-        return PARSELINE_ERROR;
+    a = &ahead_list[nahead];
+    a->token = (nspare > 0) ? ahead_spare[--nspare]
+                            : Malloc(sizeof(*a->token));
+    parsing_ahead = true;
+    ahead_unsafe = false;
+    a->result = (words != NULL) ? expand_line(cmdline, words, a->token)
+                                : parseline(cmdline, a->token);
+    parsing_ahead = false;
+    if (ahead_unsafe || a->result == PARSELINE_ERROR) {
+        parse_release(a->token);
+        return false;
     }
 
-    /* The argument list must end with a NULL pointer */
-    token->argv[token->argc] = NULL;
+    a->cmdline = cmdline;
+    strncpy(a->text, cmdline, MAXLINE_TSH - 1);
+    a->text[MAXLINE_TSH - 1] = '\0';
+    a->depends = ahead_depends(cmdline);
+    a->env_gen = env_generation();
+    a->status = param_status;
+    a->bg_pid = param_bg_pid;
+    a->args = param_args;
+    a->nargs = param_nargs;
+    nahead++;
+    return true;
+}
 
-    if (token->argc == 0) {                     /* ignore blank line */
-        return PARSELINE_EMPTY;
+/* parse_take - The token parsed ahead for cmdline, if still valid */
+struct cmdline_tokens *parse_take(const char *cmdline,
+                                  parseline_return *result) {
+    struct cmdline_tokens *token;
+
+    if (nahead == 0) {
+        return NULL;
     }
+    if (!ahead_current(&ahead_list[0], cmdline)) {
+        parse_ahead_cancel();           // another line, or another state
+        return NULL;
+    }
+    token = ahead_list[0].token;
+    *result = ahead_list[0].result;
+    nahead--;
+    memmove(&ahead_list[0], &ahead_list[1], nahead * sizeof(ahead_list[0]));
+    return token;
+}
 
-    if ((strcmp(token->argv[0], "quit")) == 0) {      /* quit command */
-        token->builtin = BUILTIN_QUIT;
-    } else if ((strcmp(token->argv[0], "jobs")) == 0) { /* jobs command */
-        token->builtin = BUILTIN_JOBS;
-    } else if ((strcmp(token->argv[0], "bg")) == 0) {   /* bg command */
-        token->builtin = BUILTIN_BG;
-    } else if ((strcmp(token->argv[0], "fg")) == 0) {   /* fg command */
-        token->builtin = BUILTIN_FG;
+/* parse_release - Give back a token from parse_take */
+void parse_release(struct cmdline_tokens *token) {
+    if (nspare < MAXAHEAD) {
+        ahead_spare[nspare++] = token;
     } else {
-        token->builtin = BUILTIN_NONE;
+        free(token);
+    }
+}
+
+/* parse_ahead_cancel - Drop the lines parsed ahead */
+void parse_ahead_cancel(void) {
+    while (nahead > 0) {
+        parse_release(ahead_list[--nahead].token);
     }
+}
 
-    // Returns 1 if job runs on background; 0 if job runs on foreground
+/* lookup_builtin - Map a command name to a builtin */
+builtin_state lookup_builtin(const char *name) {
+    size_t i;
 
-    if (*token->argv[(token->argc)-1] == '&') {
-        token->argv[--(token->argc)] = NULL;
-        return PARSELINE_BG;
-    } else {
-        return PARSELINE_FG;
+    for (i = 0; i < sizeof(builtin_table) / sizeof(builtin_table[0]); i++) {
+        if (strcmp(name, builtin_table[i].name) == 0) {
+            return builtin_table[i].builtin;
+        }
     }
+    return BUILTIN_NONE;
 }
 
 
@@ -233,7 +1241,17 @@ static void clearjob(struct job_t *job) {
     job->pid = 0;
     job->jid = 0;
     job->state = UNDEF;
+    job->flags = 0;
+    job->timeout.deadline_ms = 0;
+    job->timeout.sig = 0;
+    job->timeout.grace_ms = 0;
+    job->sched.nice = 0;
+    job->sched.policy = 0;
+    job->cpu_limit = 0;
+    job->seq = 0;
     job->cmdline[0] = '\0';
+    job->driver = 0;
+    job->relay_fd = -1;
 }
 
 /* init_job_list - Initialize the job list */
@@ -258,9 +1276,32 @@ static int maxjid() {
     return max;
 }
 
+/*
+ * set_name - Make the last part of the len characters of path the command
+ * name of job
+ */
+static void set_name(struct job_t *job, const char *path, size_t len) {
+    const char *base = path;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if (path[i] == '/') {
+            base = path + i + 1;
+        }
+    }
+    len -= base - path;
+    if (len >= MAXCMDNAME) {
+        len = MAXCMDNAME - 1;
+    }
+    memcpy(job->name, base, len);
+    job->name[len] = '\0';
+}
+
 /* add_job - Add a job to the job list */
 bool add_job(pid_t pid, job_state state, const char *cmdline) {
     check_blocked();
+    const char *word;
+    size_t len;
     int i;
     usleep(100); // fixme move this to wrapper.c
     if (pid < 1) {
@@ -272,10 +1313,27 @@ bool add_job(pid_t pid, job_state state, const char *cmdline) {
             job_list[i].pid = pid;
             job_list[i].state = state;
             job_list[i].jid = nextjid++;
+            job_list[i].seq = ++job_seq;
             if (nextjid > MAXJOBS) {
                 nextjid = 1;
             }
-            strcpy(job_list[i].cmdline, cmdline);
+            /* the first line: the others are here-documents */
+            len = strcspn(cmdline, "\n");
+            if (len >= MAXLINE_TSH) {
+                len = MAXLINE_TSH - 1;
+            }
+            memcpy(job_list[i].cmdline, cmdline, len);
+            job_list[i].cmdline[len] = '\0';
+
+            /* its command, after any NAME=value words */
+            word = job_list[i].cmdline + strspn(job_list[i].cmdline, " \t");
+            len = env_name_len(word);
+            while (len > 0 && word[len] == '=') {
+                word += strcspn(word, " \t");
+                word += strspn(word, " \t");
+                len = env_name_len(word);
+            }
+            set_name(&job_list[i], word, strcspn(word, " \t"));
             if (verbose) {
                 printf("Added job [%d] %d %s\n",
                        job_list[i].jid,
@@ -289,6 +1347,66 @@ bool add_job(pid_t pid, job_state state, const char *cmdline) {
     return false;
 }
 
+/* add_helper - Record a process substitution helper of the job pgid */
+bool add_helper(pid_t pid, pid_t pgid, const char *cmdline) {
+    check_blocked();
+    int i;
+
+    for (i = 0; i < MAXHELPERS; i++) {
+        if (helper_list[i].pid == 0) {
+            helper_list[i].pid = pid;
+            helper_list[i].pgid = pgid;
+            strncpy(helper_list[i].cmdline, cmdline, MAXLINE_TSH - 1);
+            helper_list[i].cmdline[MAXLINE_TSH - 1] = '\0';
+            nhelpers++;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* find_helper - The slot of helper pid, or NULL */
+static struct helper_t *find_helper(pid_t pid) {
+    int i;
+
+    for (i = 0; i < MAXHELPERS && nhelpers > 0; i++) {
+        if (helper_list[i].pid == pid) {
+            return &helper_list[i];
+        }
+    }
+    return NULL;
+}
+
+/* delete_helper - Forget a process substitution helper */
+bool delete_helper(pid_t pid) {
+    check_blocked();
+    struct helper_t *helper = find_helper(pid);
+
+    if (pid < 1 || helper == NULL) {
+        return false;
+    }
+    helper->pid = 0;
+    nhelpers--;
+    return true;
+}
+
+/* kill_helpers - Send sig to the process substitution helpers of pgid */
+void kill_helpers(pid_t pgid, int sig) {
+    check_blocked();
+    int i;
+
+    for (i = 0; i < MAXHELPERS && nhelpers > 0; i++) {
+        if (helper_list[i].pid != 0 && helper_list[i].pgid == pgid) {
+            kill(helper_list[i].pid, sig);
+        }
+    }
+}
+
+/* is_helper - Test whether pid is a process substitution helper */
+bool is_helper(pid_t pid) {
+    return pid > 0 && find_helper(pid) != NULL;
+}
+
 /* delete_job - Delete a job whose PID=pid from the job list */
 bool delete_job(pid_t pid) {
     check_blocked();
@@ -303,6 +1421,9 @@ bool delete_job(pid_t pid) {
 
     for (i = 0; i < MAXJOBS; i++) {
         if (job_list[i].pid == pid) {
+            if (job_list[i].relay_fd >= 0) {
+                close(job_list[i].relay_fd);
+            }
             clearjob(&job_list[i]);
             nextjid = maxjid() + 1;
             return true;
@@ -354,6 +1475,19 @@ struct job_t *find_job_with_pid(pid_t pid) {
     return NULL;
 }
 
+/* find_job_with_driver - Find the job whose list driver is pid */
+struct job_t *find_job_with_driver(pid_t pid) {
+    check_blocked();
+    int i;
+
+    for (i = 0; i < MAXJOBS && pid > 0; i++) {
+        if (job_list[i].pid != 0 && job_list[i].driver == pid) {
+            return &job_list[i];
+        }
+    }
+    return NULL;
+}
+
 /* find_job_with_jid  - Find a job (by JID) on the job list */
 struct job_t *find_job_with_jid(int jid) {
     check_blocked();
@@ -377,6 +1511,71 @@ struct job_t *find_job_with_jid(int jid) {
     return NULL;
 }
 
+/* more_current - Whether job a comes before job b as the current job:
+ * stopped jobs first, then the most recently started or stopped */
+static bool more_current(const struct job_t *a, const struct job_t *b) {
+    if (b == NULL) {
+        return true;
+    }
+    if ((a->state == ST) != (b->state == ST)) {
+        return a->state == ST;
+    }
+    return a->seq > b->seq;
+}
+
+/* find_job_with_spec - Find a job by job specification (without the %) */
+struct job_t *find_job_with_spec(const char *spec, bool *ambiguous) {
+    check_blocked();
+    struct job_t *current = NULL, *previous = NULL, *match = NULL;
+    bool substring = (spec[0] == '?');
+    size_t len;
+    char *end;
+    long jid;
+    int i;
+
+    *ambiguous = false;
+    if (isdigit((unsigned char)spec[0])) {
+        jid = strtol(spec, &end, 10);
+        return (*end == '\0') ? find_job_with_jid(jid) : NULL;
+    }
+
+    /* %, %%, %+ and %-: the two most current jobs */
+    if (spec[0] == '\0' || strcmp(spec, "%") == 0 || strcmp(spec, "+") == 0 ||
+        strcmp(spec, "-") == 0) {
+        for (i = 0; i < MAXJOBS; i++) {
+            if (job_list[i].pid == 0) {
+                continue;
+            }
+            if (more_current(&job_list[i], current)) {
+                previous = current;
+                current = &job_list[i];
+            } else if (more_current(&job_list[i], previous)) {
+                previous = &job_list[i];
+            }
+        }
+        return (spec[0] == '-') ? previous : current;
+    }
+
+    /* %name: the command line or the command name starts with name;
+     * %?text: the command line contains text */
+    spec += substring;
+    len = strlen(spec);
+    for (i = 0; i < MAXJOBS; i++) {
+        if (job_list[i].pid == 0 ||
+            (substring ? strstr(job_list[i].cmdline, spec) == NULL
+                       : strncmp(job_list[i].cmdline, spec, len) != 0 &&
+                         strncmp(job_list[i].name, spec, len) != 0)) {
+            continue;
+        }
+        if (match != NULL) {
+            *ambiguous = true;
+            return NULL;
+        }
+        match = &job_list[i];
+    }
+    return match;
+}
+
 job_state get_state_of_job(struct job_t *jobp) {
     check_blocked();
     return jobp->state;
@@ -385,9 +1584,98 @@ job_state get_state_of_job(struct job_t *jobp) {
 void set_state_of_job(struct job_t *jobp, job_state state) {
     // check here for invalid transitions.
     check_blocked();
+    if (state == ST && jobp->state != ST) {
+        jobp->seq = ++job_seq;
+    }
     jobp->state = state;
 }
 
+/* get_next_job - Iterate over the jobs in the job list */
+struct job_t *get_next_job(struct job_t *jobp) {
+    check_blocked();
+    int i = (jobp == NULL) ? 0 : (jobp - job_list) + 1;
+
+    for (; i < MAXJOBS; i++) {
+        if (job_list[i].pid != 0) {
+            return &job_list[i];
+        }
+    }
+    return NULL;
+}
+
+unsigned get_flags_of_job(struct job_t *jobp) {
+    check_blocked();
+    return jobp->flags;
+}
+
+void set_flags_of_job(struct job_t *jobp, unsigned flags) {
+    check_blocked();
+    jobp->flags = flags;
+}
+
+struct job_timeout *get_timeout_of_job(struct job_t *jobp) {
+    check_blocked();
+    return &jobp->timeout;
+}
+
+struct job_sched *get_sched_of_job(struct job_t *jobp) {
+    check_blocked();
+    return &jobp->sched;
+}
+
+long get_cpu_limit_of_job(struct job_t *jobp) {
+    check_blocked();
+    return jobp->cpu_limit;
+}
+
+void set_cpu_limit_of_job(struct job_t *jobp, long seconds) {
+    check_blocked();
+    jobp->cpu_limit = seconds;
+}
+
+/* record_job_status - Remember a status reported by waitpid */
+void record_job_status(pid_t pid, int status, unsigned flags) {
+    int slot = reaped_next;
+
+    reaped_list[slot].pid = pid;
+    reaped_list[slot].status = status;
+    reaped_list[slot].flags = flags;
+    reaped_next = (slot + 1) % MAXREAPED;
+    if (!WIFSTOPPED(status)) {
+        last_reaped = slot;
+        reap_count++;
+    }
+}
+
+/* find_job_status - Find the most recent status recorded for pid */
+bool find_job_status(pid_t pid, int *status, unsigned *flags) {
+    int i, slot;
+
+    for (i = 1; i <= MAXREAPED; i++) {
+        slot = (reaped_next - i + MAXREAPED) % MAXREAPED;
+        if (reaped_list[slot].pid == pid && pid != 0) {
+            *status = reaped_list[slot].status;
+            if (flags != NULL) {
+                *flags = reaped_list[slot].flags;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+unsigned long get_reap_count(void) {
+    return reap_count;
+}
+
+pid_t get_last_reaped(int *status, unsigned *flags) {
+    *status = reaped_list[last_reaped].status;
+    if (flags != NULL) {
+        *flags = reaped_list[last_reaped].flags;
+    }
+    return reaped_list[last_reaped].pid;
+}
+
 /* find_job_with_pid - returns the pid from a job struct */
 pid_t get_pid_of_job(struct job_t *jobp) {
     check_blocked();
@@ -404,6 +1692,52 @@ char *get_cmdline_of_job(struct job_t *jobp) {
     return jobp->cmdline;
 }
 
+/* set_command_of_job - Set the command name %name matches */
+void set_command_of_job(struct job_t *jobp, const char *path) {
+    check_blocked();
+    set_name(jobp, path, strlen(path));
+}
+
+/* set_cmdline_of_job - Replace the command line of a job */
+void set_cmdline_of_job(struct job_t *jobp, const char *cmdline) {
+    check_blocked();
+    strncpy(jobp->cmdline, cmdline, MAXLINE_TSH - 1);
+    jobp->cmdline[MAXLINE_TSH - 1] = '\0';
+}
+
+/* set_driver_of_job - Give a job the driver of the rest of its list */
+void set_driver_of_job(struct job_t *jobp, pid_t driver, int relay_fd) {
+    check_blocked();
+    jobp->driver = driver;
+    jobp->relay_fd = relay_fd;
+}
+
+/* relay_job_status - Send the status of a job's leader to its driver */
+bool relay_job_status(struct job_t *jobp, int status) {
+    check_blocked();
+
+    if (jobp->relay_fd < 0) {
+        return false;
+    }
+    send(jobp->relay_fd, &status, sizeof(status), MSG_NOSIGNAL);
+    close(jobp->relay_fd);
+    jobp->relay_fd = -1;
+    return true;
+}
+
+/* drop_job_driver - Forget the driver of a job, which has gone */
+bool drop_job_driver(struct job_t *jobp) {
+    check_blocked();
+    bool waiting = jobp->relay_fd >= 0;
+
+    if (waiting) {
+        close(jobp->relay_fd);
+        jobp->relay_fd = -1;
+    }
+    jobp->driver = 0;
+    return waiting;
+}
+
 /* find_jid_by_pid - Map process ID to job ID */
 int find_jid_by_pid(pid_t pid) {
     check_blocked();
@@ -426,8 +1760,30 @@ int find_jid_by_pid(pid_t pid) {
     return 0;
 }
 
-/* list_jobs - Print the job list */
-void list_jobs(int output_fd) {
+/* print_helpers - Print the process substitutions of the job pgid */
+static void print_helpers(int output_fd, pid_t pgid) {
+    char pid[16];
+    int i;
+
+    for (i = 0; i < MAXHELPERS && nhelpers > 0; i++) {
+        if (helper_list[i].pid == 0 || helper_list[i].pgid != pgid) {
+            continue;
+        }
+        snprintf(pid, sizeof(pid), "%d", (int)helper_list[i].pid);
+        if (write(output_fd, "    (", 5) < 0 ||
+            write(output_fd, pid, strlen(pid)) < 0 ||
+            write(output_fd, ") ", 2) < 0 ||
+            write(output_fd, helper_list[i].cmdline,
+                  strlen(helper_list[i].cmdline)) < 0 ||
+            write(output_fd, "\n", 1) < 0) {
+            fprintf(stderr, "Error writing to output file\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/* print_jobs - Print the job list, with placements if long_format */
+static void print_jobs(int output_fd, bool long_format) {
     check_blocked();
     int i;
     char buf[MAXLINE_TSH];
@@ -451,6 +1807,9 @@ void list_jobs(int output_fd) {
             case ST:
                 sprintf(buf, "Stopped    ");
                 break;
+            case TH:
+                sprintf(buf, "Throttled  ");
+                break;
             default:
                 sprintf(buf, "list_jobs: Internal error: job[%d].state=%d ",
                         i, job_list[i].state);
@@ -467,9 +1826,32 @@ void list_jobs(int output_fd) {
                 fprintf(stderr, "Error writing to output file\n");
                 exit(EXIT_FAILURE);
             }
+
+            if (long_format) {
+                memset(buf, '\0', MAXLINE_TSH);
+                strcpy(buf, "    ");
+                format_placement(job_list[i].pid, buf + 4, MAXLINE_TSH - 5);
+                strcat(buf, "\n");
+                if (write(output_fd, buf, strlen(buf)) < 0) {
+                    fprintf(stderr, "Error writing to output file\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+
+            print_helpers(output_fd, job_list[i].pid);
         }
     }
 }
+
+/* list_jobs - Print the job list */
+void list_jobs(int output_fd) {
+    print_jobs(output_fd, false);
+}
+
+/* list_jobs_long - Print the job list with each job's placement */
+void list_jobs_long(int output_fd) {
+    print_jobs(output_fd, true);
+}
 /******************************
  * end job list helper routines
  ******************************/
@@ -479,13 +1861,54 @@ void list_jobs(int output_fd) {
  * Other helper routines
  ***********************/
 
+/* Signal names understood by parse_signal */
+static const struct {
+    const char *name;
+    int sig;
+} signal_table[] = {
+    { "HUP",  SIGHUP },  { "INT",  SIGINT },  { "QUIT", SIGQUIT },
+    { "ILL",  SIGILL },  { "TRAP", SIGTRAP }, { "ABRT", SIGABRT },
+    { "BUS",  SIGBUS },  { "FPE",  SIGFPE },  { "KILL", SIGKILL },
+    { "USR1", SIGUSR1 }, { "SEGV", SIGSEGV }, { "USR2", SIGUSR2 },
+    { "PIPE", SIGPIPE }, { "ALRM", SIGALRM }, { "TERM", SIGTERM },
+    { "CHLD", SIGCHLD }, { "CONT", SIGCONT }, { "STOP", SIGSTOP },
+    { "TSTP", SIGTSTP }, { "TTIN", SIGTTIN }, { "TTOU", SIGTTOU },
+    { "URG",  SIGURG },  { "XCPU", SIGXCPU }, { "XFSZ", SIGXFSZ },
+    { "VTALRM", SIGVTALRM }, { "PROF", SIGPROF }, { "WINCH", SIGWINCH },
+    { "IO",   SIGIO },   { "SYS",  SIGSYS },
+};
+
+/*
+ * parse_signal - Convert a signal number or name to a signal number
+ */
+int parse_signal(const char *name) {
+    size_t i;
+    char *end;
+    long sig;
+
+    if (isdigit((unsigned char)name[0])) {
+        sig = strtol(name, &end, 10);
+        return (*end == '\0' && sig > 0 && sig < NSIG) ? (int)sig : -1;
+    }
+    if (strncasecmp(name, "SIG", 3) == 0) {
+        name += 3;
+    }
+    for (i = 0; i < sizeof(signal_table) / sizeof(signal_table[0]); i++) {
+        if (strcasecmp(name, signal_table[i].name) == 0) {
+            return signal_table[i].sig;
+        }
+    }
+    return -1;
+}
+
 /*
  * usage - print a help message
  */
 void usage(void) {
-    printf("Usage: shell [-hvp]\n");
+    printf("Usage: shell [-hvp] [-c command]\n");
     printf("   -h   print this message\n");
     printf("   -v   print additional diagnostic information\n");
     printf("   -p   do not emit a command prompt\n");
+    printf("   -c   run command, which may span lines, and exit\n");
     exit(EXIT_FAILURE);
 }
@@ -21,18 +21,29 @@
 #define MAXARGS       128   /* max args on a command line */
 #define MAXJOBS        16   /* max jobs at any point in time */
 #define MAXJID      1<<16   /* max job ID */
+#define MAXREDIRS      16   /* max I/O redirections on a command line */
+#define MAXEXPAND    4096   /* max size of the expanded words of a line */
+#define MAXBRACES      16   /* max brace words on a command line */
+#define MAXPSUBS        8   /* max process substitutions on a command line */
+#define MAXHELPERS     64   /* max process substitution helpers running */
+#define PSUB_PATHLEN   24   /* room for /dev/fd/N */
+#define MAXAHEAD        4   /* max command lines parsed ahead */
+#define MAXCMDNAME     64   /* max command name kept for %name job specs */
 
 struct job_t;
 
 
 /* 
  * Job states: FG (foreground), BG (background), ST (stopped),
- *             UNDEF (undefined)
+ *             TH (throttled), UNDEF (undefined)
  * Job state transitions and enabling actions:
  *     FG -> ST  : ctrl-z
  *     ST -> FG  : fg command
  *     ST -> BG  : bg command
  *     BG -> FG  : fg command
+ *     BG -> TH  : load governor, under pressure
+ *     TH -> BG  : load governor once pressure drops, or bg command
+ *     TH -> FG  : fg command
  * At most 1 job can be in the FG state.
  */
 
@@ -42,7 +53,8 @@ typedef enum job_state
     UNDEF,
     FG,
     BG,
-    ST
+    ST,
+    TH
 } job_state;
 
 // Parseline return states
@@ -54,6 +66,15 @@ typedef enum parseline_return
     PARSELINE_ERROR
 } parseline_return;
 
+// Operators that join the commands of a command list
+typedef enum list_op
+{
+    LIST_END,                   // none: the last command of the list
+    LIST_SEQ,                   // a ; b   runs b after a
+    LIST_AND,                   // a && b  runs b if a succeeded
+    LIST_OR                     // a || b  runs b if a failed
+} list_op;
+
 // Builtin states for shell to execute
 typedef enum builtin_state
 {
@@ -61,18 +82,132 @@ typedef enum builtin_state
     BUILTIN_QUIT,
     BUILTIN_JOBS,
     BUILTIN_BG,
-    BUILTIN_FG
+    BUILTIN_FG,
+    BUILTIN_WAIT,
+    BUILTIN_TIMEOUT,
+    BUILTIN_RENICE,
+    BUILTIN_ULIMIT,
+    BUILTIN_RSSGUARD,
+    BUILTIN_THROTTLE,
+    BUILTIN_AUTONICE,
+    BUILTIN_HISTORY,
+    BUILTIN_EXPORT,
+    BUILTIN_UNSET,
+    BUILTIN_SOURCE,
+    BUILTIN_ALIAS,
+    BUILTIN_UNALIAS,
+    BUILTIN_FORKRETRY,
+    BUILTIN_KILL
 } builtin_state;
 
+// Job flags, see get_flags_of_job
+#define JOB_TIMEDOUT    0x1     // Job overran its deadline
+#define JOB_RSS_STOPPED 0x8     // Job was stopped over the soft RSS limit
+#define JOB_RSS_KILLED  0x10    // Job was killed over the hard RSS limit
+#define JOB_RSS_EXEMPT  0x20    // Job was resumed despite the soft limit
+#define JOB_THROTTLE_EXEMPT 0x40 // Job was resumed by bg while throttled
+#define JOB_DEMOTED     0x80    // Job runs at background priority
+
+/*
+ * Wall-clock deadline of a job. When the deadline passes the job's process
+ * group is sent sig; if it is still around grace_ms later it is killed.
+ */
+struct job_timeout
+{
+    long deadline_ms;           // Expiry time (timer_now_ms), or 0 if none
+    int sig;                    // Signal sent at the deadline
+    long grace_ms;              // Delay before SIGKILL, or 0 for none
+};
+
+/*
+ * Scheduling priority a job had before it was demoted to background
+ * priority (JOB_DEMOTED), restored when it returns to the foreground.
+ */
+struct job_sched
+{
+    int nice;                   // Nice value of the job's leader
+    int policy;                 // Scheduling policy of the job's leader
+};
+
+/*
+ * I/O redirection kinds, in the form [n]OP target:
+ *     REDIR_IN      n<file   (n defaults to 0)
+ *     REDIR_OUT     n>file   (n defaults to 1)
+ *     REDIR_APPEND  n>>file  (n defaults to 1)
+ *     REDIR_DUP     n>&m     (n defaults to 1; also n<&m, n defaults to 0)
+ *     REDIR_DATA    n<<WORD  (n defaults to 0) the here-document up to the
+ *                            line WORD, or n<<<word, the here-string word
+ */
+typedef enum redir_kind
+{
+    REDIR_IN,
+    REDIR_OUT,
+    REDIR_APPEND,
+    REDIR_DUP,
+    REDIR_DATA
+} redir_kind;
+
+struct redirection
+{
+    redir_kind kind;            // What kind of redirection this is
+    int fd;                     // The descriptor being redirected
+    int src_fd;                 // The descriptor duplicated by REDIR_DUP
+    char *path;                 // The file name for the other kinds
+    const char *data;           // The text read by REDIR_DATA
+    size_t len;                 // Its length
+};
+
+
+/*
+ * A process substitution, <(cmd) or >(cmd): an argument or file name that
+ * names a pipe from or to cmd, run alongside the command
+ */
+struct proc_subst
+{
+    bool write;                 // >(cmd): the command writes to cmd
+    char *cmd;                  // The command line of the helper
+    char *path;                 // The argument, /dev/fd/N once N is known
+};
 
 struct cmdline_tokens
 {
     char text[MAXLINE_TSH];     // Modified text from command line
     int argc;                   // Number of arguments
-    char *argv[MAXARGS];        // The arguments list
+    char **argv;                // The arguments list
+    int argv_cap;               // Size of argv
     char *infile;               // The input file
     char *outfile;              // The output file
+    int nredirs;                // Number of redirections, in command order
+    struct redirection redirs[MAXREDIRS];   // The redirections list
     builtin_state builtin;      // Indicates if argv[0] is a builtin command
+    int nbraces;                // Number of brace words
+    char *braces[MAXBRACES];    // Words of argv to brace-expand, lazily
+    int npsubs;                 // Number of process substitutions
+    struct proc_subst psubs[MAXPSUBS];
+    char arena[MAXEXPAND];      // Words changed by parameter expansion
+    size_t arena_used;          // Bytes of arena in use
+    char *argv_inline[MAXARGS]; // argv, unless globbing needs more room
+};
+
+/*
+ * Exit status of a child that could not execute its command, and the
+ * report it sends to the shell over the status pipe before exiting.
+ */
+#define EXIT_NOEXEC  127
+
+typedef enum report_stage
+{
+    REPORT_LIMIT,               // applying the resource limits
+    REPORT_PLACE,               // applying the launch placement
+    REPORT_REDIR,               // redirecting I/O
+    REPORT_EXEC                 // execve
+} report_stage;
+
+struct exec_report
+{
+    report_stage stage;         // Step that failed
+    int err;                    // errno of the failed call
+    int redir_op;               // Failing redirection operation
 };
 
 
@@ -97,6 +232,87 @@ extern struct job_t job_list[MAXJOBS];  // The job list
 parseline_return parseline(const char *cmdline,
                            struct cmdline_tokens *token);
 
+/*
+ * parse_words splits cmdline into its words, redirections and process
+ * substitutions, which parse_expand then expands into token as parseline
+ * would parse cmdline, as often as needed: the splitting is done once
+ * for a line that is run many times. cmdline must stay valid for its
+ * here-documents. parse_words returns NULL if the line does not parse,
+ * without a diagnostic: parseline prints it when the line is run.
+ * parse_words_free frees the words.
+ */
+struct cmdline_words;
+
+struct cmdline_words *parse_words(const char *cmdline);
+parseline_return parse_expand(const char *cmdline,
+                              const struct cmdline_words *words,
+                              struct cmdline_tokens *token);
+void parse_words_free(struct cmdline_words *words);
+
+/*
+ * split_list finds the end of the first command of a command list: the
+ * first ;, && or || outside quotes and process substitutions, on the
+ * first line of list. It returns the length of the command and stores
+ * the operator after it in *op (LIST_END, and the length of list, if
+ * there is none).
+ */
+size_t split_list(const char *list, list_op *op);
+
+/*
+ * heredoc_pending tests whether text, a command line followed by the
+ * lines read after it, still lacks the end of one of the here-documents
+ * the command line starts: the caller must read another line.
+ */
+bool heredoc_pending(const char *text);
+
+/*
+ * set_expansion_params sets the values parseline gives the special
+ * parameters $? (status) and $! (bg_pid, or nothing if it is 0).
+ */
+void set_expansion_params(int status, pid_t bg_pid);
+
+/*
+ * set_positional_params sets the positional parameters $1 ... $nargs to
+ * args, which must stay valid while they are set, and stores the
+ * previous ones in *saved_args and *saved_nargs.
+ */
+void set_positional_params(char *const *args, int nargs,
+                           char *const **saved_args, int *saved_nargs);
+
+/*
+ * parse_splice replaces argument index of a line parsed by parseline
+ * with words, expanding those marked in expand as parseline expands an
+ * unquoted argument. The words must stay valid while token is used.
+ * Returns false after printing a diagnostic.
+ */
+bool parse_splice(struct cmdline_tokens *token, int index,
+                  char *const *words, const bool *expand, int nwords);
+
+/*
+ * parse_ahead parses cmdline, which must stay valid, ahead of its turn,
+ * for parse_take to hand over when it is evaluated, so that the parsing
+ * is done while a job runs. It is expanded from words (see parse_words)
+ * unless they are NULL. Lines are taken in the order they were
+ * parsed. A line is not kept if it is a command list, fails to parse
+ * (its diagnostics are printed at its turn), or has words that match
+ * files, as the files may change before it runs. Returns false if the
+ * line was not kept, after which the lines following it are not wanted.
+ */
+bool parse_ahead(const char *cmdline, const struct cmdline_words *words);
+
+/*
+ * parse_take returns the token parsed ahead for cmdline, storing its
+ * parseline result in *result, if cmdline is the next line parsed ahead
+ * and the variables and parameters its words were expanded from have not
+ * changed since. Otherwise it drops every line parsed ahead, and returns
+ * NULL: cmdline is to be parsed now. The token is given back with
+ * parse_release once done with; parse_ahead_cancel drops every line.
+ */
+struct cmdline_tokens *parse_take(const char *cmdline,
+                                  parseline_return *result);
+void parse_release(struct cmdline_tokens *token);
+void parse_ahead_cancel(void);
+
 /*
  * sigquit_handler terminates the shell due to SIGQUIT signal.
  */
@@ -122,6 +338,30 @@ bool add_job(pid_t pid, job_state state,
  */
 bool delete_job(pid_t pid);
 
+/*
+ * add_helper records pid as a helper of the job whose process group is
+ * pgid: a process substitution, cmdline, run in the job's process group.
+ * Helpers are listed with their job, and reaped quietly. It returns false
+ * if there are too many.
+ */
+bool add_helper(pid_t pid, pid_t pgid, const char *cmdline);
+
+/*
+ * delete_helper forgets helper pid. It returns false if pid is not one.
+ */
+bool delete_helper(pid_t pid);
+
+/*
+ * kill_helpers sends sig to the helpers of the job whose process group is
+ * pgid, and not to the job itself.
+ */
+void kill_helpers(pid_t pgid, int sig);
+
+/*
+ * is_helper tests whether pid is a helper.
+ */
+bool is_helper(pid_t pid);
+
 /*
  * fg_pid returns the process ID of the foreground job in the job list.
  */
@@ -134,6 +374,13 @@ pid_t fg_pid();
  */
 struct job_t *find_job_with_pid(pid_t pid);
 
+/*
+ * find_job_with_driver returns the job whose suspended command list is
+ * run on by the driver pid (see set_driver_of_job), or NULL if there is
+ * none.
+ */
+struct job_t *find_job_with_driver(pid_t pid);
+
 /*
  * find_job_with_jid takes in a job ID, and returns either a pointer the job
  * struct with the respective job ID, or NULL if a job with the given job ID
@@ -148,11 +395,33 @@ struct job_t *find_job_with_jid(int jid);
  */
 int find_jid_by_pid(pid_t pid);
 
+/*
+ * find_job_with_spec takes in a job specification without its leading %,
+ * and returns the job it names, or NULL if there is none:
+ *     N         the job with job ID N
+ *     +, % or nothing
+ *               the current job: the most recently stopped, or if none is
+ *               stopped, the most recently started
+ *     -         the previous job: the one that was current before it
+ *     name      the job whose command line, or whose command name (the
+ *               last part of the program's path), starts with name
+ *     ?text     the job whose command line contains text
+ * If several jobs match a name or text, it sets *ambiguous and returns
+ * NULL.
+ */
+struct job_t *find_job_with_spec(const char *spec, bool *ambiguous);
+
 /*
  * list_jobs prints the job list to standard output.
  */
 void list_jobs(int output_fd);
 
+/*
+ * list_jobs_long prints the job list like list_jobs, followed for each job
+ * by the current CPU affinity, nice value and I/O priority of its leader.
+ */
+void list_jobs_long(int output_fd);
+
 /*
  * usage prints usage instructions for the tiny shell.
  */
@@ -172,6 +441,43 @@ int get_jid_of_job(struct job_t *jobp);
  */
 char *get_cmdline_of_job(struct job_t *jobp);
 
+/*
+ * set_command_of_job sets the command name of a job, which %name job
+ * specs match, to the last part of path, the program it runs. add_job
+ * takes it from the first word of the command line after any NAME=value
+ * words, which may be a launch prefix instead.
+ */
+void set_command_of_job(struct job_t *jobp, const char *path);
+
+/*
+ * set_cmdline_of_job replaces the command line jobs shows for a job.
+ */
+void set_cmdline_of_job(struct job_t *jobp, const char *cmdline);
+
+/*
+ * set_driver_of_job hands the rest of a command list, one of whose
+ * commands is the stopped job jobp, over to driver, a process in the
+ * job's group that runs it once the command has ended. The job is then
+ * both: the driver's stops and exit are the job's. relay_fd is the
+ * socket where relay_job_status sends the command's status; the job
+ * closes it.
+ */
+void set_driver_of_job(struct job_t *jobp, pid_t driver, int relay_fd);
+
+/*
+ * relay_job_status sends status, the wait status of the leader of jobp,
+ * to its driver. Returns false, sending nothing, if the job has no driver
+ * waiting for it. Async-signal-safe.
+ */
+bool relay_job_status(struct job_t *jobp, int status);
+
+/*
+ * drop_job_driver forgets the driver of jobp, which has been reaped.
+ * Returns true if it went before the status of the job's leader was
+ * relayed to it: the job is then that of the leader alone again.
+ */
+bool drop_job_driver(struct job_t *jobp);
+
 /* get_state_of_job, returns the state of a job
  */
 job_state get_state_of_job(struct job_t *jobp);
@@ -180,5 +486,65 @@ job_state get_state_of_job(struct job_t *jobp);
  */
 void set_state_of_job(struct job_t *jobp, job_state state);
 
+/*
+ * get_next_job returns the job following jobp in the job list, or the first
+ * job if jobp is NULL. It returns NULL after the last job.
+ */
+struct job_t *get_next_job(struct job_t *jobp);
+
+/* get_flags_of_job, set_flags_of_job - access a job's JOB_* flags
+ */
+unsigned get_flags_of_job(struct job_t *jobp);
+void set_flags_of_job(struct job_t *jobp, unsigned flags);
+
+/* get_timeout_of_job - returns the (modifiable) deadline of a job
+ */
+struct job_timeout *get_timeout_of_job(struct job_t *jobp);
+
+/* get_sched_of_job - returns the (modifiable) saved priority of a job
+ */
+struct job_sched *get_sched_of_job(struct job_t *jobp);
+
+/* get_cpu_limit_of_job, set_cpu_limit_of_job - access the CPU time limit
+ * (seconds) a job runs under, 0 if none, used to explain its death
+ */
+long get_cpu_limit_of_job(struct job_t *jobp);
+void set_cpu_limit_of_job(struct job_t *jobp, long seconds);
+
+/*
+ * record_job_status remembers the wait status reported by waitpid for a
+ * job's process (termination or stop), together with the job's flags, so
+ * that it can be looked up after the job has been deleted.
+ * It is async-signal-safe.
+ */
+void record_job_status(pid_t pid, int status, unsigned flags);
+
+/*
+ * find_job_status looks up the most recent status recorded for pid. It
+ * returns true and stores the status (and flags, if not NULL) if one is
+ * found, and false otherwise.
+ */
+bool find_job_status(pid_t pid, int *status, unsigned *flags);
+
+/*
+ * get_reap_count returns how many job terminations have been recorded so
+ * far; get_last_reaped returns the pid and status of the latest one.
+ */
+unsigned long get_reap_count(void);
+pid_t get_last_reaped(int *status, unsigned *flags);
+
+/*
+ * lookup_builtin returns the builtin named by a command name, or
+ * BUILTIN_NONE if it is not a builtin.
+ */
+builtin_state lookup_builtin(const char *name);
+
+/*
+ * parse_signal converts a signal number or name (with or without the SIG
+ * prefix, e.g. "9", "KILL", "SIGTERM") to a signal number. It returns -1
+ * if the signal is unknown.
+ */
+int parse_signal(const char *name);
+
 
 #endif // __TSH_HELPER_H__
@@ -0,0 +1,412 @@
+/* tsh_history.c
+ * persistent command history for tshlab
+ */
+
+#include <stdint.h>
+#include <sys/file.h>
+
+#include "tsh_history.h"
+
+#define HIST_MAGIC      0x33485354      /* "TSH3" */
+#define HIST_LEVELS     8               /* prefix lengths with a chain */
+#define HIST_BUCKETS    65536           /* buckets per chain level */
+#define HIST_MINMAP     (1 << 20)       /* smallest mapping, in bytes */
+
+/*
+ * Index header, at the start of FILE.idx. An entry at least L bytes long
+ * is on the chain of level L (1 to HIST_LEVELS) for its first L bytes:
+ * bucketed by those bytes for L = 1 and 2, by a hash of them beyond.
+ */
+struct hist_header
+{
+    uint32_t magic;                     // HIST_MAGIC, 0 once replaced
+    uint32_t count;                     // Number of entries
+    uint32_t heads[HIST_LEVELS][HIST_BUCKETS];  // Newest entry per bucket
+};
+
+/* Index entry; entry n (1 is the oldest) follows the header */
+struct hist_entry
+{
+    uint64_t offset;                    // Start of the command in FILE
+    uint32_t len;                       // Length, without the newline
+    uint32_t prev[HIST_LEVELS];         // Previous entry on each chain
+    uint32_t unused;
+};
+
+/* The open history */
+static struct
+{
+    int data_fd;                        // FILE, or -1 if there is none
+    int idx_fd;                         // FILE.idx
+    const char *data;                   // Mapping of FILE
+    size_t data_maplen;
+    struct hist_header *idx;            // Mapping of FILE.idx
+    size_t idx_maplen;
+    char idx_path[MAXLINE_TSH];         // Name of FILE.idx
+} hist = { -1, -1, NULL, 0, NULL, 0, "" };
+
+/* entry_at - Index entry n of the current mapping */
+#define entry_at(n) \
+    ((struct hist_entry *)(hist.idx + 1) + ((n) - 1))
+
+/* bucket_of - Bucket of the first level (1 to HIST_LEVELS) bytes of cmd */
+static unsigned bucket_of(const char *cmd, int level) {
+    uint32_t hash = 2166136261u;
+    int i;
+
+    if (level <= 2) {
+        return (level == 1) ? (unsigned char)cmd[0]
+                            : ((unsigned char)cmd[0] << 8) |
+                              (unsigned char)cmd[1];
+    }
+    for (i = 0; i < level; i++) {       // FNV-1a
+        hash = (hash ^ (unsigned char)cmd[i]) * 16777619u;
+    }
+    return (hash ^ (hash >> 16)) % HIST_BUCKETS;
+}
+
+/*
+ * map_file - Make sure *map covers the first need bytes of fd, remapping
+ * it (with room to grow, since the file only grows) if it does not
+ */
+static bool map_file(int fd, void **map, size_t *maplen, size_t need,
+                     int prot) {
+    size_t len;
+    void *p;
+
+    if (*map != NULL && need <= *maplen) {
+        return true;
+    }
+    len = (need < HIST_MINMAP / 2) ? HIST_MINMAP : need * 2;
+    if ((p = mmap(NULL, len, prot, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        return false;
+    }
+    if (*map != NULL) {
+        munmap(*map, *maplen);
+    }
+    *map = p;
+    *maplen = len;
+    return true;
+}
+
+/* map_index - Map the index far enough for n entries */
+static bool map_index(uint32_t n) {
+    return map_file(hist.idx_fd, (void **)&hist.idx, &hist.idx_maplen,
+                    sizeof(struct hist_header) +
+                    n * sizeof(struct hist_entry),
+                    PROT_READ | PROT_WRITE);
+}
+
+/* map_data - Map the data file up to offset end */
+static bool map_data(uint64_t end) {
+    return map_file(hist.data_fd, (void **)&hist.data, &hist.data_maplen,
+                    end, PROT_READ);
+}
+
+/* unmap_index - Drop the mapping of the index */
+static void unmap_index(void) {
+    if (hist.idx != NULL) {
+        munmap(hist.idx, hist.idx_maplen);
+    }
+    hist.idx = NULL;
+    hist.idx_maplen = 0;
+}
+
+/*
+ * lock_index - Take the index lock, first moving to the current FILE.idx
+ * if a rebuild has replaced the one open. Returns false if the current
+ * one cannot be opened.
+ */
+static bool lock_index(void) {
+    struct stat open_st, path_st;
+    int fd;
+
+    for (;;) {
+        flock(hist.idx_fd, LOCK_EX);
+        if (fstat(hist.idx_fd, &open_st) < 0 ||
+            stat(hist.idx_path, &path_st) < 0 ||
+            (open_st.st_dev == path_st.st_dev &&
+             open_st.st_ino == path_st.st_ino)) {
+            return true;
+        }
+        flock(hist.idx_fd, LOCK_UN);
+        if ((fd = open(hist.idx_path, O_RDWR | O_CLOEXEC)) < 0) {
+            return false;
+        }
+        close(hist.idx_fd);
+        hist.idx_fd = fd;
+        unmap_index();
+    }
+}
+
+/*
+ * append_entry - Index a command stored at offset in FILE.
+ * The index lock must be held.
+ */
+static bool append_entry(uint64_t offset, const char *cmd, size_t len) {
+    struct hist_entry entry;
+    uint32_t n = hist.idx->count + 1;
+    unsigned buckets[HIST_LEVELS];
+    int level;
+
+    memset(&entry, 0, sizeof(entry));
+    entry.offset = offset;
+    entry.len = len;
+    for (level = 1; level <= HIST_LEVELS && (size_t)level <= len; level++) {
+        buckets[level - 1] = bucket_of(cmd, level);
+        entry.prev[level - 1] = hist.idx->heads[level - 1][buckets[level - 1]];
+    }
+    if (pwrite(hist.idx_fd, &entry, sizeof(entry),
+               sizeof(struct hist_header) +
+               (n - 1) * sizeof(struct hist_entry)) != sizeof(entry)) {
+        return false;
+    }
+    for (level = 1; level <= HIST_LEVELS && (size_t)level <= len; level++) {
+        hist.idx->heads[level - 1][buckets[level - 1]] = n;
+    }
+    hist.idx->count = n;
+    return true;
+}
+
+/*
+ * rebuild_index - Recreate the index from the data file, in a new file
+ * that then replaces FILE.idx. Other shells may have the old one mapped,
+ * so it is never truncated: it is marked replaced, and they move to the
+ * new one when they next take the lock (see lock_index).
+ * The index lock must be held; it is released with the old index.
+ */
+static bool rebuild_index(void) {
+    char tmp_path[MAXLINE_TSH + 16];
+    struct hist_header *old_idx = hist.idx;
+    size_t old_maplen = hist.idx_maplen;
+    int old_fd = hist.idx_fd;
+    struct stat st, old_st;
+    const char *p, *end, *nl;
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d", hist.idx_path,
+             (int)getpid());
+    if ((hist.idx_fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+                            DEF_MODE)) < 0) {
+        hist.idx_fd = old_fd;
+        return false;
+    }
+    hist.idx = NULL;
+    hist.idx_maplen = 0;
+    if (ftruncate(hist.idx_fd, sizeof(struct hist_header)) < 0 ||
+        !map_index(0) || fstat(hist.data_fd, &st) < 0) {
+        goto fail;
+    }
+
+    if (st.st_size > 0) {
+        if (!map_data(st.st_size)) {
+            goto fail;
+        }
+        p = hist.data;
+        end = hist.data + st.st_size;
+        while (p < end && (nl = memchr(p, '\n', end - p)) != NULL) {
+            if (nl > p && !append_entry(p - hist.data, p, nl - p)) {
+                goto fail;
+            }
+            p = nl + 1;
+        }
+    }
+    hist.idx->magic = HIST_MAGIC;
+    if (rename(tmp_path, hist.idx_path) < 0) {
+        goto fail;
+    }
+
+    /* the old index, if it has a header, tells its users it is replaced */
+    if (old_idx != NULL && fstat(old_fd, &old_st) == 0 &&
+        (size_t)old_st.st_size >= sizeof(struct hist_header)) {
+        old_idx->magic = 0;
+    }
+    if (old_idx != NULL) {
+        munmap(old_idx, old_maplen);
+    }
+    close(old_fd);
+    return true;
+
+fail:
+    unmap_index();
+    close(hist.idx_fd);
+    unlink(tmp_path);
+    hist.idx_fd = old_fd;
+    hist.idx = old_idx;
+    hist.idx_maplen = old_maplen;
+    return false;
+}
+
+/* history_open - Open the history files */
+bool history_open(const char *path) {
+    struct stat st;
+    bool ok;
+
+    if (strlen(path) + sizeof(".idx") > sizeof(hist.idx_path)) {
+        return false;
+    }
+    strcpy(hist.idx_path, path);
+    strcat(hist.idx_path, ".idx");
+
+    hist.data_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, DEF_MODE);
+    hist.idx_fd = open(hist.idx_path, O_RDWR | O_CREAT | O_CLOEXEC,
+                       DEF_MODE);
+    if (hist.data_fd < 0 || hist.idx_fd < 0 || !lock_index()) {
+        goto fail;
+    }
+
+    /* the size is only checked under the lock, as others append */
+    ok = fstat(hist.idx_fd, &st) == 0 &&
+         (size_t)st.st_size >= sizeof(struct hist_header) &&
+         map_index(0) && hist.idx->magic == HIST_MAGIC &&
+         (size_t)st.st_size >= sizeof(struct hist_header) +
+                               hist.idx->count * sizeof(struct hist_entry);
+    if (!ok) {
+        ok = rebuild_index();
+    }
+    flock(hist.idx_fd, LOCK_UN);
+    if (ok) {
+        return true;
+    }
+
+fail:
+    if (hist.data_fd >= 0) {
+        close(hist.data_fd);
+    }
+    if (hist.idx_fd >= 0) {
+        close(hist.idx_fd);
+    }
+    hist.data_fd = hist.idx_fd = -1;
+    return false;
+}
+
+/* history_add - Append a command line to the history */
+void history_add(const char *cmdline) {
+    char line[MAXLINE_TSH + 1];
+    size_t len = strlen(cmdline);
+    off_t offset;
+
+    if (hist.data_fd < 0 || len == 0 || len >= MAXLINE_TSH) {
+        return;
+    }
+    memcpy(line, cmdline, len);
+    line[len] = '\n';
+
+    if (!lock_index()) {
+        return;
+    }
+    if (map_index(0) && map_index(hist.idx->count + 1) &&
+        (offset = lseek(hist.data_fd, 0, SEEK_END)) >= 0 &&
+        pwrite(hist.data_fd, line, len + 1, offset) == (ssize_t)len + 1) {
+        append_entry(offset, line, len);
+    }
+    flock(hist.idx_fd, LOCK_UN);
+}
+
+/* history_count - Number of entries */
+int history_count(void) {
+    if (hist.data_fd < 0) {
+        return 0;
+    }
+    /* a rebuild by another shell replaced the index: move to the new one */
+    if (hist.idx->magic != HIST_MAGIC) {
+        if (!lock_index()) {
+            return 0;
+        }
+        flock(hist.idx_fd, LOCK_UN);
+        if (!map_index(0)) {
+            return 0;
+        }
+    }
+    return (int)hist.idx->count;
+}
+
+/* history_get - Entry n of the history */
+const char *history_get(int n, size_t *len) {
+    struct hist_entry *entry;
+
+    if (n < 1 || n > history_count() || !map_index(n)) {
+        return NULL;
+    }
+    entry = entry_at(n);
+    if (!map_data(entry->offset + entry->len)) {
+        return NULL;
+    }
+    *len = entry->len;
+    return hist.data + entry->offset;
+}
+
+/*
+ * history_find_prefix - Newest entry starting with prefix, walking the
+ * chain of the prefix's length (capped at HIST_LEVELS), which only holds
+ * entries sharing the prefix and a few hash collisions
+ */
+int history_find_prefix(const char *prefix) {
+    size_t plen = strlen(prefix);
+    int level = (plen < HIST_LEVELS) ? (int)plen : HIST_LEVELS;
+    size_t len;
+    const char *cmd;
+    uint32_t n;
+
+    if (plen == 0 || history_count() == 0 || !map_index(history_count())) {
+        return 0;
+    }
+
+    for (n = hist.idx->heads[level - 1][bucket_of(prefix, level)]; n > 0;
+         n = entry_at(n)->prev[level - 1]) {
+        if ((cmd = history_get(n, &len)) != NULL && len >= plen &&
+            memcmp(cmd, prefix, plen) == 0) {
+            return n;
+        }
+    }
+    return 0;
+}
+
+/* history_expand - Replace a history reference with its entry */
+int history_expand(char *cmdline, size_t size) {
+    const char *ref = cmdline + 1;
+    const char *cmd;
+    char *end;
+    size_t len;
+    long n;
+
+    if (cmdline[0] != '!' || cmdline[1] == '\0' ||
+        isspace((unsigned char)cmdline[1])) {
+        return 0;
+    }
+
+    if (strcmp(ref, "!") == 0) {
+        n = history_count();
+    } else if (isdigit((unsigned char)ref[0]) || ref[0] == '-') {
+        n = strtol(ref, &end, 10);
+        if (*end != '\0') {
+            n = 0;
+        } else if (n < 0) {
+            n += history_count() + 1;
+        }
+    } else {
+        n = history_find_prefix(ref);
+    }
+
+    if ((cmd = history_get(n, &len)) == NULL || len >= size) {
+        sio_printf("%s: event not found\n", cmdline);
+        return -1;
+    }
+    memcpy(cmdline, cmd, len);
+    cmdline[len] = '\0';
+    return 1;
+}
+
+/* history_print - Print the last n entries */
+void history_print(int n) {
+    int count = history_count();
+    int i;
+    const char *cmd;
+    size_t len;
+
+    i = (n > 0 && n < count) ? count - n + 1 : 1;
+    for (; i <= count; i++) {
+        if ((cmd = history_get(i, &len)) != NULL) {
+            printf("%5d  %.*s\n", i, (int)len, cmd);
+        }
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef __TSH_HISTORY_H__
+#define __TSH_HISTORY_H__
+
+/*
+ * tsh_history.h: persistent command history for tshlab
+ *
+ * The history is kept in two files shared by every shell using them:
+ *
+ *     FILE      the commands, one per line, only ever appended to
+ *     FILE.idx  an index: a header holding the entry count and, for each
+ *               bucket, the newest entry in that bucket, followed by one
+ *               fixed-size entry per command giving its offset and length
+ *               in FILE and the previous entry in each of its buckets
+ *
+ * A command is in a bucket for each of its first one to eight bytes: for
+ * the bytes themselves at one and two, for a hash of them beyond. Both
+ * files are memory-mapped, so reading an entry is a memory access, and a
+ * prefix search walks the chain for the prefix's length (eight at most),
+ * which only visits the entries that share it, newest first. Appending is
+ * two pwrites and a store to the mapped header under flock, so concurrent
+ * shells never interleave.
+ *
+ * The index can always be rebuilt from FILE. A rebuild writes a new file
+ * and renames it over FILE.idx; the old one, which other shells may have
+ * mapped, is only marked replaced, and they move to the new one.
+ */
+
+#include "tsh_helper.h"
+
+#define HISTFILE_DEFAULT  ".tsh_history"    /* in $HOME */
+
+/*
+ * history_open opens (creating if needed) the history in path, checking
+ * its index and rebuilding it if it is missing or damaged. Returns false
+ * if the history cannot be used; the shell then runs without one.
+ */
+bool history_open(const char *path);
+
+/*
+ * history_add appends a command line to the history.
+ */
+void history_add(const char *cmdline);
+
+/*
+ * history_count returns the number of entries in the history, including
+ * those appended by other shells.
+ */
+int history_count(void);
+
+/*
+ * history_get returns entry n (1 is the oldest) and stores its length in
+ * len. The entry is not NUL-terminated. Returns NULL if there is no such
+ * entry.
+ */
+const char *history_get(int n, size_t *len);
+
+/*
+ * history_find_prefix returns the number of the newest entry that starts
+ * with prefix, or 0 if there is none.
+ */
+int history_find_prefix(const char *prefix);
+
+/*
+ * history_expand replaces a command line of the form !!, !N, !-N or
+ * !prefix with the history entry it refers to. Returns 1 if the line was
+ * expanded, 0 if it is not a history reference, or -1 after printing a
+ * diagnostic if the entry does not exist.
+ */
+int history_expand(char *cmdline, size_t size);
+
+/*
+ * history_print prints the last n entries (all if n is 0) to stdout.
+ */
+void history_print(int n);
+
+#endif // __TSH_HISTORY_H__
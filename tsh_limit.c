@@ -0,0 +1,212 @@
+/* tsh_limit.c
+ * per-job resource limits for tshlab
+ */
+
+#include <sys/syscall.h>
+
+#include "tsh_limit.h"
+#include "tsh_proc.h"
+
+/* Resource limit as passed to the prlimit64 system call */
+struct limit_rlimit64
+{
+    unsigned long long cur;
+    unsigned long long max;
+};
+
+/* Description of each limit, indexed by limit_kind */
+static const struct
+{
+    char opt;                   // ulimit option letter
+    int resource;               // RLIMIT_*
+    rlim_t scale;               // Bytes (or units) per ulimit unit
+    const char *name;           // Name printed by ulimit
+} limit_table[LIMIT_COUNT] = {
+    { 'v', RLIMIT_AS,     1024, "address space (kbytes)" },
+    { 't', RLIMIT_CPU,    1,    "cpu time (seconds)" },
+    { 'n', RLIMIT_NOFILE, 1,    "open files" },
+    { 'u', RLIMIT_NPROC,  1,    "processes" },
+    { 'c', RLIMIT_CORE,   1024, "core file size (kbytes)" },
+};
+
+/* limit_kind_of - Limit selected by a ulimit option letter */
+int limit_kind_of(char opt) {
+    int kind;
+
+    for (kind = 0; kind < LIMIT_COUNT; kind++) {
+        if (limit_table[kind].opt == opt) {
+            return kind;
+        }
+    }
+    return -1;
+}
+
+/* parse_limit - Parse a limit value into a limit set */
+bool parse_limit(limit_kind kind, const char *str, struct limit_set *set) {
+    char *end;
+    unsigned long long value;
+
+    if (strcmp(str, "unlimited") == 0) {
+        set->value[kind] = RLIM_INFINITY;
+    } else {
+        if (!isdigit((unsigned char)str[0])) {
+            return false;
+        }
+        errno = 0;
+        value = strtoull(str, &end, 10);
+        if (*end != '\0' || errno != 0 || value >= RLIM_INFINITY) {
+            return false;
+        }
+        set->value[kind] = (rlim_t)value;
+    }
+    set->mask |= 1U << kind;
+    return true;
+}
+
+/* limit_merge - Copy the limits set in src into dst */
+void limit_merge(struct limit_set *dst, const struct limit_set *src) {
+    int kind;
+
+    for (kind = 0; kind < LIMIT_COUNT; kind++) {
+        if (src->mask & (1U << kind)) {
+            dst->value[kind] = src->value[kind];
+            dst->mask |= 1U << kind;
+        }
+    }
+}
+
+/*
+ * limit_rlimit - The soft and hard limits for a value in ulimit units.
+ * The hard CPU limit is a second past the soft one, so that a job first
+ * gets SIGXCPU (which explains its death) rather than SIGKILL.
+ */
+static void limit_rlimit(limit_kind kind, rlim_t value, rlim_t *cur,
+                         rlim_t *max) {
+    if (value == RLIM_INFINITY) {
+        *cur = *max = RLIM_INFINITY;
+        return;
+    }
+    *cur = *max = value * limit_table[kind].scale;
+    if (kind == LIMIT_CPU) {
+        *max = value + 1;
+    }
+}
+
+/* limits_apply_self - Apply a limit set to the calling process */
+int limits_apply_self(const struct limit_set *set) {
+    struct rlimit rl;
+    int kind;
+
+    for (kind = 0; kind < LIMIT_COUNT; kind++) {
+        if (!(set->mask & (1U << kind))) {
+            continue;
+        }
+        limit_rlimit(kind, set->value[kind], &rl.rlim_cur, &rl.rlim_max);
+        if (setrlimit(limit_table[kind].resource, &rl) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* A limit set being applied to a process group, for limit_member */
+struct limit_walk
+{
+    const struct limit_set *set;
+    int err;                    // errno of the last failure, or 0
+};
+
+/* limit_member - Apply a limit set to one process of a group */
+static void limit_member(pid_t pid, void *arg) {
+    struct limit_walk *walk = arg;
+    struct limit_rlimit64 rl;
+    rlim_t cur, max;
+    int kind;
+
+    for (kind = 0; kind < LIMIT_COUNT; kind++) {
+        if (!(walk->set->mask & (1U << kind))) {
+            continue;
+        }
+        limit_rlimit(kind, walk->set->value[kind], &cur, &max);
+        rl.cur = cur;
+        rl.max = max;
+        if (syscall(SYS_prlimit64, pid, limit_table[kind].resource,
+                    &rl, NULL) < 0) {
+            walk->err = errno;
+        }
+    }
+}
+
+/* limits_apply_pgrp - Apply a limit set to a whole process group */
+int limits_apply_pgrp(pid_t pgid, const struct limit_set *set) {
+    struct limit_walk walk;
+
+    walk.set = set;
+    walk.err = 0;
+    if (proc_pgrp_each(pgid, limit_member, &walk) == 0) {
+        errno = ESRCH;
+        return -1;
+    }
+    if (walk.err != 0) {
+        errno = walk.err;
+        return -1;
+    }
+    return 0;
+}
+
+/* limit_print - Print the limits given to new jobs */
+void limit_print(const struct limit_set *set) {
+    struct rlimit rl;
+    rlim_t value;
+    int kind;
+
+    for (kind = 0; kind < LIMIT_COUNT; kind++) {
+        if (set->mask & (1U << kind)) {
+            value = set->value[kind];
+        } else if (getrlimit(limit_table[kind].resource, &rl) == 0 &&
+                   rl.rlim_cur != RLIM_INFINITY) {
+            value = rl.rlim_cur / limit_table[kind].scale;
+        } else {
+            value = RLIM_INFINITY;
+        }
+
+        if (value == RLIM_INFINITY) {
+            printf("-%c  %-26s unlimited\n", limit_table[kind].opt,
+                   limit_table[kind].name);
+        } else {
+            printf("-%c  %-26s %llu\n", limit_table[kind].opt,
+                   limit_table[kind].name, (unsigned long long)value);
+        }
+    }
+}
+
+/* limit_cpu_of - The CPU time limit set in a limit set */
+bool limit_cpu_of(const struct limit_set *set, long *seconds) {
+    if (!(set->mask & (1U << LIMIT_CPU))) {
+        return false;
+    }
+    *seconds = (set->value[LIMIT_CPU] == RLIM_INFINITY)
+               ? 0 : (long)set->value[LIMIT_CPU];
+    return true;
+}
+
+/* limit_death - The limit that explains how a job died, if any */
+const char *limit_death(int status, long cpu_limit, long cpu_used_ms) {
+    int sig;
+
+    if (!WIFSIGNALED(status)) {
+        return NULL;
+    }
+    sig = WTERMSIG(status);
+    if (sig == SIGXCPU) {
+        return "cpu time limit exceeded";
+    }
+    if (sig == SIGXFSZ) {
+        return "file size limit exceeded";
+    }
+    /* past the soft limit, the kernel kills at the hard one */
+    if (sig == SIGKILL && cpu_limit > 0 && cpu_used_ms >= cpu_limit * 1000) {
+        return "cpu time limit exceeded";
+    }
+    return NULL;
+}
@@ -0,0 +1,88 @@
+#ifndef __TSH_LIMIT_H__
+#define __TSH_LIMIT_H__
+
+/*
+ * tsh_limit.h: per-job resource limits for tshlab
+ *
+ * A limit set holds the resource limits to give a job: address space, CPU
+ * seconds, open files, processes and core file size. A limit set is
+ * applied to a child before execve (the ulimit launch prefix and the
+ * shell-wide limits), or to every process of a running job with prlimit.
+ * The shell itself is never limited.
+ */
+
+#include <sys/resource.h>
+#include "tsh_helper.h"
+
+// Limits in a limit set, in the order ulimit lists them
+typedef enum limit_kind
+{
+    LIMIT_AS,                   // -v  address space (kbytes)
+    LIMIT_CPU,                  // -t  CPU time (seconds)
+    LIMIT_NOFILE,               // -n  open files
+    LIMIT_NPROC,                // -u  processes
+    LIMIT_CORE,                 // -c  core file size (kbytes)
+    LIMIT_COUNT
+} limit_kind;
+
+struct limit_set
+{
+    unsigned mask;                      // Bit (1 << kind) for each limit set
+    rlim_t value[LIMIT_COUNT];          // Limit, in ulimit units
+};
+
+/*
+ * limit_kind_of returns the limit selected by a ulimit option letter
+ * ('v', 't', 'n', 'u' or 'c'), or -1 if there is none.
+ */
+int limit_kind_of(char opt);
+
+/*
+ * parse_limit parses a limit value ("unlimited" or a number in the unit
+ * of the limit) and records it in set. It returns false if the value is
+ * malformed.
+ */
+bool parse_limit(limit_kind kind, const char *str, struct limit_set *set);
+
+/*
+ * limit_merge copies into dst every limit that is set in src.
+ */
+void limit_merge(struct limit_set *dst, const struct limit_set *src);
+
+/*
+ * limits_apply_self applies a limit set to the calling process.
+ * Returns 0 on success, or -1 with errno set. Async-signal-safe.
+ */
+int limits_apply_self(const struct limit_set *set);
+
+/*
+ * limits_apply_pgrp applies a limit set with prlimit to every process in
+ * process group pgid. Returns 0 on success, or -1 with errno set if the
+ * limits could not be applied to some process.
+ */
+int limits_apply_pgrp(pid_t pgid, const struct limit_set *set);
+
+/*
+ * limit_print writes one line per limit to stdout: the value in set if
+ * it is set there, otherwise the shell's own (inherited) limit.
+ */
+void limit_print(const struct limit_set *set);
+
+/*
+ * limit_cpu_of tests whether set has a CPU time limit, and if so stores
+ * it in *seconds (0 for unlimited).
+ */
+bool limit_cpu_of(const struct limit_set *set, long *seconds);
+
+/*
+ * limit_death describes the limit a job died from, given its wait status,
+ * its CPU time limit in seconds (0 if none) and the CPU time it used, or
+ * returns NULL if no limit explains its death. A limit is only blamed on
+ * evidence: the signal the kernel sends for it (SIGXCPU, SIGXFSZ), or a
+ * SIGKILL once the CPU time used reached the limit. An address space
+ * limit leaves no such trace (an allocation just fails, and the peak
+ * size goes with the process), so it is not blamed. Async-signal-safe.
+ */
+const char *limit_death(int status, long cpu_limit, long cpu_used_ms);
+
+#endif // __TSH_LIMIT_H__
@@ -0,0 +1,547 @@
+/* tsh_proc.c
+ * process placement and /proc helpers for tshlab
+ */
+
+#include <sys/syscall.h>
+
+#include "tsh_proc.h"
+
+#define IOPRIO_WHO_PROCESS  1
+#define IOPRIO_WHO_PGRP     2
+#define IOPRIO_CLASS_SHIFT  13
+#define IOPRIO_LEVEL_MASK   ((1 << IOPRIO_CLASS_SHIFT) - 1)
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open          434     /* the same on every architecture */
+#endif
+#ifndef SYS_pidfd_send_signal
+#define SYS_pidfd_send_signal   424
+#endif
+
+#define DIRENT_BUFSIZE      16384   /* bytes per getdents64 batch */
+#define PROC_PATHLEN        64
+
+/* Directory entry returned by getdents64 */
+struct proc_dirent
+{
+    unsigned long long d_ino;
+    long long d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+/* I/O class names, indexed by IOCLASS_* */
+static const char *ioclass_names[] = {
+    "none", "realtime", "best-effort", "idle"
+};
+
+
+/*****************
+ * Parsing and formatting
+ *****************/
+
+/* set_cpu - Add cpu to the CPU mask of a placement */
+static void set_cpu(struct placement *place, long cpu) {
+    place->cpus[cpu / PLACE_MASKBITS] |= 1UL << (cpu % PLACE_MASKBITS);
+}
+
+/* has_cpu - Test whether cpu is in a CPU mask */
+static bool has_cpu(const unsigned long *cpus, long cpu) {
+    return (cpus[cpu / PLACE_MASKBITS] >> (cpu % PLACE_MASKBITS)) & 1;
+}
+
+/* parse_cpulist - Parse a CPU list such as "0-3,8" */
+bool parse_cpulist(const char *str, struct placement *place) {
+    const char *p = str;
+    char *end;
+    long first, last, cpu;
+    bool any = false;
+
+    memset(place->cpus, 0, sizeof(place->cpus));
+    while (*p != '\0') {
+        first = strtol(p, &end, 10);
+        if (end == p || first < 0 || first >= PLACE_MAXCPUS) {
+            return false;
+        }
+        last = first;
+        p = end;
+        if (*p == '-') {
+            p++;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first || last >= PLACE_MAXCPUS) {
+                return false;
+            }
+            p = end;
+        }
+        for (cpu = first; cpu <= last; cpu++) {
+            set_cpu(place, cpu);
+        }
+        any = true;
+        if (*p == ',') {
+            p++;
+        } else if (*p != '\0') {
+            return false;
+        }
+    }
+
+    if (any) {
+        place->flags |= PLACE_CPUS;
+    }
+    return any;
+}
+
+/* parse_ioclass - Parse an I/O class with an optional ":LEVEL" */
+bool parse_ioclass(const char *str, struct placement *place) {
+    const char *colon = strchr(str, ':');
+    size_t len = (colon != NULL) ? (size_t)(colon - str) : strlen(str);
+    int cls;
+    char *end;
+    long level = 4;
+
+    for (cls = IOCLASS_RT; cls <= IOCLASS_IDLE; cls++) {
+        if ((len == 1 && str[0] == '0' + cls) ||
+            (len == strlen(ioclass_names[cls]) &&
+             strncmp(str, ioclass_names[cls], len) == 0)) {
+            break;
+        }
+    }
+    if (cls > IOCLASS_IDLE) {
+        return false;
+    }
+
+    if (colon != NULL) {
+        level = strtol(colon + 1, &end, 10);
+        if (end == colon + 1 || *end != '\0' || level < 0 || level > 7) {
+            return false;
+        }
+    }
+
+    place->io_class = cls;
+    place->io_level = (cls == IOCLASS_IDLE) ? 0 : (int)level;
+    place->flags |= PLACE_IOPRIO;
+    return true;
+}
+
+/* format_cpulist - Write a CPU mask as a CPU list, truncated to fit */
+static void format_cpulist(const unsigned long *cpus, int ncpus,
+                           char *buf, size_t len) {
+    int cpu, last, n;
+    size_t used = 0;
+
+    buf[0] = '\0';
+    for (cpu = 0; cpu < ncpus && used < len; cpu++) {
+        if (!has_cpu(cpus, cpu)) {
+            continue;
+        }
+        for (last = cpu; last + 1 < ncpus && has_cpu(cpus, last + 1);
+             last++) {
+        }
+        if (last == cpu) {
+            n = snprintf(buf + used, len - used, "%s%d",
+                         used ? "," : "", cpu);
+        } else {
+            n = snprintf(buf + used, len - used, "%s%d-%d",
+                         used ? "," : "", cpu, last);
+        }
+        if (n < 0 || (size_t)n >= len - used) {
+            break;              // truncated: buf holds what fitted
+        }
+        used += n;
+        cpu = last;
+    }
+}
+
+/* proc_sched_of - Nice value and scheduling policy of a process */
+bool proc_sched_of(pid_t pid, int *nice, int *policy) {
+    errno = 0;
+    *nice = getpriority(PRIO_PROCESS, pid);
+    if (errno != 0) {
+        return false;
+    }
+    *policy = syscall(SYS_sched_getscheduler, pid);
+    return *policy >= 0;
+}
+
+/* format_placement - Describe the current placement of a process */
+void format_placement(pid_t pid, char *buf, size_t len) {
+    unsigned long cpus[PLACE_MASKWORDS];
+    char cpulist[MAXLINE_TSH];
+    long nbytes;
+    int nice, ioprio, cls;
+
+    memset(cpus, 0, sizeof(cpus));
+    nbytes = syscall(SYS_sched_getaffinity, pid, sizeof(cpus), cpus);
+    if (nbytes > 0) {
+        format_cpulist(cpus, nbytes * 8, cpulist, sizeof(cpulist));
+    } else {
+        strcpy(cpulist, "?");
+    }
+
+    errno = 0;
+    nice = getpriority(PRIO_PROCESS, pid);
+    if (errno != 0) {
+        nice = 0;
+    }
+
+    ioprio = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, pid);
+    cls = (ioprio < 0) ? IOCLASS_NONE : ioprio >> IOPRIO_CLASS_SHIFT;
+    if (cls < IOCLASS_NONE || cls > IOCLASS_IDLE) {
+        cls = IOCLASS_NONE;
+    }
+
+    if (cls == IOCLASS_NONE || cls == IOCLASS_IDLE) {
+        snprintf(buf, len, "cpus=%s nice=%d io=%s", cpulist, nice,
+                 ioclass_names[cls]);
+    } else {
+        snprintf(buf, len, "cpus=%s nice=%d io=%s:%d", cpulist, nice,
+                 ioclass_names[cls], ioprio & IOPRIO_LEVEL_MASK);
+    }
+}
+
+
+/*****************
+ * /proc access
+ *****************/
+
+/* proc_path - Build "/proc/<pid><suffix>" without using stdio */
+static char *proc_path(char *buf, pid_t pid, const char *suffix) {
+    char digits[16];
+    int n = 0;
+    char *p;
+
+    strcpy(buf, "/proc/");
+    p = buf + strlen(buf);
+    do {
+        digits[n++] = '0' + pid % 10;
+        pid /= 10;
+    } while (pid > 0);
+    while (n > 0) {
+        *p++ = digits[--n];
+    }
+    strcpy(p, suffix);
+    return buf;
+}
+
+/* proc_read_file - Read a small /proc file */
+ssize_t proc_read_file(const char *path, char *buf, size_t len) {
+    int fd;
+    ssize_t n;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        return -1;
+    }
+    n = read(fd, buf, len - 1);
+    close(fd);
+    if (n < 0) {
+        return -1;
+    }
+    buf[n] = '\0';
+    return n;
+}
+
+/*
+ * proc_stat_of - Process group and resident set size (in pages) of pid
+ * from /proc/<pid>/stat. Returns false if the process is gone.
+ */
+static bool proc_stat_of(pid_t pid, pid_t *pgrp, long *rss_pages) {
+    char path[PROC_PATHLEN];
+    char stat[512];
+    char *p;
+    int field;
+
+    if (proc_read_file(proc_path(path, pid, "/stat"), stat,
+                       sizeof(stat)) < 0) {
+        return false;
+    }
+    /* "pid (comm) state ppid pgrp ... rss ..." where comm may contain
+     * anything, so fields are counted from the last ')' (ending field 2) */
+    if ((p = strrchr(stat, ')')) == NULL) {
+        return false;
+    }
+    for (field = 2; field < 24 && p != NULL; field++) {
+        p = strchr(p + 1, ' ');
+        if (field + 1 == 5 && p != NULL) {
+            *pgrp = (pid_t)strtol(p + 1, NULL, 10);
+        }
+    }
+    if (p == NULL) {
+        return false;
+    }
+    *rss_pages = strtol(p + 1, NULL, 10);
+    return true;
+}
+
+/* proc_pgrp_of - Process group of pid, or -1 */
+static pid_t proc_pgrp_of(pid_t pid) {
+    pid_t pgrp;
+    long rss;
+
+    return proc_stat_of(pid, &pgrp, &rss) ? pgrp : -1;
+}
+
+/*
+ * scan_pids - Call visit(pid, arg) for each numeric entry of directory
+ * path as it is read, in large getdents64 batches, so that there is no
+ * limit on the number of entries.
+ */
+static void scan_pids(const char *path, proc_visit visit, void *arg) {
+    char buf[DIRENT_BUFSIZE];
+    struct proc_dirent *ent;
+    long nread, off;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+        return;
+    }
+    while ((nread = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+        for (off = 0; off < nread; off += ent->d_reclen) {
+            ent = (struct proc_dirent *)(buf + off);
+            if (isdigit((unsigned char)ent->d_name[0])) {
+                visit((pid_t)strtol(ent->d_name, NULL, 10), arg);
+            }
+        }
+    }
+    close(fd);
+}
+
+/* A walk over the members of a process group, for proc_pgrp_each */
+struct pgrp_walk
+{
+    pid_t pgid;
+    proc_visit visit;
+    void *arg;
+    int count;
+};
+
+/* visit_member - Pass pid on if it is in the group walked */
+static void visit_member(pid_t pid, void *arg) {
+    struct pgrp_walk *walk = arg;
+
+    if (proc_pgrp_of(pid) == walk->pgid) {
+        walk->visit(pid, walk->arg);
+        walk->count++;
+    }
+}
+
+/* proc_pgrp_each - Visit the processes in a process group */
+int proc_pgrp_each(pid_t pgid, proc_visit visit, void *arg) {
+    struct pgrp_walk walk;
+
+    walk.pgid = pgid;
+    walk.visit = visit;
+    walk.arg = arg;
+    walk.count = 0;
+    scan_pids("/proc", visit_member, &walk);
+    return walk.count;
+}
+
+/* A sampling of resident set sizes, for proc_pgrp_rss */
+struct rss_walk
+{
+    const pid_t *pgids;
+    long *rss_kb;
+    int n;
+    long page_kb;
+};
+
+/* add_rss - Add the resident set size of pid to its group's total */
+static void add_rss(pid_t pid, void *arg) {
+    struct rss_walk *walk = arg;
+    pid_t pgrp;
+    long rss;
+    int j;
+
+    if (!proc_stat_of(pid, &pgrp, &rss)) {
+        return;
+    }
+    for (j = 0; j < walk->n; j++) {
+        if (walk->pgids[j] == pgrp) {
+            walk->rss_kb[j] += rss * walk->page_kb;
+            return;
+        }
+    }
+}
+
+/* proc_pgrp_rss - Resident set sizes of several process groups */
+void proc_pgrp_rss(const pid_t *pgids, long *rss_kb, int n) {
+    struct rss_walk walk;
+    int j;
+
+    for (j = 0; j < n; j++) {
+        rss_kb[j] = 0;
+    }
+    walk.pgids = pgids;
+    walk.rss_kb = rss_kb;
+    walk.n = n;
+    walk.page_kb = sysconf(_SC_PAGESIZE) / 1024;
+    scan_pids("/proc", add_rss, &walk);
+}
+
+/*
+ * parse_fixed2 - Parse a decimal such as "12.34" at str in hundredths,
+ * without strtod (which is not async-signal-safe)
+ */
+static bool parse_fixed2(const char *str, long *x100) {
+    long whole = 0, frac = 0;
+    int digits = 0;
+
+    if (!isdigit((unsigned char)*str)) {
+        return false;
+    }
+    while (isdigit((unsigned char)*str)) {
+        whole = whole * 10 + (*str++ - '0');
+    }
+    if (*str == '.') {
+        str++;
+        while (isdigit((unsigned char)*str)) {
+            if (digits++ < 2) {
+                frac = frac * 10 + (*str - '0');
+            }
+            str++;
+        }
+    }
+    if (digits == 1) {
+        frac *= 10;
+    }
+    *x100 = whole * 100 + frac;
+    return true;
+}
+
+/* proc_loadavg - 1-minute load average in hundredths */
+bool proc_loadavg(long *load_x100) {
+    char buf[128];
+
+    if (proc_read_file("/proc/loadavg", buf, sizeof(buf)) < 0) {
+        return false;
+    }
+    return parse_fixed2(buf, load_x100);
+}
+
+/* proc_cpu_pressure - CPU "some" pressure over 10 seconds in hundredths */
+bool proc_cpu_pressure(long *some_x100) {
+    char buf[256];
+    char *p;
+
+    if (proc_read_file("/proc/pressure/cpu", buf, sizeof(buf)) < 0 ||
+        strncmp(buf, "some ", 5) != 0 ||
+        (p = strstr(buf, "avg10=")) == NULL) {
+        return false;
+    }
+    return parse_fixed2(p + 6, some_x100);
+}
+
+
+/*****************
+ * Applying placements
+ *****************/
+
+/* set_policy - Set the (non-realtime) scheduling policy of a task */
+static int set_policy(pid_t tid, int policy) {
+    struct sched_param param;
+
+    param.sched_priority = 0;
+    return syscall(SYS_sched_setscheduler, tid, policy, &param);
+}
+
+/* placement_apply_self - Apply a placement to the calling process */
+int placement_apply_self(const struct placement *place) {
+    if ((place->flags & PLACE_CPUS) &&
+        syscall(SYS_sched_setaffinity, 0, sizeof(place->cpus),
+                place->cpus) < 0) {
+        return -1;
+    }
+    if ((place->flags & PLACE_NICE) &&
+        setpriority(PRIO_PROCESS, 0, place->nice) < 0) {
+        return -1;
+    }
+    if ((place->flags & PLACE_IOPRIO) &&
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+                (place->io_class << IOPRIO_CLASS_SHIFT) |
+                place->io_level) < 0) {
+        return -1;
+    }
+    if ((place->flags & PLACE_POLICY) &&
+        set_policy(0, place->policy) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/* A placement being applied to a process group, thread by thread */
+struct place_walk
+{
+    const struct placement *place;
+    int err;                    // errno of the last failure, or 0
+};
+
+/* place_task - Apply the per-thread parts of a placement to tid */
+static void place_task(pid_t tid, void *arg) {
+    struct place_walk *walk = arg;
+    const struct placement *place = walk->place;
+
+    if ((place->flags & PLACE_CPUS) &&
+        syscall(SYS_sched_setaffinity, tid, sizeof(place->cpus),
+                place->cpus) < 0) {
+        walk->err = errno;
+    }
+    if ((place->flags & PLACE_POLICY) &&
+        set_policy(tid, place->policy) < 0) {
+        walk->err = errno;
+    }
+}
+
+/* place_member - Apply the per-thread parts of a placement to every
+ * thread of pid */
+static void place_member(pid_t pid, void *arg) {
+    char path[PROC_PATHLEN];
+
+    scan_pids(proc_path(path, pid, "/task"), place_task, arg);
+}
+
+/* placement_apply_pgrp - Apply a placement to a whole process group */
+int placement_apply_pgrp(pid_t pgid, const struct placement *place) {
+    struct place_walk walk;
+    int err = 0;
+
+    if ((place->flags & PLACE_NICE) &&
+        setpriority(PRIO_PGRP, pgid, place->nice) < 0) {
+        err = errno;
+    }
+    if ((place->flags & PLACE_IOPRIO) &&
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PGRP, pgid,
+                (place->io_class << IOPRIO_CLASS_SHIFT) |
+                place->io_level) < 0) {
+        err = errno;
+    }
+
+    /* Affinity and policy are per thread: visit every task of every
+     * member */
+    if (place->flags & (PLACE_CPUS | PLACE_POLICY)) {
+        walk.place = place;
+        walk.err = 0;
+        proc_pgrp_each(pgid, place_member, &walk);
+        err = (walk.err != 0) ? walk.err : err;
+    }
+
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+
+/*****************
+ * Signalling
+ *****************/
+
+/* proc_pidfd - Open a pidfd for a process */
+int proc_pidfd(pid_t pid) {
+    return syscall(SYS_pidfd_open, pid, 0);
+}
+
+/* proc_pidfd_signal - Send a signal to the process of a pidfd */
+int proc_pidfd_signal(int pidfd, int sig) {
+    return syscall(SYS_pidfd_send_signal, pidfd, sig, NULL, 0);
+}
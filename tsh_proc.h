@@ -0,0 +1,135 @@
+#ifndef __TSH_PROC_H__
+#define __TSH_PROC_H__
+
+/*
+ * tsh_proc.h: process placement and /proc helpers for tshlab
+ *
+ * A placement describes where and how eagerly a job runs: its CPU
+ * affinity, its nice value and its I/O priority. A placement is applied
+ * to a child before execve (launch prefixes), or to every process of a
+ * running job's process group (the renice builtin).
+ *
+ * The kernel interfaces are reached through raw system calls, so neither
+ * this header nor its users need _GNU_SOURCE. The routines that only read
+ * /proc or apply a placement are async-signal-safe.
+ */
+
+#include <sys/resource.h>
+#include "tsh_helper.h"
+
+// Which parts of a placement are set
+#define PLACE_CPUS      0x1     // CPU affinity
+#define PLACE_NICE      0x2     // nice value
+#define PLACE_IOPRIO    0x4     // I/O scheduling class and level
+#define PLACE_POLICY    0x8     // Scheduling policy (SCHED_OTHER or BATCH)
+
+#define PLACE_MAXCPUS   1024
+#define PLACE_MASKBITS  (8 * sizeof(unsigned long))
+#define PLACE_MASKWORDS (PLACE_MAXCPUS / PLACE_MASKBITS)
+
+// I/O scheduling classes (as ioprio_set)
+#define IOCLASS_NONE    0
+#define IOCLASS_RT      1
+#define IOCLASS_BE      2
+#define IOCLASS_IDLE    3
+
+struct placement
+{
+    unsigned flags;                     // PLACE_* parts that are set
+    unsigned long cpus[PLACE_MASKWORDS];// Allowed CPUs
+    int nice;                           // Absolute nice value
+    int io_class;                       // IOCLASS_*
+    int io_level;                       // 0 (highest) to 7 (lowest)
+    int policy;                         // SCHED_OTHER or SCHED_BATCH
+};
+
+#ifndef SCHED_BATCH
+#define SCHED_BATCH     3       // Linux; only defined with _GNU_SOURCE
+#endif
+
+/*
+ * parse_cpulist parses a CPU list such as "0-3,8,10-11" into the CPU mask
+ * of place. It returns false if the list is malformed or empty.
+ */
+bool parse_cpulist(const char *str, struct placement *place);
+
+/*
+ * parse_ioclass parses an I/O class given by number (1-3) or name
+ * ("realtime", "best-effort", "idle"), optionally followed by ":LEVEL".
+ * It returns false if the class or level is malformed.
+ */
+bool parse_ioclass(const char *str, struct placement *place);
+
+/*
+ * placement_apply_self applies a placement to the calling process.
+ * Returns 0 on success, or -1 with errno set. Async-signal-safe.
+ */
+int placement_apply_self(const struct placement *place);
+
+/*
+ * placement_apply_pgrp applies a placement to every process (and thread)
+ * in process group pgid. Returns 0 on success, or -1 with errno set if
+ * any part could not be applied.
+ */
+int placement_apply_pgrp(pid_t pgid, const struct placement *place);
+
+/*
+ * proc_sched_of stores the nice value and scheduling policy of process
+ * pid. Returns false if the process is gone. Async-signal-safe.
+ */
+bool proc_sched_of(pid_t pid, int *nice, int *policy);
+
+/*
+ * format_placement writes the current placement of process pid, as
+ * reported by the kernel, to buf (e.g. "cpus=0-3 nice=10 io=idle").
+ */
+void format_placement(pid_t pid, char *buf, size_t len);
+
+/*
+ * proc_pgrp_each calls visit(pid, arg) for each process in process group
+ * pgid, scanning /proc as it goes, and returns how many there were.
+ * Async-signal-safe if visit is.
+ */
+typedef void (*proc_visit)(pid_t pid, void *arg);
+
+int proc_pgrp_each(pid_t pgid, proc_visit visit, void *arg);
+
+/*
+ * proc_pgrp_rss sets rss_kb[i] to the total resident set size, in
+ * kbytes, of the processes in process group pgids[i], for each of the n
+ * groups. /proc is scanned once for all of them. Async-signal-safe.
+ */
+void proc_pgrp_rss(const pid_t *pgids, long *rss_kb, int n);
+
+/*
+ * proc_loadavg reads the 1-minute load average, in hundredths, from
+ * /proc/loadavg. Returns false if it is unavailable. Async-signal-safe.
+ */
+bool proc_loadavg(long *load_x100);
+
+/*
+ * proc_cpu_pressure reads the share of the last 10 seconds in which some
+ * task was stalled waiting for a CPU, in hundredths of a percent, from
+ * /proc/pressure/cpu. Returns false if the kernel has no PSI support.
+ * Async-signal-safe.
+ */
+bool proc_cpu_pressure(long *some_x100);
+
+/*
+ * proc_read_file reads up to len-1 bytes of a /proc file into buf and
+ * terminates it. Returns the number of bytes read, or -1 on failure.
+ * Async-signal-safe.
+ */
+ssize_t proc_read_file(const char *path, char *buf, size_t len);
+
+/*
+ * proc_pidfd opens a pidfd for process pid: a descriptor that refers to
+ * that process, and not to another that later takes over its pid.
+ * Returns -1 with errno set on failure: ESRCH if there is no such
+ * process, ENOSYS if the kernel has no pidfds. proc_pidfd_signal sends
+ * sig to the process of a pidfd.
+ */
+int proc_pidfd(pid_t pid);
+int proc_pidfd_signal(int pidfd, int sig);
+
+#endif // __TSH_PROC_H__
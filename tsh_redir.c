@@ -0,0 +1,275 @@
+/* tsh_redir.c
+ * I/O redirection planning and execution for tshlab
+ */
+
+#include <limits.h>
+#include <sys/syscall.h>
+
+#include "tsh_redir.h"
+
+/* memfd_create(2) and file sealing, which need _GNU_SOURCE in glibc */
+#define REDIR_MFD_CLOEXEC        0x0001U
+#define REDIR_MFD_ALLOW_SEALING  0x0002U
+#define REDIR_F_ADD_SEALS        (1024 + 9)
+#define REDIR_F_SEALS            (0x0001 | 0x0002 | 0x0004 | 0x0008)
+                                 /* seal, shrink, grow and write */
+
+/*
+ * redir_plan_build - Turn the parsed redirections into open/dup2 operations.
+ * Duplications of a descriptor onto itself, and duplications repeating the
+ * previous operation on the same descriptor, are dropped.
+ */
+void redir_plan_build(const struct cmdline_tokens *token,
+                      struct redir_plan *plan) {
+    int i;
+    const struct redirection *redir;
+    struct redir_op *op;
+    struct redir_op *prev;
+
+    plan->nops = 0;
+    for (i = 0; i < token->nredirs; i++) {
+        redir = &token->redirs[i];
+        prev = (plan->nops > 0) ? &plan->ops[plan->nops - 1] : NULL;
+        op = &plan->ops[plan->nops];
+
+        op->fd = redir->fd;
+        op->src_fd = -1;
+        op->flags = 0;
+        op->path = redir->path;
+
+        switch (redir->kind) {
+        case REDIR_IN:
+            op->kind = ROP_OPEN;
+            op->flags = O_RDONLY;
+            break;
+        case REDIR_OUT:
+            op->kind = ROP_OPEN;
+            op->flags = O_WRONLY | O_CREAT | O_TRUNC;
+            break;
+        case REDIR_APPEND:
+            op->kind = ROP_OPEN;
+            op->flags = O_WRONLY | O_CREAT | O_APPEND;
+            break;
+        case REDIR_DATA:
+            op->kind = ROP_DATA;
+            op->data = redir->data;
+            op->len = redir->len;
+            op->path = NULL;
+            break;
+        case REDIR_DUP:
+            if (redir->src_fd == redir->fd) {
+                continue;
+            }
+            if (prev != NULL && prev->kind == ROP_DUP2 &&
+                prev->fd == redir->fd && prev->src_fd == redir->src_fd) {
+                continue;
+            }
+            op->kind = ROP_DUP2;
+            op->src_fd = redir->src_fd;
+            op->path = NULL;
+            break;
+        }
+        plan->nops++;
+    }
+}
+
+/* redir_plan_keep - Keep a descriptor of the shell open in the child */
+void redir_plan_keep(struct redir_plan *plan, int fd) {
+    struct redir_op *op = &plan->ops[plan->nops++];
+
+    op->kind = ROP_KEEP;
+    op->fd = fd;
+    op->src_fd = -1;
+    op->flags = 0;
+    op->path = NULL;
+}
+
+/* write_all - Write len bytes of data to fd */
+static int write_all(int fd, const char *data, size_t len) {
+    ssize_t n;
+
+    while (len > 0) {
+        if ((n = write(fd, data, len)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * data_fd - A descriptor to read len bytes of data from: the read end of
+ * a pipe already holding them if they fit in its buffer, or else a
+ * sealed memory file. Returns -1 with errno set on failure.
+ */
+static int data_fd(const char *data, size_t len) {
+    int fds[2], fd, err;
+
+    if (len <= PIPE_BUF) {
+        /* an empty pipe takes PIPE_BUF bytes without blocking */
+        if (pipe(fds) < 0) {
+            return -1;
+        }
+        if (fcntl(fds[0], F_SETFD, FD_CLOEXEC) < 0 ||
+            write_all(fds[1], data, len) < 0) {
+            err = errno;
+            close(fds[0]);
+            close(fds[1]);
+            errno = err;
+            return -1;
+        }
+        close(fds[1]);
+        return fds[0];
+    }
+
+    if ((fd = syscall(SYS_memfd_create, "tsh-heredoc",
+                      REDIR_MFD_CLOEXEC | REDIR_MFD_ALLOW_SEALING)) < 0) {
+        return -1;
+    }
+    if (write_all(fd, data, len) < 0 ||
+        fcntl(fd, REDIR_F_ADD_SEALS, REDIR_F_SEALS) < 0 ||
+        lseek(fd, 0, SEEK_SET) < 0) {
+        err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+/* redir_plan_prepare - Put the text of here-documents in descriptors */
+int redir_plan_prepare(struct redir_plan *plan) {
+    struct redir_op *op;
+    int i, err;
+
+    for (i = 0; i < plan->nops; i++) {
+        op = &plan->ops[i];
+        if (op->kind == ROP_DATA &&
+            (op->src_fd = data_fd(op->data, op->len)) < 0) {
+            err = errno;
+            redir_plan_release(plan);
+            errno = err;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* redir_plan_release - Close the descriptors of redir_plan_prepare */
+void redir_plan_release(struct redir_plan *plan) {
+    struct redir_op *op;
+    int i;
+
+    for (i = 0; i < plan->nops; i++) {
+        op = &plan->ops[i];
+        if (op->kind == ROP_DATA && op->src_fd >= 0) {
+            close(op->src_fd);
+            op->src_fd = -1;
+        }
+    }
+}
+
+/* save_fd - Remember the current state of fd, once per plan execution */
+static void save_fd(struct redir_saved *saved, int fd) {
+    int i;
+
+    for (i = 0; i < saved->nsaved; i++) {
+        if (saved->fd[i] == fd) {
+            return;
+        }
+    }
+    saved->fd[saved->nsaved] = fd;
+    saved->copy[saved->nsaved] = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+    saved->nsaved++;
+}
+
+/* redir_plan_exec - Apply a redirection plan to the calling process */
+int redir_plan_exec(const struct redir_plan *plan, struct redir_saved *saved,
+                    const struct redir_op **failed) {
+    int i, tmp, err;
+    const struct redir_op *op;
+
+    if (saved != NULL) {
+        saved->nsaved = 0;
+    }
+
+    for (i = 0; i < plan->nops; i++) {
+        op = &plan->ops[i];
+        if (saved != NULL && op->kind != ROP_KEEP) {
+            save_fd(saved, op->fd);
+        }
+
+        if (op->kind == ROP_KEEP) {
+            if (fcntl(op->fd, F_SETFD, 0) < 0) {
+                goto fail;
+            }
+        } else if (op->kind == ROP_OPEN) {
+            if ((tmp = open(op->path, op->flags | O_CLOEXEC,
+                            REDIR_MODE)) < 0) {
+                goto fail;
+            }
+            if (tmp == op->fd) {
+                /* Landed on the target: it must survive execve */
+                if (fcntl(tmp, F_SETFD, 0) < 0) {
+                    goto fail;
+                }
+            } else {
+                if (dup2(tmp, op->fd) < 0) {
+                    err = errno;
+                    close(tmp);
+                    errno = err;
+                    goto fail;
+                }
+                /* In a child the CLOEXEC copy goes away at execve */
+                if (saved != NULL) {
+                    close(tmp);
+                }
+            }
+        } else if (dup2(op->src_fd, op->fd) < 0) {
+            goto fail;          // ROP_DUP2 or ROP_DATA
+        }
+    }
+    return 0;
+
+fail:
+    err = errno;
+    if (failed != NULL) {
+        *failed = op;
+    }
+    if (saved != NULL) {
+        redir_restore(saved);
+    }
+    errno = err;
+    return -1;
+}
+
+/* redir_restore - Undo a plan applied with a saved descriptor set */
+void redir_restore(struct redir_saved *saved) {
+    int i;
+
+    for (i = saved->nsaved - 1; i >= 0; i--) {
+        if (saved->copy[i] < 0) {
+            close(saved->fd[i]);
+        } else {
+            dup2(saved->copy[i], saved->fd[i]);
+            close(saved->copy[i]);
+        }
+    }
+    saved->nsaved = 0;
+}
+
+/* redir_strerror - Report why a redirection operation failed */
+void redir_strerror(const struct redir_op *op, int err) {
+    if (op->kind == ROP_OPEN) {
+        sio_printf("%s: %s\n", op->path, strerror(err));
+    } else if (op->kind == ROP_DATA) {
+        sio_printf("here-document: %s\n", strerror(err));
+    } else {
+        sio_printf("%d: %s\n", (op->kind == ROP_KEEP) ? op->fd : op->src_fd,
+                   strerror(err));
+    }
+}
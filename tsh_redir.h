@@ -0,0 +1,111 @@
+#ifndef __TSH_REDIR_H__
+#define __TSH_REDIR_H__
+
+/*
+ * tsh_redir.h: I/O redirection planning for tshlab
+ *
+ * A redirection plan is computed once in the shell from the redirections
+ * recorded by parseline, and then executed either in a freshly forked
+ * child (before execve) or around a builtin command in the shell itself.
+ *
+ * Executing a plan in the child only issues open/dup2/fcntl calls on data
+ * prepared by the parent, so it is async-signal-safe and performs no
+ * allocation. Every file is opened with O_CLOEXEC, so the temporary
+ * descriptors returned by open never need to be closed explicitly: they
+ * disappear at execve, and only the dup2'ed targets survive. The plan maps
+ * one-to-one onto posix_spawn file actions (addopen/adddup2).
+ *
+ * The text of a here-document or here-string is put in a descriptor by
+ * redir_plan_prepare, in the shell, before the plan is executed: a pipe
+ * if it fits in the pipe without blocking, and otherwise a sealed memory
+ * file (memfd). Either way nothing touches the file system, and there is
+ * no temporary file to remove; the child only dup2's the descriptor.
+ */
+
+#include "tsh_helper.h"
+
+/* Permissions for files created by output redirection (before umask) */
+#define REDIR_MODE  (DEF_MODE)
+
+typedef enum redir_op_kind
+{
+    ROP_OPEN,                   // open path, then move it onto fd
+    ROP_DUP2,                   // dup2(src_fd, fd)
+    ROP_DATA,                   // dup2 the descriptor holding data onto fd
+    ROP_KEEP                    // let fd, close-on-exec, survive execve
+} redir_op_kind;
+
+struct redir_op
+{
+    redir_op_kind kind;
+    int fd;                     // Target descriptor
+    int src_fd;                 // Source descriptor for ROP_DUP2
+    int flags;                  // open flags for ROP_OPEN
+    const char *path;           // File name for ROP_OPEN
+    const char *data;           // Text for ROP_DATA, of len bytes, which
+    size_t len;                 // redir_plan_prepare puts in src_fd
+};
+
+struct redir_plan
+{
+    int nops;                   // Number of operations
+    struct redir_op ops[MAXREDIRS + MAXPSUBS];
+};
+
+/*
+ * Descriptors saved by redir_plan_exec so that a redirection applied to
+ * the shell itself (for a builtin) can be undone by redir_restore.
+ */
+struct redir_saved
+{
+    int nsaved;
+    int fd[MAXREDIRS];          // Descriptor that was redirected
+    int copy[MAXREDIRS];        // Saved copy of it, or -1 if it was closed
+};
+
+/*
+ * redir_plan_build computes the sequence of operations that realizes the
+ * redirections in token, dropping operations that have no effect.
+ */
+void redir_plan_build(const struct cmdline_tokens *token,
+                      struct redir_plan *plan);
+
+/*
+ * redir_plan_keep adds to a plan run in a child the operation that keeps
+ * fd, a close-on-exec descriptor of the shell, open across execve.
+ */
+void redir_plan_keep(struct redir_plan *plan, int fd);
+
+/*
+ * redir_plan_prepare creates the descriptors holding the text of the
+ * here-documents and here-strings of a plan, in the shell. Returns 0 on
+ * success, or -1 with errno set after closing those already created.
+ * They are closed by redir_plan_release once the plan has been executed
+ * (in the shell) or the child has been forked.
+ */
+int redir_plan_prepare(struct redir_plan *plan);
+void redir_plan_release(struct redir_plan *plan);
+
+/*
+ * redir_plan_exec executes a plan in the calling process. If saved is not
+ * NULL, the previous state of every redirected descriptor is recorded in
+ * it first. Returns 0 on success. On failure returns -1 with errno set,
+ * stores the failing operation in *failed (if not NULL), and undoes any
+ * operations already applied when saved is not NULL.
+ * Async-signal-safe when saved is NULL.
+ */
+int redir_plan_exec(const struct redir_plan *plan, struct redir_saved *saved,
+                    const struct redir_op **failed);
+
+/*
+ * redir_restore undoes a redirection applied by redir_plan_exec.
+ */
+void redir_restore(struct redir_saved *saved);
+
+/*
+ * redir_strerror prints a diagnostic for a failed redirection operation
+ * using async-signal-safe output.
+ */
+void redir_strerror(const struct redir_op *op, int err);
+
+#endif // __TSH_REDIR_H__
@@ -0,0 +1,758 @@
+/* tsh_script.c
+ * scripts and compound commands for tshlab
+ */
+
+#include "tsh_script.h"
+#include "tsh_env.h"
+#include "tsh_brace.h"
+#include "tsh_func.h"
+
+/* Instructions */
+#define OP_CMD          0       // evaluate the command line text, from
+                                //   its words
+#define OP_JFALSE       1       // if the status is not 0, make it 0 and
+                                //   jump to target
+#define OP_JUMP         2       // jump to target
+#define OP_FOR_INIT     3       // expand the words text into loop slot
+#define OP_FOR_NEXT     4       // set variable text to the next word of
+                                //   loop slot, or jump to target
+#define OP_FUNC         5       // define function text as the body that
+                                //   follows, and jump to target past it
+#define OP_RETURN       6       // end of a function body
+
+/* Kinds of compound command, and where their compilation is at */
+#define CTL_FOR         0
+#define CTL_WHILE       1
+#define CTL_IF          2
+#define CTL_FUNC        3
+
+#define ST_COND         0       // before do, then or {
+#define ST_BODY         1       // after do, then or {
+#define ST_ELSE         2       // after else
+
+#define MAXNEST         32      /* max nesting of compound commands */
+#define MAXRUNS         64      /* max nesting of runs, as scripts
+                                   source scripts and functions call
+                                   functions */
+
+struct script_op
+{
+    int code;                   // OP_...
+    const char *text;           // Command line, words, or variable name
+    struct cmdline_words *words;// OP_CMD: the words of the command line,
+                                //   unless it is a command list
+    int slot;                   // Loop slot of a for
+    int target;                 // Jump target
+};
+
+struct script
+{
+    char *text;                 // The script, cut into statements
+    struct script_op *ops;      // The program
+    int nops;
+    int cap;
+    int nslots;                 // Loop slots: the deepest nesting of for
+    int refs;                   // References: the cache, the functions
+                                //   it defines and runs in progress
+    char *path;                 // Cache: the file compiled, and its
+    dev_t dev;                  //   identity, size and mtime then
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    struct script *next;
+};
+
+/* A compound command being compiled */
+struct ctl
+{
+    int kind;                   // CTL_...
+    int state;                  // ST_...
+    int loop;                   // Loops: instruction to jump back to
+    int pending;                // Jump to the end (or to else), to patch
+};
+
+struct compiler
+{
+    struct script *script;
+    const char *name;           // Name of the script, for diagnostics
+    int line;                   // Line being compiled
+    struct ctl stack[MAXNEST];  // Compound commands open
+    int depth;
+    int loops;                  // for loops open
+};
+
+/* A for loop being run */
+struct for_loop
+{
+    char *storage;              // Copies of the words
+    char **words;
+    char **braces;              // Those of them to brace-expand
+    struct brace_stream stream;
+    bool ran;                   // The body has run
+};
+
+/* Compiled scripts read by script_load */
+static struct script *cache = NULL;
+
+/* Nesting of script_run, and where each run is at */
+static int runs = 0;
+static struct
+{
+    const struct script *script;
+    const int *pc;              // Next instruction
+} frames[MAXRUNS];
+
+/* skip_space - Skip blanks */
+static char *skip_space(char *p) {
+    while (isspace((unsigned char)*p)) {
+        p++;
+    }
+    return p;
+}
+
+/*
+ * keyword - Test whether stmt starts with the word kw. Returns what
+ * follows it, or NULL.
+ */
+static char *keyword(char *stmt, const char *kw) {
+    size_t len = strlen(kw);
+
+    if (strncmp(stmt, kw, len) == 0 &&
+        (stmt[len] == '\0' || isspace((unsigned char)stmt[len]))) {
+        return skip_space(stmt + len);
+    }
+    return NULL;
+}
+
+/*
+ * func_header - Test whether stmt starts a function definition, NAME().
+ * Returns what follows it, or NULL, and sets *len to the length of NAME.
+ */
+static char *func_header(char *stmt, size_t *len) {
+    char *p;
+
+    if ((*len = env_name_len(stmt)) == 0) {
+        return NULL;
+    }
+    p = skip_space(stmt + *len);
+    if (p[0] != '(' || p[1] != ')') {
+        return NULL;
+    }
+    return skip_space(p + 2);
+}
+
+/* is_compound - Test whether stmt starts a compound command */
+static bool is_compound(char *stmt) {
+    size_t len;
+
+    return keyword(stmt, "for") != NULL || keyword(stmt, "while") != NULL ||
+           keyword(stmt, "if") != NULL || func_header(stmt, &len) != NULL;
+}
+
+/* script_is_keyword - Test whether line starts with a keyword */
+bool script_is_keyword(const char *line) {
+    static const char *const closing[] = { "do", "done", "then", "else",
+                                           "fi", "{", "}" };
+    char *stmt = skip_space((char *)line);
+    size_t i;
+
+    for (i = 0; i < sizeof(closing) / sizeof(closing[0]); i++) {
+        if (keyword(stmt, closing[i]) != NULL) {
+            return true;
+        }
+    }
+    return is_compound(stmt);
+}
+
+/* emit - Append an instruction to the program. Returns its index. */
+static int emit(struct compiler *c, int code, const char *text, int slot) {
+    struct script *s = c->script;
+    struct script_op *op;
+
+    if (s->nops == s->cap) {
+        s->cap = (s->cap > 0) ? 2 * s->cap : 16;
+        s->ops = Realloc(s->ops, s->cap * sizeof(s->ops[0]));
+    }
+    op = &s->ops[s->nops];
+    op->code = code;
+    op->text = text;
+    op->slot = slot;
+    op->target = -1;
+    op->words = NULL;
+    return s->nops++;
+}
+
+/*
+ * emit_cmd - Append an OP_CMD for the command line stmt, split into words
+ * now unless it is a command list: a list is run as a job of its own,
+ * which splits it. Returns its index.
+ */
+static int emit_cmd(struct compiler *c, const char *stmt) {
+    int pc = emit(c, OP_CMD, stmt, 0);
+    list_op op;
+
+    split_list(stmt, &op);
+    if (op == LIST_END) {
+        c->script->ops[pc].words = parse_words(stmt);
+    }
+    return pc;
+}
+
+/* syntax_error - Report a syntax error near what */
+static int syntax_error(struct compiler *c, const char *what) {
+    if (c->name != NULL) {
+        fprintf(stderr, "%s: line %d: syntax error near '%s'\n", c->name,
+                c->line, what);
+    } else {
+        fprintf(stderr, "Error: syntax error near '%s'\n", what);
+    }
+    return SCRIPT_ERROR;
+}
+
+/* heredoc_error - Report a here-document that its line does not end with */
+static int heredoc_error(struct compiler *c) {
+    if (c->name != NULL) {
+        fprintf(stderr, "%s: line %d: a here-document must be in the last "
+                "command of its line\n", c->name, c->line);
+    } else {
+        fprintf(stderr, "Error: a here-document must be in the last "
+                "command of its line\n");
+    }
+    return SCRIPT_ERROR;
+}
+
+/* open_ctl - Start compiling a compound command */
+static struct ctl *open_ctl(struct compiler *c, int kind) {
+    struct ctl *ctl = &c->stack[c->depth++];
+
+    ctl->kind = kind;
+    ctl->state = ST_COND;
+    ctl->loop = -1;
+    ctl->pending = -1;
+    return ctl;
+}
+
+/*
+ * compile_statement - Compile a statement: a command line, or a keyword
+ * with what follows it.
+ */
+static int compile_statement(struct compiler *c, char *stmt) {
+    struct ctl *ctl = (c->depth > 0) ? &c->stack[c->depth - 1] : NULL;
+    struct script_op *ops;
+    char *rest, *words;
+    size_t len;
+    int jump;
+
+    stmt = skip_space(stmt);
+    if (*stmt == '\0') {
+        return SCRIPT_OK;
+    }
+
+    if (is_compound(stmt) && c->depth == MAXNEST) {
+        return syntax_error(c, stmt);   // too deeply nested
+    }
+
+    if ((rest = keyword(stmt, "for")) != NULL) {
+        len = env_name_len(rest);
+        if (len == 0 || !isspace((unsigned char)rest[len]) ||
+            (words = keyword(skip_space(rest + len), "in")) == NULL) {
+            return syntax_error(c, stmt);
+        }
+        rest[len] = '\0';
+        ctl = open_ctl(c, CTL_FOR);
+        emit(c, OP_FOR_INIT, words, c->loops);
+        ctl->loop = ctl->pending = emit(c, OP_FOR_NEXT, rest, c->loops);
+        if (++c->loops > c->script->nslots) {
+            c->script->nslots = c->loops;
+        }
+        return SCRIPT_OK;
+    }
+    if ((rest = keyword(stmt, "while")) != NULL ||
+        (rest = keyword(stmt, "if")) != NULL) {
+        if (*rest == '\0') {
+            return syntax_error(c, stmt);
+        }
+        ctl = open_ctl(c, (*stmt == 'w') ? CTL_WHILE : CTL_IF);
+        ctl->loop = emit_cmd(c, rest);
+        return SCRIPT_OK;
+    }
+    if ((rest = func_header(stmt, &len)) != NULL) {
+        stmt[len] = '\0';
+        ctl = open_ctl(c, CTL_FUNC);
+        ctl->pending = emit(c, OP_FUNC, stmt, 0);
+        return compile_statement(c, rest);
+    }
+
+    ops = c->script->ops;
+    if ((rest = keyword(stmt, "do")) != NULL) {
+        if (ctl == NULL || ctl->kind == CTL_IF || ctl->state != ST_COND) {
+            return syntax_error(c, "do");
+        }
+        if (ctl->kind == CTL_WHILE) {
+            ctl->pending = emit(c, OP_JFALSE, NULL, 0);
+        }
+        ctl->state = ST_BODY;
+        return compile_statement(c, rest);
+    }
+    if ((rest = keyword(stmt, "then")) != NULL) {
+        if (ctl == NULL || ctl->kind != CTL_IF || ctl->state != ST_COND) {
+            return syntax_error(c, "then");
+        }
+        ctl->pending = emit(c, OP_JFALSE, NULL, 0);
+        ctl->state = ST_BODY;
+        return compile_statement(c, rest);
+    }
+    if ((rest = keyword(stmt, "{")) != NULL) {
+        if (ctl == NULL || ctl->kind != CTL_FUNC || ctl->state != ST_COND) {
+            return syntax_error(c, "{");
+        }
+        ctl->state = ST_BODY;
+        return compile_statement(c, rest);
+    }
+    if ((rest = keyword(stmt, "}")) != NULL) {
+        if (ctl == NULL || ctl->kind != CTL_FUNC || ctl->state != ST_BODY ||
+            *rest != '\0') {
+            return syntax_error(c, "}");
+        }
+        emit(c, OP_RETURN, NULL, 0);
+        c->script->ops[ctl->pending].target = c->script->nops;
+        c->depth--;
+        return SCRIPT_OK;
+    }
+    if ((rest = keyword(stmt, "else")) != NULL) {
+        if (ctl == NULL || ctl->kind != CTL_IF || ctl->state != ST_BODY) {
+            return syntax_error(c, "else");
+        }
+        jump = emit(c, OP_JUMP, NULL, 0);
+        c->script->ops[ctl->pending].target = c->script->nops;
+        ctl->pending = jump;
+        ctl->state = ST_ELSE;
+        return compile_statement(c, rest);
+    }
+    if ((rest = keyword(stmt, "done")) != NULL) {
+        if (ctl == NULL || ctl->kind == CTL_IF || ctl->state != ST_BODY ||
+            *rest != '\0') {
+            return syntax_error(c, "done");
+        }
+        jump = emit(c, OP_JUMP, NULL, 0);
+        ops = c->script->ops;
+        ops[jump].target = ctl->loop;
+        ops[ctl->pending].target = c->script->nops;
+        c->loops -= (ctl->kind == CTL_FOR);
+        c->depth--;
+        return SCRIPT_OK;
+    }
+    if ((rest = keyword(stmt, "fi")) != NULL) {
+        if (ctl == NULL || ctl->kind != CTL_IF || ctl->state == ST_COND ||
+            *rest != '\0') {
+            return syntax_error(c, "fi");
+        }
+        ops[ctl->pending].target = c->script->nops;
+        c->depth--;
+        return SCRIPT_OK;
+    }
+
+    /* a command line; before do or then, it is part of the condition */
+    if (ctl != NULL && ctl->state == ST_COND &&
+        (ctl->kind == CTL_FOR || ctl->kind == CTL_FUNC)) {
+        return syntax_error(c, stmt);
+    }
+    emit_cmd(c, stmt);
+    return SCRIPT_OK;
+}
+
+/*
+ * compile_line - Compile the statements of a line, which end at each ;
+ * (the commands of a list, joined by && and ||, stay together). The
+ * lines of here-documents follow the last statement, so only it may have
+ * any.
+ */
+static int compile_line(struct compiler *c, char *line) {
+    char *end;
+    list_op op;
+    int result;
+
+    if (*skip_space(line) == '#') {
+        return SCRIPT_OK;
+    }
+
+    while (true) {
+        end = line;
+        while (end += split_list(end, &op), op == LIST_AND || op == LIST_OR) {
+            end += 2;
+        }
+        *end = '\0';
+        if (op != LIST_END && heredoc_pending(line)) {
+            return heredoc_error(c);
+        }
+        if ((result = compile_statement(c, line)) != SCRIPT_OK) {
+            return result;
+        }
+        if (op == LIST_END) {
+            return SCRIPT_OK;
+        }
+        line = end + 1;
+    }
+}
+
+/*
+ * line_end - Find the newline ending the command line at line, which
+ * takes the lines of its here-documents along, counting them in *lineno.
+ * Returns NULL if it ends the text.
+ */
+static char *line_end(char *line, int *lineno) {
+    char *end = strchr(line, '\n');
+    bool pending = true;
+
+    /* the first newline at which no here-document is left open */
+    while (end != NULL) {
+        *end = '\0';
+        pending = heredoc_pending(line);
+        *end = '\n';
+        if (!pending) {
+            break;
+        }
+        (*lineno)++;
+        end = strchr(end + 1, '\n');
+    }
+    return end;
+}
+
+/* script_compile - Compile a script */
+int script_compile(const char *text, const char *name,
+                   struct script **script) {
+    struct compiler c;
+    struct script *s = Calloc(1, sizeof(*s));
+    char *line, *next;
+    int result = SCRIPT_OK;
+    int lineno = 0;
+
+    s->refs = 1;
+    s->text = Malloc(strlen(text) + 1);
+    strcpy(s->text, text);
+
+    c.script = s;
+    c.name = name;
+    c.line = 0;
+    c.depth = 0;
+    c.loops = 0;
+    for (line = s->text; line != NULL && result == SCRIPT_OK; line = next) {
+        c.line = ++lineno;          // where the command line starts
+        if (heredoc_pending(line)) {
+            result = SCRIPT_INCOMPLETE;
+            break;
+        }
+        if ((next = line_end(line, &lineno)) != NULL) {
+            *next++ = '\0';
+        }
+        result = compile_line(&c, line);
+    }
+    if (result == SCRIPT_OK && c.depth > 0) {
+        result = SCRIPT_INCOMPLETE;
+    }
+
+    if (result != SCRIPT_OK) {
+        script_release(s);
+        return result;
+    }
+    *script = s;
+    return SCRIPT_OK;
+}
+
+/* script_hold - Take a reference to a script */
+void script_hold(struct script *script) {
+    script->refs++;
+}
+
+/* script_release - Drop a reference to a script, freeing it at the last */
+void script_release(struct script *script) {
+    int i;
+
+    if (--script->refs > 0) {
+        return;
+    }
+    for (i = 0; i < script->nops; i++) {
+        parse_words_free(script->ops[i].words);
+    }
+    free(script->text);
+    free(script->ops);
+    free(script->path);
+    free(script);
+}
+
+/* same_file - Test whether a cached script was compiled from st */
+static bool same_file(const struct script *s, const struct stat *st) {
+    return s->dev == st->st_dev && s->ino == st->st_ino &&
+           s->size == st->st_size &&
+           s->mtime.tv_sec == st->st_mtim.tv_sec &&
+           s->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+/* read_file - Read the whole of an open file of size bytes */
+static char *read_file(int fd, off_t size) {
+    char *text = Malloc(size + 1);
+    off_t len = 0;
+    ssize_t n;
+
+    while (len < size && (n = read(fd, text + len, size - len)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            free(text);
+            return NULL;
+        }
+        len += n;
+    }
+    text[len] = '\0';
+    return text;
+}
+
+/* script_load - Get the compiled script at path */
+struct script *script_load(const char *path) {
+    struct script *s, **link;
+    struct stat st;
+    char *text;
+    int fd, result;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "source: %s: %s\n", path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+
+    for (link = &cache; (s = *link) != NULL; link = &s->next) {
+        if (strcmp(s->path, path) == 0) {
+            break;
+        }
+    }
+    if (s != NULL && same_file(s, &st)) {
+        close(fd);
+        return s;
+    }
+    if (s != NULL) {
+        /* it has changed, or path is another file now */
+        *link = s->next;
+        script_release(s);
+    }
+
+    text = read_file(fd, st.st_size);
+    close(fd);
+    if (text == NULL) {
+        fprintf(stderr, "source: %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    result = script_compile(text, path, &s);
+    free(text);
+    if (result == SCRIPT_INCOMPLETE) {
+        fprintf(stderr, "%s: unexpected end of file\n", path);
+    }
+    if (result != SCRIPT_OK) {
+        return NULL;
+    }
+
+    s->path = Malloc(strlen(path) + 1);
+    strcpy(s->path, path);
+    s->dev = st.st_dev;
+    s->ino = st.st_ino;
+    s->size = st.st_size;
+    s->mtime = st.st_mtim;
+    s->next = cache;
+    cache = s;
+    return s;
+}
+
+/* loop_free - Free the words of a for loop */
+static void loop_free(struct for_loop *loop) {
+    free(loop->storage);
+    free(loop->words);
+    free(loop->braces);
+    loop->storage = NULL;
+    loop->words = NULL;
+    loop->braces = NULL;
+}
+
+/*
+ * loop_start - Expand the words of a for loop. The expanded words are
+ * copied, as they do not outlive the next parseline; brace words are
+ * copied as they are, to be streamed.
+ */
+static void loop_start(struct for_loop *loop, const char *text) {
+    struct cmdline_tokens token;
+    parseline_return result;
+    size_t size = 0, len;
+    char *pos;
+    int i, j, nbraces = 0;
+
+    loop_free(loop);
+    loop->ran = false;
+
+    result = parseline(text, &token);
+    if (result == PARSELINE_ERROR || result == PARSELINE_EMPTY) {
+        brace_stream_init(&loop->stream, NULL, 0, NULL, 0);
+        return;
+    }
+
+    for (i = 0; i < token.argc; i++) {
+        size += strlen(token.argv[i]) + 1;
+    }
+    loop->storage = pos = Malloc(size);
+    loop->words = Malloc(token.argc * sizeof(char *));
+    loop->braces = Malloc((token.nbraces + 1) * sizeof(char *));
+
+    for (i = 0; i < token.argc; i++) {
+        len = strlen(token.argv[i]) + 1;
+        memcpy(pos, token.argv[i], len);
+        loop->words[i] = pos;
+        for (j = 0; j < token.nbraces; j++) {
+            if (token.braces[j] == token.argv[i]) {
+                loop->braces[nbraces++] = pos;
+                break;
+            }
+        }
+        pos += len;
+    }
+    brace_stream_init(&loop->stream, loop->words, token.argc, loop->braces,
+                      nbraces);
+}
+
+/*
+ * run - Run script from instruction pc to its end, or to the end of the
+ * function body pc is in
+ */
+static int run(struct script *script, int pc,
+               int (*eval_cmd)(const char *, const struct cmdline_words *,
+                               int),
+               int status) {
+    struct for_loop *loops;
+    struct for_loop *loop;
+    const struct script_op *op;
+    char word[MAXEXPAND];
+    long n;
+
+    if (runs == MAXRUNS) {
+        fprintf(stderr, "Error: scripts and functions nested too deeply\n");
+        return 1;
+    }
+    frames[runs].script = script;
+    frames[runs].pc = &pc;
+    runs++;
+    script_hold(script);
+    loops = Calloc(script->nslots + 1, sizeof(*loops));
+
+    while (pc < script->nops) {
+        op = &script->ops[pc++];
+        switch (op->code) {
+        case OP_CMD:
+            status = eval_cmd(op->text, op->words, status);
+            if (status == 128 + SIGINT) {
+                pc = script->nops;      // interrupted: stop the script
+            }
+            break;
+        case OP_JFALSE:
+            if (status != 0) {
+                status = 0;
+                pc = op->target;
+            }
+            break;
+        case OP_JUMP:
+            pc = op->target;
+            break;
+        case OP_FOR_INIT:
+            loop_start(&loops[op->slot], op->text);
+            break;
+        case OP_FOR_NEXT:
+            loop = &loops[op->slot];
+            if ((n = brace_next(&loop->stream, word, sizeof(word))) < 0) {
+                if (n == BRACE_FULL) {
+                    fprintf(stderr, "Error: for: word too long\n");
+                }
+                if (!loop->ran) {
+                    status = 0;
+                }
+                pc = op->target;
+            } else {
+                env_set(op->text, word);
+                loop->ran = true;
+            }
+            break;
+        case OP_FUNC:
+            func_define(op->text, script, pc);
+            pc = op->target;
+            break;
+        case OP_RETURN:
+            pc = script->nops;
+            break;
+        }
+    }
+
+    for (n = 0; n < script->nslots; n++) {
+        loop_free(&loops[n]);
+    }
+    free(loops);
+    runs--;
+    script_release(script);
+    return status;
+}
+
+/* script_peek - The command lines the innermost run evaluates next */
+int script_peek(const char **lines, const struct cmdline_words **words,
+                int max) {
+    const struct script *script;
+    const struct script_op *op;
+    int n = 0, pc, steps = 0;
+
+    if (runs == 0) {
+        return 0;
+    }
+    script = frames[runs - 1].script;
+    pc = *frames[runs - 1].pc;
+    while (n < max && pc < script->nops && steps++ < script->nops) {
+        op = &script->ops[pc];
+        if (op->code == OP_CMD) {
+            words[n] = op->words;
+            lines[n++] = op->text;
+            pc++;
+        } else if (op->code == OP_JUMP) {
+            pc = op->target;
+        } else {
+            break;              // depends on a status, or changes state
+        }
+    }
+    return n;
+}
+
+/* script_is_last - Whether the line being evaluated ends the script */
+bool script_is_last(void) {
+    const struct script *script;
+    int pc, steps = 0;
+
+    if (runs != 1) {
+        return false;
+    }
+    script = frames[0].script;
+    pc = *frames[0].pc;
+    while (pc < script->nops && script->ops[pc].code == OP_JUMP &&
+           steps++ < script->nops) {
+        pc = script->ops[pc].target;
+    }
+    return pc >= script->nops;
+}
+
+/* script_run - Run a script */
+int script_run(struct script *script,
+               int (*eval_cmd)(const char *, const struct cmdline_words *,
+                               int),
+               int status) {
+    return run(script, 0, eval_cmd, status);
+}
+
+/* script_call - Run the function body starting at entry */
+int script_call(struct script *script, int entry,
+                int (*eval_cmd)(const char *, const struct cmdline_words *,
+                                int),
+                int status) {
+    return run(script, entry, eval_cmd, status);
+}
@@ -0,0 +1,115 @@
+#ifndef __TSH_SCRIPT_H__
+#define __TSH_SCRIPT_H__
+
+/*
+ * tsh_script.h: scripts and compound commands for tshlab
+ *
+ * A script is a sequence of command lines and of the compound commands
+ *
+ *     for NAME in WORDS; do ...; done
+ *     while COMMAND; do ...; done
+ *     if COMMAND; then ...; [else ...;] fi
+ *     NAME() { ...; }
+ *
+ * where ; and a newline are interchangeable, and the commands between
+ * the keywords may be command lists (see split_list) or compound
+ * commands themselves. A command line with here-documents takes their
+ * lines along, so only the last command on it may have any. Lines
+ * starting with # are comments. Running a function definition defines
+ * the function (see tsh_func.h), whose body is then run in place by
+ * script_call.
+ *
+ * A script is compiled once into a flat program of instructions, with
+ * the control flow resolved into jumps, and its command lines are split
+ * into words as they are compiled (see parse_words), so running a loop
+ * does not scan its text again: each iteration only expands the words of
+ * the body afresh, since they may use the loop's variables. Command lists
+ * are kept as text, as each runs as a job that splits it. The WORDS of a
+ * for loop are expanded once, on entry, and brace ranges among them are
+ * streamed rather than stored.
+ *
+ * Scripts read by source are kept compiled, keyed by path and checked
+ * against the file's identity, size and mtime, so sourcing an unchanged
+ * script again skips reading and compiling it.
+ */
+
+#include "tsh_helper.h"
+
+/* script_compile results */
+#define SCRIPT_OK           0
+#define SCRIPT_INCOMPLETE   1   /* a compound command is not closed */
+#define SCRIPT_ERROR        2   /* syntax error, already reported */
+
+struct script;
+
+/*
+ * script_is_keyword returns true if line starts with a keyword: it is
+ * (or ends, in error) a compound command, which goes on until its
+ * closing keyword.
+ */
+bool script_is_keyword(const char *line);
+
+/*
+ * script_compile compiles text into *script, with one reference held by
+ * the caller. Syntax errors are reported with the line number, and name
+ * if it is not NULL. Nothing is stored unless it returns SCRIPT_OK.
+ */
+int script_compile(const char *text, const char *name,
+                   struct script **script);
+
+/*
+ * script_load returns the compiled script at path, reading and compiling
+ * it only if it is not cached or has changed. The reference is the
+ * cache's. Returns NULL after printing a diagnostic if it cannot be read
+ * or compiled.
+ */
+struct script *script_load(const char *path);
+
+/*
+ * script_run runs script, passing each command line to eval_cmd along
+ * with its words (see parse_words), or NULL if it is a command list or
+ * does not parse, and the status so far (for $?, starting from status);
+ * eval_cmd returns the command's exit status. Stops early if a command
+ * was interrupted by ctrl-c (status 128 + SIGINT). Returns the status of
+ * the script.
+ */
+int script_run(struct script *script,
+               int (*eval_cmd)(const char *, const struct cmdline_words *,
+                               int),
+               int status);
+
+/*
+ * script_call runs the body of a function, which starts at instruction
+ * entry of script, as script_run runs a script.
+ */
+int script_call(struct script *script, int entry,
+                int (*eval_cmd)(const char *, const struct cmdline_words *,
+                                int),
+                int status);
+
+/*
+ * script_peek stores in lines the next command lines (at most max) that
+ * the innermost script_run or script_call in progress evaluates for sure,
+ * whatever their status, and their words in words: up to the end of the
+ * script or function, or to the next instruction that depends on a status
+ * or sets a variable. They stay valid while it runs. Returns how many it
+ * stored.
+ */
+int script_peek(const char **lines, const struct cmdline_words **words,
+                int max);
+
+/*
+ * script_is_last tests whether the command line being evaluated is the
+ * last thing the outermost script_run in progress runs: after it, the
+ * script ends whatever its status. False within a function.
+ */
+bool script_is_last(void);
+
+/*
+ * script_hold takes a reference to script, and script_release drops
+ * one, freeing the script when none is left.
+ */
+void script_hold(struct script *script);
+void script_release(struct script *script);
+
+#endif // __TSH_SCRIPT_H__
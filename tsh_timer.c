@@ -0,0 +1,113 @@
+/* tsh_timer.c
+ * job deadlines for tshlab, driven by a single interval timer
+ */
+
+#include "tsh_timer.h"
+#include "tsh_governor.h"
+
+/* timer_now_ms - Current monotonic time in milliseconds */
+long timer_now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+/* parse_duration_ms - Parse a duration with an optional unit suffix */
+bool parse_duration_ms(const char *str, long *ms) {
+    char *end;
+    double value;
+    double scale;
+
+    value = strtod(str, &end);
+    if (end == str || value < 0) {
+        return false;
+    }
+
+    if (*end == '\0' || strcmp(end, "s") == 0) {
+        scale = 1000;
+    } else if (strcmp(end, "ms") == 0) {
+        scale = 1;
+    } else if (strcmp(end, "m") == 0) {
+        scale = 60 * 1000;
+    } else if (strcmp(end, "h") == 0) {
+        scale = 60 * 60 * 1000;
+    } else {
+        return false;
+    }
+
+    *ms = (long)(value * scale);
+    return true;
+}
+
+/* job_timer_arm - Arm the interval timer for the earliest deadline */
+void job_timer_arm(void) {
+    struct itimerval it;
+    struct job_t *job = NULL;
+    long next = governor_next_ms();
+    long deadline, delta;
+
+    while ((job = get_next_job(job)) != NULL) {
+        deadline = get_timeout_of_job(job)->deadline_ms;
+        if (deadline != 0 && (next == 0 || deadline < next)) {
+            next = deadline;
+        }
+    }
+
+    memset(&it, 0, sizeof(it));
+    if (next != 0) {
+        delta = next - timer_now_ms();
+        if (delta < 1) {
+            delta = 1;
+        }
+        it.it_value.tv_sec = delta / 1000;
+        it.it_value.tv_usec = (delta % 1000) * 1000;
+    }
+    setitimer(ITIMER_REAL, &it, NULL);
+}
+
+/* job_timer_tick - Signal the jobs whose deadline has passed */
+void job_timer_tick(void) {
+    struct job_t *job = NULL;
+    struct job_timeout *timeout;
+    unsigned flags;
+    pid_t pid;
+    long now = timer_now_ms();
+
+    governor_tick(now);
+
+    while ((job = get_next_job(job)) != NULL) {
+        timeout = get_timeout_of_job(job);
+        if (timeout->deadline_ms == 0 || timeout->deadline_ms > now) {
+            continue;
+        }
+
+        pid = get_pid_of_job(job);
+        flags = get_flags_of_job(job);
+        if (flags & JOB_TIMEDOUT) {
+            /* Grace period is over */
+            kill(-pid, SIGKILL);
+            timeout->deadline_ms = 0;
+            continue;
+        }
+
+        set_flags_of_job(job, flags | JOB_TIMEDOUT);
+        kill(-pid, timeout->sig);
+        if (get_state_of_job(job) == ST || get_state_of_job(job) == TH) {
+            /* A stopped job must run to act on the signal */
+            kill(-pid, SIGCONT);
+            set_state_of_job(job, BG);
+        }
+        timeout->deadline_ms = (timeout->grace_ms > 0)
+                               ? now + timeout->grace_ms : 0;
+    }
+
+    job_timer_arm();
+}
+
+/* job_timer_poll - Take the governor samples the last tick found due */
+void job_timer_poll(void) {
+    if (governor_sample()) {
+        job_timer_arm();
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef __TSH_TIMER_H__
+#define __TSH_TIMER_H__
+
+/*
+ * tsh_timer.h: job deadlines for tshlab
+ *
+ * All job deadlines share a single interval timer (ITIMER_REAL) that is
+ * always armed for the earliest pending deadline. SIGALRM interrupts the
+ * shell wherever it is waiting (sigsuspend in the foreground and wait
+ * paths, or the read of the next command line), and its handler calls
+ * job_timer_tick to act on every deadline that has passed. The same timer
+ * also wakes up the resource governor (see tsh_governor.h), whose samples
+ * are taken outside the handler, by job_timer_poll.
+ */
+
+#include "tsh_helper.h"
+
+#define TIMEOUT_DEFAULT_SIG    SIGTERM  /* signal sent at the deadline */
+#define TIMEOUT_DEFAULT_GRACE  2000     /* ms before the follow-up SIGKILL */
+
+/*
+ * timer_now_ms returns the current CLOCK_MONOTONIC time in milliseconds.
+ * It is async-signal-safe.
+ */
+long timer_now_ms(void);
+
+/*
+ * parse_duration_ms converts a duration such as "10", "1.5s", "250ms",
+ * "2m" or "1h" (seconds by default) to milliseconds. It returns false if
+ * the duration is malformed or negative.
+ */
+bool parse_duration_ms(const char *str, long *ms);
+
+/*
+ * job_timer_arm (re)arms the interval timer for the earliest deadline in
+ * the job list or governor sample, or disarms it if there is none.
+ * Signals must be blocked.
+ */
+void job_timer_arm(void);
+
+/*
+ * job_timer_tick notes the governor samples that are due, then signals
+ * every job whose deadline has passed: first with the job's timeout
+ * signal (marking it JOB_TIMEDOUT), then with SIGKILL once its grace
+ * period has also passed. It then re-arms the timer.
+ * Called from the SIGALRM handler with signals blocked.
+ */
+void job_timer_tick(void);
+
+/*
+ * job_timer_poll takes the governor samples that job_timer_tick found
+ * due, if any, and re-arms the timer. Called wherever the shell waits
+ * (after each sigsuspend, and before reading a command line).
+ * Signals must be blocked.
+ */
+void job_timer_poll(void);
+
+#endif // __TSH_TIMER_H__
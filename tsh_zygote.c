@@ -0,0 +1,487 @@
+/* tsh_zygote.c
+ * fork server for launching jobs in tshlab
+ */
+
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#include "tsh_zygote.h"
+#include "tsh_env.h"
+
+/* clone(2) flag, which needs _GNU_SOURCE in glibc */
+#define ZYGOTE_CLONE_PARENT  0x00008000
+
+/*
+ * A request, as sent to the zygote, followed by len bytes of strings:
+ * the argc words of argv, the envc entries of envp, the nassigns
+ * overrides, and the path of each ROP_OPEN operation of the plan, in
+ * order, each ending with a null byte. The descriptors come with it, in
+ * the order of fds.
+ */
+struct zygote_header
+{
+    pid_t pgid;
+    int report_fd;
+    int nfds;
+    int fds[ZYGOTE_MAXFDS];     // Their numbers in the shell
+    bool cloexec[ZYGOTE_MAXFDS];// Whether they were close-on-exec there
+    struct limit_set limits;
+    struct placement place;
+    struct redir_plan plan;     // Pointers not valid
+    int argc;
+    int envc;
+    int nassigns;
+    size_t len;
+};
+
+static int zygote_sock = -1;            // Shell's end of the socket
+static volatile pid_t zygote_child = 0; // Pid of the zygote
+
+/* send_all - Send len bytes, without SIGPIPE if the peer has gone */
+static int send_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    ssize_t n;
+
+    while (len > 0) {
+        if ((n = send(fd, p, len, MSG_NOSIGNAL)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* recv_all - Receive len bytes; returns 0, or -1 at end of file or error */
+static int recv_all(int fd, void *buf, size_t len) {
+    char *p = buf;
+    ssize_t n;
+
+    while (len > 0) {
+        if ((n = recv(fd, p, len, 0)) < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            if (n == 0) {
+                errno = EPIPE;
+            }
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * restore_fds - In the child, put the descriptors received at fds back
+ * at the numbers they had in the shell. Standard descriptors the shell
+ * did not have open are closed.
+ */
+static int restore_fds(const struct zygote_header *h, int *fds) {
+    int i, top = 2;
+    bool std[3] = { false, false, false };
+
+    for (i = 0; i < h->nfds; i++) {
+        top = (h->fds[i] > top) ? h->fds[i] : top;
+    }
+    /* out of the way of every target first */
+    for (i = 0; i < h->nfds; i++) {
+        if ((fds[i] = fcntl(fds[i], F_DUPFD_CLOEXEC, top + 1)) < 0) {
+            return -1;
+        }
+    }
+    for (i = 0; i < h->nfds; i++) {
+        if (dup2(fds[i], h->fds[i]) < 0) {
+            return -1;
+        }
+        if (h->cloexec[i]) {
+            fcntl(h->fds[i], F_SETFD, FD_CLOEXEC);
+        }
+        if (h->fds[i] <= 2) {
+            std[h->fds[i]] = true;
+        }
+    }
+    for (i = 0; i <= 2; i++) {
+        if (!std[i]) {
+            close(i);
+        }
+    }
+    return 0;
+}
+
+/*
+ * zygote_exec - In the child: join the process group, take the
+ * descriptors, apply the limits, placement and redirections, and execute
+ * the command, as the shell's children do. On failure the reason is
+ * written to the shell's status pipe. Never returns.
+ */
+static void zygote_exec(struct zygote_header *h, int *fds, char **argv,
+                        char **envp, char **assigns) {
+    struct exec_report report;
+    const struct redir_op *failed_op;
+
+    report.redir_op = -1;
+    setpgid(0, h->pgid);
+
+    if (restore_fds(h, fds) < 0) {
+        _exit(EXIT_NOEXEC);     // no status pipe to report on
+    }
+
+    if (limits_apply_self(&h->limits) < 0) {
+        report.stage = REPORT_LIMIT;
+        report.err = errno;
+        write(h->report_fd, &report, sizeof(report));
+        _exit(1);
+    }
+
+    if (placement_apply_self(&h->place) < 0) {
+        report.stage = REPORT_PLACE;
+        report.err = errno;
+        write(h->report_fd, &report, sizeof(report));
+        _exit(1);
+    }
+
+    if (redir_plan_exec(&h->plan, NULL, &failed_op) < 0) {
+        report.stage = REPORT_REDIR;
+        report.err = errno;
+        report.redir_op = failed_op - h->plan.ops;
+        write(h->report_fd, &report, sizeof(report));
+        _exit(1);
+    }
+
+    execve(argv[0], argv, env_override(envp, assigns, h->nassigns));
+
+    report.stage = REPORT_EXEC;
+    report.err = errno;
+    write(h->report_fd, &report, sizeof(report));
+    _exit(EXIT_NOEXEC);
+}
+
+/*
+ * recv_request - Receive a request: its header and descriptors, then
+ * its strings. Returns false at end of file (the shell has gone) or on
+ * error.
+ */
+static bool recv_request(int sock, struct zygote_header *h, int *fds,
+                         char **payload) {
+    char control[CMSG_SPACE(ZYGOTE_MAXFDS * sizeof(int))];
+    struct iovec iov = { h, sizeof(*h) };
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    ssize_t n;
+    int i, nfds = 0;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    while ((n = recvmsg(sock, &msg, 0)) < 0 && errno == EINTR) {
+        continue;
+    }
+    if (n <= 0) {
+        return false;
+    }
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(cmsg), nfds * sizeof(int));
+        }
+    }
+    for (i = 0; i < nfds; i++) {
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    if (recv_all(sock, (char *)h + n, sizeof(*h) - n) < 0 ||
+        nfds != h->nfds || (msg.msg_flags & MSG_CTRUNC)) {
+        for (i = 0; i < nfds; i++) {
+            close(fds[i]);
+        }
+        return false;
+    }
+    *payload = Malloc(h->len + 1);
+    if (recv_all(sock, *payload, h->len) < 0) {
+        free(*payload);
+        for (i = 0; i < nfds; i++) {
+            close(fds[i]);
+        }
+        return false;
+    }
+    (*payload)[h->len] = '\0';
+    return true;
+}
+
+/* take_strings - Point n slots of vec at the next n strings of a payload */
+static char *take_strings(char **vec, int n, char *p) {
+    int i;
+
+    for (i = 0; i < n; i++) {
+        vec[i] = p;
+        p += strlen(p) + 1;
+    }
+    vec[n] = NULL;
+    return p;
+}
+
+/*
+ * serve - The zygote's loop: fork a child for each request, and answer
+ * with its pid, or with -errno if it could not be forked. Returns when
+ * the shell closes its end.
+ */
+static void serve(int sock) {
+    struct zygote_header h;
+    int fds[ZYGOTE_MAXFDS];
+    char *payload, *p, **argv, **envp, **assigns;
+    int i, reply;
+    pid_t pid;
+
+    while (recv_request(sock, &h, fds, &payload)) {
+        argv = Malloc((h.argc + 1) * sizeof(argv[0]));
+        envp = Malloc((h.envc + h.nassigns + 1) * sizeof(envp[0]));
+        assigns = Malloc((h.nassigns + 1) * sizeof(assigns[0]));
+        p = take_strings(argv, h.argc, payload);
+        p = take_strings(envp, h.envc, p);
+        p = take_strings(assigns, h.nassigns, p);
+        for (i = 0; i < h.plan.nops; i++) {
+            h.plan.ops[i].data = NULL;
+            if (h.plan.ops[i].kind == ROP_OPEN) {
+                h.plan.ops[i].path = p;
+                p += strlen(p) + 1;
+            }
+        }
+
+        /* the child is the shell's, which reaps it */
+        pid = syscall(SYS_clone, ZYGOTE_CLONE_PARENT | SIGCHLD, 0, 0, 0, 0);
+        if (pid == 0) {
+            zygote_exec(&h, fds, argv, envp, assigns);
+        }
+        reply = (pid < 0) ? -errno : pid;
+
+        for (i = 0; i < h.nfds; i++) {
+            close(fds[i]);
+        }
+        free(assigns);
+        free(envp);
+        free(argv);
+        free(payload);
+        if (send_all(sock, &reply, sizeof(reply)) < 0) {
+            return;
+        }
+    }
+}
+
+/* zygote_start - Fork the zygote */
+bool zygote_start(void) {
+    int sv[2], null_fd;
+    pid_t pid;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        return false;
+    }
+    fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+    fcntl(sv[1], F_SETFD, FD_CLOEXEC);
+
+    if ((pid = fork()) < 0) {
+        close(sv[0]);
+        close(sv[1]);
+        return false;
+    }
+    if (pid == 0) {
+        close(sv[0]);
+        /* out of the terminal's way: ctrl-c and ctrl-z are not for it */
+        setpgid(0, 0);
+        /* the shell's children ignore these, so the zygote's must too */
+        signal(SIGTTIN, SIG_IGN);
+        signal(SIGTTOU, SIG_IGN);
+        /* do not hold the shell's input and output open */
+        if ((null_fd = open("/dev/null", O_RDWR)) >= 0) {
+            dup2(null_fd, STDIN_FILENO);
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+            if (null_fd > STDERR_FILENO) {
+                close(null_fd);
+            }
+        }
+        serve(sv[1]);
+        _exit(0);
+    }
+
+    close(sv[1]);
+    zygote_sock = sv[0];
+    zygote_child = pid;
+    return true;
+}
+
+/* zygote_running - Whether the zygote takes requests */
+bool zygote_running(void) {
+    return zygote_sock >= 0 && zygote_child != 0;
+}
+
+/* zygote_stop - Let go of the zygote, which exits when its socket closes */
+static void zygote_stop(void) {
+    int olderrno = errno;
+
+    if (zygote_sock >= 0) {
+        close(zygote_sock);
+        zygote_sock = -1;
+    }
+    errno = olderrno;
+}
+
+/* add_fd - Pass fd with a request, once, if the shell has it open */
+static void add_fd(struct zygote_header *h, int fd) {
+    int i, flags;
+
+    for (i = 0; i < h->nfds; i++) {
+        if (h->fds[i] == fd) {
+            return;
+        }
+    }
+    if (fd < 0 || (flags = fcntl(fd, F_GETFD)) < 0) {
+        return;
+    }
+    h->fds[h->nfds] = fd;
+    h->cloexec[h->nfds] = (flags & FD_CLOEXEC) != 0;
+    h->nfds++;
+}
+
+/* add_strings - Copy n strings into a payload; returns the end */
+static char *add_strings(char *p, char *const *vec, int n) {
+    size_t len;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        len = strlen(vec[i]) + 1;
+        memcpy(p, vec[i], len);
+        p += len;
+    }
+    return p;
+}
+
+/* count_strings - Number of strings in a null-terminated vector */
+static int count_strings(char *const *vec) {
+    int n = 0;
+
+    while (vec[n] != NULL) {
+        n++;
+    }
+    return n;
+}
+
+/* strings_len - Total length of n strings, with their null bytes */
+static size_t strings_len(char *const *vec, int n) {
+    size_t len = 0;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        len += strlen(vec[i]) + 1;
+    }
+    return len;
+}
+
+/* zygote_spawn - Have the zygote fork a child */
+pid_t zygote_spawn(const struct zygote_spawn *req) {
+    static struct zygote_header h;
+    char control[CMSG_SPACE(ZYGOTE_MAXFDS * sizeof(int))];
+    struct iovec iov = { &h, sizeof(h) };
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    const struct redir_op *op;
+    char *payload, *p;
+    ssize_t n;
+    int i, reply;
+
+    if (!zygote_running()) {
+        errno = ESRCH;
+        return -1;
+    }
+
+    memset(&h, 0, sizeof(h));
+    h.pgid = req->pgid;
+    h.report_fd = req->report_fd;
+    h.limits = *req->limits;
+    h.place = *req->place;
+    h.plan = *req->plan;
+    h.argc = count_strings(req->argv);
+    h.envc = count_strings(req->envp);
+    h.nassigns = req->nassigns;
+
+    /* every descriptor the plan reads from, and the status pipe */
+    add_fd(&h, STDIN_FILENO);
+    add_fd(&h, STDOUT_FILENO);
+    add_fd(&h, STDERR_FILENO);
+    for (i = 0; i < req->plan->nops; i++) {
+        op = &req->plan->ops[i];
+        if (op->kind == ROP_DUP2 || op->kind == ROP_DATA) {
+            add_fd(&h, op->src_fd);
+        } else if (op->kind == ROP_KEEP) {
+            add_fd(&h, op->fd);
+        }
+    }
+    add_fd(&h, req->report_fd);
+
+    h.len = strings_len(req->argv, h.argc) +
+            strings_len(req->envp, h.envc) +
+            strings_len(req->assigns, h.nassigns);
+    for (i = 0; i < req->plan->nops; i++) {
+        if (req->plan->ops[i].kind == ROP_OPEN) {
+            h.len += strlen(req->plan->ops[i].path) + 1;
+        }
+    }
+    p = payload = Malloc(h.len);
+    p = add_strings(p, req->argv, h.argc);
+    p = add_strings(p, req->envp, h.envc);
+    p = add_strings(p, req->assigns, h.nassigns);
+    for (i = 0; i < req->plan->nops; i++) {
+        if (req->plan->ops[i].kind == ROP_OPEN) {
+            p = add_strings(p, (char *const *)&req->plan->ops[i].path, 1);
+        }
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(h.nfds * sizeof(int));
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(h.nfds * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), h.fds, h.nfds * sizeof(int));
+
+    while ((n = sendmsg(zygote_sock, &msg, MSG_NOSIGNAL)) < 0 &&
+           errno == EINTR) {
+        continue;
+    }
+    if (n < 0 ||
+        send_all(zygote_sock, (char *)&h + n, sizeof(h) - n) < 0 ||
+        send_all(zygote_sock, payload, h.len) < 0 ||
+        recv_all(zygote_sock, &reply, sizeof(reply)) < 0) {
+        free(payload);
+        zygote_stop();
+        return -1;
+    }
+    free(payload);
+
+    if (reply < 0) {
+        errno = -reply;
+        return -1;
+    }
+    return reply;
+}
+
+/* zygote_reaped - Whether a reaped child was the zygote */
+bool zygote_reaped(pid_t pid) {
+    if (pid == 0 || pid != zygote_child) {
+        return false;
+    }
+    zygote_child = 0;
+    return true;
+}
@@ -0,0 +1,74 @@
+#ifndef __TSH_ZYGOTE_H__
+#define __TSH_ZYGOTE_H__
+
+/*
+ * tsh_zygote.h: a fork server for launching jobs in tshlab
+ *
+ * Forking copies the page tables of the whole process, so every fork in
+ * eval gets slower as the shell's heap grows (history, compiled scripts,
+ * the environment, the job table). The zygote is a small process forked
+ * from the shell when it starts, before any of that, that forks the
+ * children of jobs in its place.
+ *
+ * The shell sends it a request over a Unix socket: the argv and envp of
+ * the command, the process group to put it in, its resource limits and
+ * placement, and its redirection plan, along with the descriptors the
+ * plan uses (the shell's standard descriptors among them), passed with
+ * SCM_RIGHTS. The zygote forks the child with CLONE_PARENT, so that the
+ * child is the shell's, not the zygote's: the shell tracks, signals and
+ * reaps it as if it had forked it. The child puts each descriptor back
+ * at the number it had in the shell, executes the plan there, and
+ * reports a failed launch over the shell's status pipe just the same.
+ *
+ * The zygote is optional: it is started if $TSH_ZYGOTE is set (and not
+ * 0) when the shell starts. If it is not running, or goes away, the
+ * shell forks as usual.
+ */
+
+#include "tsh_helper.h"
+#include "tsh_limit.h"
+#include "tsh_proc.h"
+#include "tsh_redir.h"
+
+/* Max descriptors passed with a request */
+#define ZYGOTE_MAXFDS   (3 + MAXREDIRS + MAXPSUBS + 1)
+
+struct zygote_spawn
+{
+    char *const *argv;          // The command
+    char *const *envp;          // Its environment, as from env_envp
+    char *const *assigns;       // NAME=value overrides of envp
+    int nassigns;
+    pid_t pgid;                 // Process group to join, or 0 for its own
+    const struct limit_set *limits;
+    const struct placement *place;
+    const struct redir_plan *plan;  // Redirections, prepared
+    int report_fd;              // Where the child reports a failed launch,
+                                // as struct exec_report
+};
+
+/*
+ * zygote_start forks the zygote. It must be called before the shell
+ * installs its signal handlers. Returns false if it could not be started.
+ */
+bool zygote_start(void);
+
+/*
+ * zygote_running tests whether the zygote is there to take requests.
+ */
+bool zygote_running(void);
+
+/*
+ * zygote_spawn has the zygote fork a child as described by req, and
+ * returns its pid. Returns -1 with errno set if the zygote could not
+ * fork it; the zygote is then stopped if it did not answer.
+ */
+pid_t zygote_spawn(const struct zygote_spawn *req);
+
+/*
+ * zygote_reaped tests whether pid, reaped by the shell, was the zygote,
+ * which is then no longer used. Async-signal-safe.
+ */
+bool zygote_reaped(pid_t pid);
+
+#endif // __TSH_ZYGOTE_H__